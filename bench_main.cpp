@@ -0,0 +1,427 @@
+/* 046267 Computer Architecture - HW #4 */
+/* Simulator throughput benchmark, over synthetic images */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include "core_api.h"
+#include "sim_api.h"
+
+static void usage(const char * prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-N list] [-I list] [-l load%%] [-s store%%] [-L lat]\n"
+            "          [-S lat] [-O cycles] [-D words] [-w warmups] [-r reps]\n"
+            "          [--seed n] [--json]\n"
+            "       %s --gen <image> [-N threads] [-I instructions] [...]\n"
+            "  -N       Thread counts, default 1,16,256,4096.\n"
+            "  -I       Instructions of a run, all threads together, default\n"
+            "           100,1000,...,10000000. Points with fewer instructions\n"
+            "           than threads are skipped.\n"
+            "  -l, -s   Percentage of LOADs and of STOREs, default 20 and 10.\n"
+            "  -L, -S   LOAD and STORE latencies, default 4 and 2.\n"
+            "  -O       Context-switch penalty, default 2.\n"
+            "  -D       Data words the LOADs and STOREs access, default 4096.\n"
+            "  -w, -r   Untimed warm-up runs and timed runs of each point,\n"
+            "           default 1 and 5. The median run is reported.\n"
+            "  --gen    Only write the image of a point, to <image>.\n",
+            prog, prog);
+}
+
+/**
+ * @brief Parameters of a synthetic image.
+ */
+struct gen_config
+{
+    int threads;
+    long instructions;  // of all threads together, HALTs included
+    int load_pct;
+    int store_pct;
+    int load_lat;
+    int store_lat;
+    int switch_cycles;
+    int data_words;
+    uint64_t seed;
+};
+
+struct bench_result
+{
+    const char * mode;
+    int threads;
+    size_t instructions;
+    size_t cycles;
+    double seconds;     // median
+    double min_seconds;
+    double max_seconds;
+};
+
+/**
+ * @brief Seeded random numbers (SplitMix64), the same on every host.
+ */
+class Random
+{
+private:
+    uint64_t m_state;
+
+public:
+    explicit Random(uint64_t seed) : m_state(seed) {}
+
+    uint64_t next()
+    {
+        uint64_t z = (m_state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    /**
+     * @brief Get a number in [0, bound).
+     */
+    int below(int bound)
+    {
+        return (int)(next() % (uint64_t)bound);
+    }
+};
+
+/**
+ * @brief Write a synthetic image: a random program per thread, of LOADs and
+ * STOREs to the first `data_words` words, and ALU operations, ending with
+ * HALT. The threads' programs share the instructions evenly. $0 is never
+ * written, and serves as the base of all data accesses.
+ * @return `false` if the file cannot be written.
+ */
+static bool generate_image(const char * fname, const gen_config &config)
+{
+    static const char * const alu_ops[4] = { "ADD", "SUB", "ADDI", "SUBI" };
+    FILE * file = fopen(fname, "w");
+    Random random(config.seed);
+
+    if (file == NULL)
+    {
+        return false;
+    }
+
+    fprintf(file, "L%d\nS%d\nO%d\nN%d\n",
+            config.load_lat,
+            config.store_lat,
+            config.switch_cycles,
+            config.threads);
+
+    for (int tid = 0; tid < config.threads; ++tid)
+    {
+        long length = config.instructions / config.threads +
+                      (tid < config.instructions % config.threads);
+
+        fprintf(file, "\nT%d\nI@0x0\n", tid);
+        for (long i = 1; i < length; ++i)
+        {
+            int kind = random.below(100);
+            int addr = 4 * random.below(config.data_words);
+
+            if (kind < config.load_pct)
+            {
+                fprintf(file, "LOAD $%d, $0, 0x%X\n",
+                        1 + random.below(REGS_COUNT - 1), addr);
+            }
+            else if (kind < config.load_pct + config.store_pct)
+            {
+                fprintf(file, "STORE $0, $%d, 0x%X\n",
+                        random.below(REGS_COUNT), addr);
+            }
+            else
+            {
+                int op = random.below(4);
+                int dst = 1 + random.below(REGS_COUNT - 1);
+                int src1 = random.below(REGS_COUNT);
+
+                if (op < 2)
+                {
+                    fprintf(file, "%s $%d, $%d, $%d\n", alu_ops[op], dst,
+                            src1, random.below(REGS_COUNT));
+                }
+                else
+                {
+                    fprintf(file, "%s $%d, $%d, %d\n", alu_ops[op], dst,
+                            src1, random.below(16));
+                }
+            }
+        }
+        fprintf(file, "HALT\n");
+    }
+
+    return fclose(file) == 0;
+}
+
+/**
+ * @brief Parse a comma separated list of positive values, e.g. "1,16,256".
+ * @return `false` on a syntax error.
+ */
+static bool parse_list(const char * str, std::vector<long> &values)
+{
+    values.clear();
+    while (*str)
+    {
+        char * end;
+        long value = strtol(str, &end, 0);
+
+        if (end == str || value <= 0)
+        {
+            return false;
+        }
+        values.push_back(value);
+
+        if (*end == ',')
+        {
+            ++end;
+        }
+        else if (*end != '\0')
+        {
+            return false;
+        }
+        str = end;
+    }
+    return !values.empty();
+}
+
+/**
+ * @brief Time the runs of a mode over the loaded image.
+ */
+static bench_result run_mode(SimInstance * sim,
+                             mt_mode mode,
+                             int warmups,
+                             int reps)
+{
+    std::vector<double> seconds;
+    bench_result result;
+
+    for (int rep = -warmups; rep < reps; ++rep)
+    {
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        if (mode == MT_BLOCKED)
+        {
+            CORE_BlockedMT_r(sim);
+        }
+        else
+        {
+            CORE_FinegrainedMT_r(sim);
+        }
+        std::chrono::duration<double> time =
+            std::chrono::steady_clock::now() - start;
+
+        if (rep >= 0)
+        {
+            seconds.push_back(time.count());
+        }
+    }
+    std::sort(seconds.begin(), seconds.end());
+
+    result.mode = mode == MT_BLOCKED ? "blocked" : "finegrained";
+    result.threads = SIM_GetThreadsNum_r(CORE_Memory(sim));
+    if (mode == MT_BLOCKED)
+    {
+        result.instructions = CORE_BlockedMT_Instructions_r(sim);
+        result.cycles = CORE_BlockedMT_Cycles_r(sim);
+    }
+    else
+    {
+        result.instructions = CORE_FinegrainedMT_Instructions_r(sim);
+        result.cycles = CORE_FinegrainedMT_Cycles_r(sim);
+    }
+    result.seconds = seconds[seconds.size() / 2];
+    result.min_seconds = seconds.front();
+    result.max_seconds = seconds.back();
+    return result;
+}
+
+static void print_csv(const std::vector<bench_result> &results)
+{
+    printf("mode,threads,instructions,cycles,seconds,min_seconds,max_seconds,"
+           "cycles_per_second,instructions_per_second\n");
+    for (const bench_result &r : results)
+    {
+        printf("%s,%d,%zu,%zu,%.6f,%.6f,%.6f,%.0f,%.0f\n",
+               r.mode,
+               r.threads,
+               r.instructions,
+               r.cycles,
+               r.seconds,
+               r.min_seconds,
+               r.max_seconds,
+               r.cycles / r.seconds,
+               r.instructions / r.seconds);
+    }
+}
+
+static void print_json(const std::vector<bench_result> &results)
+{
+    printf("[\n");
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const bench_result &r = results[i];
+        printf("  {\"mode\": \"%s\", \"threads\": %d, \"instructions\": %zu, "
+               "\"cycles\": %zu, \"seconds\": %.6f, \"min_seconds\": %.6f, "
+               "\"max_seconds\": %.6f, \"cycles_per_second\": %.0f, "
+               "\"instructions_per_second\": %.0f}%s\n",
+               r.mode,
+               r.threads,
+               r.instructions,
+               r.cycles,
+               r.seconds,
+               r.min_seconds,
+               r.max_seconds,
+               r.cycles / r.seconds,
+               r.instructions / r.seconds,
+               i + 1 < results.size() ? "," : "");
+    }
+    printf("]\n");
+}
+
+int main(int argc, char const * argv[])
+{
+    gen_config config = { 0, 0, 20, 10, 4, 2, 2, 4096, 1 };
+    std::vector<long> threads = { 1, 16, 256, 4096 };
+    std::vector<long> instructions = { 100, 1000, 10000, 100000, 1000000,
+                                       10000000 };
+    const char * gen_fname = NULL;
+    int warmups = 1;
+    int reps = 5;
+    bool json = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const char * opt = argv[i];
+        if (strcmp(opt, "--json") == 0)
+        {
+            json = true;
+            continue;
+        }
+        if (i + 1 >= argc || opt[0] != '-')
+        {
+            usage(argv[0]);
+            return 2;
+        }
+
+        const char * arg = argv[++i];
+        bool ok = true;
+        if (strcmp(opt, "--gen") == 0)
+        {
+            gen_fname = arg;
+            continue;
+        }
+        if (strcmp(opt, "--seed") == 0)
+        {
+            config.seed = strtoull(arg, NULL, 0);
+            continue;
+        }
+        if (strlen(opt) != 2)
+        {
+            usage(argv[0]);
+            return 2;
+        }
+        switch (opt[1])
+        {
+            case 'N': ok = parse_list(arg, threads); break;
+            case 'I': ok = parse_list(arg, instructions); break;
+            case 'l': config.load_pct = atoi(arg); break;
+            case 's': config.store_pct = atoi(arg); break;
+            case 'L': config.load_lat = atoi(arg); break;
+            case 'S': config.store_lat = atoi(arg); break;
+            case 'O': config.switch_cycles = atoi(arg); break;
+            case 'D': config.data_words = atoi(arg); break;
+            case 'w': warmups = atoi(arg); break;
+            case 'r': reps = atoi(arg); break;
+            default:
+                usage(argv[0]);
+                return 2;
+        }
+        if (!ok)
+        {
+            fprintf(stderr, "Invalid list: %s\n", arg);
+            return 2;
+        }
+    }
+
+    if (config.load_pct < 0 || config.store_pct < 0 ||
+        config.load_pct + config.store_pct > 100 ||
+        config.load_lat < 0 || config.store_lat < 0 ||
+        config.switch_cycles < 0 || config.data_words <= 0 ||
+        warmups < 0 || reps <= 0)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (gen_fname != NULL)
+    {
+        config.threads = (int)threads.front();
+        config.instructions = std::max(instructions.front(), threads.front());
+        if (!generate_image(gen_fname, config))
+        {
+            fprintf(stderr, "Failed writing %s\n", gen_fname);
+            exit(2);
+        }
+        return 0;
+    }
+
+    const char * tmpdir = getenv("TMPDIR");
+    std::string image = std::string(tmpdir != NULL ? tmpdir : "/tmp") +
+                        "/sim_bench_XXXXXX";
+    int fd = mkstemp(&image[0]);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Failed creating %s\n", image.c_str());
+        exit(2);
+    }
+    close(fd);
+
+    std::vector<bench_result> results;
+    for (long n : threads)
+    {
+        for (long count : instructions)
+        {
+            gen_config point = config;
+            SimInstance * sim;
+
+            if (count < n)
+            {
+                continue;
+            }
+            point.threads = (int)n;
+            point.instructions = count;
+            point.seed = config.seed * 1000003 + n * 131 + count;
+
+            sim = CORE_Create();
+            if (sim == NULL ||
+                !generate_image(image.c_str(), point) ||
+                CORE_Load(sim, image.c_str()) != 0)
+            {
+                fprintf(stderr, "Failed generating the image of %ld threads "
+                        "and %ld instructions\n", n, count);
+                unlink(image.c_str());
+                exit(2);
+            }
+
+            results.push_back(run_mode(sim, MT_BLOCKED, warmups, reps));
+            results.push_back(run_mode(sim, MT_FINEGRAINED, warmups, reps));
+            CORE_Destroy(sim);
+        }
+    }
+    unlink(image.c_str());
+
+    if (json)
+    {
+        print_json(results);
+    }
+    else
+    {
+        print_csv(results);
+    }
+    return 0;
+}
@@ -0,0 +1,32 @@
+/* 046267 Computer Architecture - HW #4 */
+/* Image compiler: converts a memory image into a binary one */
+
+#include <stdio.h>
+#include "core_api.h"
+#include "sim_api.h"
+
+int main(int argc, char const * argv[])
+{
+    if (argc != 3)
+    {
+        fprintf(stderr, "Usage: %s <image> <binary image>\n", argv[0]);
+        return 2;
+    }
+
+    SimMemory * mem = SIM_MemCreate();
+    if (mem == NULL || SIM_MemReset_r(mem, argv[1]) != 0)
+    {
+        fprintf(stderr, "Failed loading %s\n", argv[1]);
+        exit(2);
+    }
+
+    if (SIM_MemSave_r(mem, argv[2]) != 0)
+    {
+        fprintf(stderr, "Failed writing %s\n", argv[2]);
+        SIM_MemDestroy(mem);
+        exit(2);
+    }
+
+    SIM_MemDestroy(mem);
+    return 0;
+}
@@ -1,379 +1,3993 @@
 /* 046267 Computer Architecture - HW #4 */
 
 #include <vector>
+#include <deque>
+#include <algorithm>
+#include <queue>
+#include <functional>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <memory>
+#include <new>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <system_error>
+#include <exception>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <cmath>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "core_api.h"
 #include "sim_api.h"
 
-class Thread;
+// Performance counters, for CORE_GetStats. Without them, the counting
+// compiles out.
+#ifndef SIM_STATS
+#define SIM_STATS 0
+#endif
 
-/* ----- globals ----- */
+#if SIM_STATS
+#define STAT_ADD(counter, value) ((counter) += (value))
+#else
+#define STAT_ADD(counter, value) ((void)sizeof(value))
+#endif
 
-std::vector<Thread> g_fg_threads;
-size_t g_fg_cycles = 0;
-size_t g_fg_retire_count = 0;
+// Cycle trace, for CORE_TraceOpen. Without it, the tracing compiles out.
+#ifndef SIM_TRACE
+#define SIM_TRACE 0
+#endif
 
-std::vector<Thread> g_b_threads;
-size_t g_b_cycles = 0;
-size_t g_b_retire_count = 0;
+#if SIM_TRACE
+#define TRACE(buffer, ...) \
+    do { if (buffer) { (buffer)->push(__VA_ARGS__); } } while (0)
+#define TRACE_STALL(buffer, ...) \
+    do { if (buffer) { (buffer)->stall(__VA_ARGS__); } } while (0)
+#define TRACE_SWITCH(buffer) \
+    do { if (buffer) { (buffer)->switched(); } } while (0)
+#else
+#define TRACE(buffer, ...) ((void)0)
+#define TRACE_STALL(buffer, ...) ((void)0)
+#define TRACE_SWITCH(buffer) ((void)0)
+#endif
 
-/* ----- Arithmetic Operations ----- */
-
-void core_add(tcontext * context, int dst, int src1, int src2)
-{
-    context->reg[dst] = context->reg[src1] + context->reg[src2];
-}
-
-void core_addi(tcontext * context, int dst, int src1, int imm)
-{
-    context->reg[dst] = context->reg[src1] + imm;
-}
+/* ----- Classes ----- */
 
-void core_sub(tcontext * context, int dst, int src1, int src2)
+/**
+ * @brief Kinds of pre-decoded operations. Unlike `cmd_opcode`, the choice
+ * between an immediate and a register second operand is part of the kind.
+ */
+enum OpKind
 {
-    context->reg[dst] = context->reg[src1] - context->reg[src2];
-}
+    OP_NOP = 0,
+    OP_ADD,
+    OP_SUB,
+    OP_ADDI,
+    OP_SUBI,
+    OP_LOAD,
+    OP_LOAD_IMM,
+    OP_STORE,
+    OP_STORE_IMM,
+    OP_HALT,
+    OP_BEQ,
+    OP_BEQ_IMM,
+    OP_BNE,
+    OP_BNE_IMM,
+    OP_JMP,
+    OP_JMP_IMM,
+    OP_KIND_COUNT
+};
 
-void core_subi(tcontext * context, int dst, int src1, int imm)
+/**
+ * @brief A pre-decoded instruction. `src2` holds either a register index or an
+ * immediate, as implied by `kind`.
+ */
+struct Op
 {
-    context->reg[dst] = context->reg[src1] - imm;
-}
-
-
-/* ----- Classes ----- */
+    uint8_t kind;
+    uint8_t dst;
+    uint8_t src1;
+    int32_t src2;
+};
 
-class Thread
+/**
+ * @brief The instructions of all threads, decoded once from the instruction
+ * memory so that executing them does not go through `SIM_MemInstRead`. The
+ * threads' programs are laid out back to back in a single buffer, and threads
+ * sharing a program in the instruction memory share its decoded copy too.
+ */
+class Program
 {
 private:
-    tcontext m_context;
-    size_t m_pc;
-
-    size_t m_load_latency;
-    size_t m_store_latency;
-    size_t m_latency_count;
-
-    bool m_finished;
-
-public:
-    Thread(size_t load_latency, size_t store_latency) :
-        m_context{ 0 },
-        m_pc(0),
-        m_load_latency(load_latency),
-        m_store_latency(store_latency),
-        m_latency_count(0),
-        m_finished(false)
-    {}
-
-    /**
-     * @brief Get the current PC of the thread.
-     */
-    size_t get_pc() const
-    {
-        return m_pc;
-    }
+    std::vector<Op> m_ops;
+    std::vector<size_t> m_entries;
+    std::vector<uint32_t> m_lengths;
 
     /**
-     * @brief Execute the given instruction.
-     * @param instruction Instruction to execute.
-     * @return `true` if an instruction completed successfully, `false`
-     * in case the thread is inactive.
+     * @param length Length of the program the instruction is part of. Branch
+     * targets past its end go to the HALT appended there.
      */
-    bool execute(Instruction instruction)
+    static Op decode_op(const Instruction &instruction, uint32_t length)
     {
-        int src2;
-        if (m_latency_count > 0)
-        {
-            return false;
-        }
+        Op op;
+        op.dst = (uint8_t)instruction.dst_index;
+        op.src1 = (uint8_t)instruction.src1_index;
+        op.src2 = instruction.src2_index_imm;
 
         switch (instruction.opcode)
         {
             case CMD_ADD:
-                core_add(&m_context,
-                         instruction.dst_index,
-                         instruction.src1_index,
-                         instruction.src2_index_imm);
-                break;
-            case CMD_ADDI:
-                core_addi(&m_context,
-                          instruction.dst_index,
-                          instruction.src1_index,
-                          instruction.src2_index_imm);
+                op.kind = OP_ADD;
                 break;
             case CMD_SUB:
-                core_sub(&m_context,
-                         instruction.dst_index,
-                         instruction.src1_index,
-                         instruction.src2_index_imm);
+                op.kind = OP_SUB;
+                break;
+            case CMD_ADDI:
+                op.kind = OP_ADDI;
                 break;
             case CMD_SUBI:
-                core_subi(&m_context,
-                          instruction.dst_index,
-                          instruction.src1_index,
-                          instruction.src2_index_imm);
+                op.kind = OP_SUBI;
                 break;
             case CMD_LOAD:
-                src2 = instruction.isSrc2Imm ?
-                       instruction.src2_index_imm :
-                       m_context.reg[instruction.src2_index_imm];
-                SIM_MemDataRead(m_context.reg[instruction.src1_index] + src2,
-                                &m_context.reg[instruction.dst_index]);
-                m_latency_count += m_load_latency;
+                op.kind = instruction.isSrc2Imm ? OP_LOAD_IMM : OP_LOAD;
                 break;
             case CMD_STORE:
-                src2 = instruction.isSrc2Imm ?
-                       instruction.src2_index_imm :
-                       m_context.reg[instruction.src2_index_imm];
-                SIM_MemDataWrite(m_context.reg[instruction.dst_index] + src2,
-                                 m_context.reg[instruction.src1_index]);
-                m_latency_count += m_store_latency;
+                op.kind = instruction.isSrc2Imm ? OP_STORE_IMM : OP_STORE;
                 break;
             case CMD_HALT:
-                m_finished = true;
+                op.kind = OP_HALT;
+                break;
+            case CMD_BEQ:
+                op.kind = instruction.isSrc2Imm ? OP_BEQ_IMM : OP_BEQ;
+                break;
+            case CMD_BNE:
+                op.kind = instruction.isSrc2Imm ? OP_BNE_IMM : OP_BNE;
+                break;
+            case CMD_JMP:
+                op.kind = instruction.isSrc2Imm ? OP_JMP_IMM : OP_JMP;
                 break;
             case CMD_NOP:
+            default:
+                op.kind = OP_NOP;
                 break;
         }
 
-        ++m_pc;
-        return true;
+        if (instruction.isSrc2Imm &&
+            (instruction.opcode == CMD_BEQ ||
+             instruction.opcode == CMD_BNE ||
+             instruction.opcode == CMD_JMP) &&
+            (uint32_t)op.src2 > length)
+        {
+            op.src2 = (int32_t)length;
+        }
+        return op;
     }
 
+public:
     /**
-     * @brief Perform an idle cycle. This is a cycle where the thread does not
-     * execute a command. This could be because it is finished, waiting for
-     * data from memory, or another thread is active.
-     * @note This is an _active_ method - the thread's state might change. Do
-     * not call this method more than once a cycle, or in the same cycle as the
-     * `execute` method (on the same thread).
-     * @return `true` if the thread is inactive (finished/waiting for memory),
-     * `false` otherwise.
+     * @brief Decode the programs of threads `first_tid` to
+     * `first_tid + thread_count - 1`, numbered from 0. Each program gets a
+     * HALT appended, as reading past its end (by running or branching off it)
+     * does.
      */
-    bool idle()
+    void decode(const SimMemory * mem, int first_tid, int thread_count)
     {
-        if (m_finished)
+        typedef std::pair<const Instruction *, uint32_t> Code;
+        std::map<Code, size_t> decoded;
+        size_t size = 0;
+
+        // Size the buffer up front: the programs of long straight-line
+        // workloads take as long to copy as to decode.
+        for (int tid = 0; tid < thread_count; ++tid)
         {
-            return true;
+            uint32_t length;
+            const Instruction * code =
+                SIM_MemInstCode_r(mem, first_tid + tid, &length);
+            if (decoded.insert(std::make_pair(Code(code, length), 0)).second)
+            {
+                size += length + 1;
+            }
         }
+        decoded.clear();
 
-        if (m_latency_count > 0)
+        m_ops.clear();
+        m_ops.reserve(size);
+        m_entries.resize(thread_count);
+        m_lengths.resize(thread_count);
+        for (int tid = 0; tid < thread_count; ++tid)
         {
-            --m_latency_count;
-            return true;
+            uint32_t length;
+            const Instruction * code =
+                SIM_MemInstCode_r(mem, first_tid + tid, &length);
+            Code key(code, length);
+
+            m_lengths[tid] = length;
+            auto it = decoded.find(key);
+            if (it != decoded.end())
+            {
+                m_entries[tid] = it->second;
+                continue;
+            }
+
+            m_entries[tid] = m_ops.size();
+            decoded[key] = m_ops.size();
+            for (uint32_t line = 0; line < length; ++line)
+            {
+                m_ops.push_back(decode_op(code[line], length));
+            }
+            Op halt = { OP_HALT, 0, 0, 0 };
+            m_ops.push_back(halt);
         }
+    }
 
-        return false;
+    /**
+     * @brief Get the first instruction of the given thread's program. Valid
+     * until the next `decode`.
+     */
+    const Op * entry(int tid) const
+    {
+        return &m_ops[m_entries[tid]];
     }
 
     /**
-     * @brief Check if the thread finished execution (occurs if the thread
-     * reached a HALT command).
+     * @brief Get the length of the given thread's program, the index of the
+     * HALT appended to it.
      */
-    bool is_finished() const
+    uint32_t length(int tid) const
     {
-        return m_finished;
+        return m_lengths[tid];
     }
+};
+
+/**
+ * @brief The latencies of memory operations. With a data cache, LOADs take the
+ * hit or miss latency instead of the fixed LOAD latency. With a memory
+ * controller, the requests that reach the memory also wait their turn for it.
+ * Taken branches make their thread wait as well, for the branch penalty.
+ */
+struct MemoryTiming
+{
+    size_t load_latency;
+    size_t store_latency;
+    size_t branch_penalty;
+    SimCache * cache;   // shared by the threads of a core, NULL for none
+    size_t hit_latency;
+    size_t miss_latency;
+    SimMemCtrl * memctrl;   // shared by the threads of a core, NULL for none
 
     /**
-     * @brief Copy the current context to the given container.
-     * @param dest Empty context to copy values to.
+     * @brief Get the longest latency of any memory operation or branch.
      */
-    void extract_context(tcontext * dest) const
+    size_t max_latency() const
     {
-        memcpy(dest, &m_context, sizeof(m_context));
+        size_t latency = std::max(std::max(load_latency, store_latency),
+                                  branch_penalty);
+        return cache == NULL ? latency :
+               std::max(latency, std::max(hit_latency, miss_latency));
     }
 };
 
-/* ----- Helper Functions ----- */
+/**
+ * @brief The STOREs of a core, as (address, value) pairs, for other cores to
+ * see.
+ */
+typedef std::vector<std::pair<uint32_t, int32_t> > StoreLog;
 
 /**
- * @brief Perform a single cycle of the machine in fine-grained mode. This
- * includes idling on all threads waiting for memory operations, as well as
- * executing a single instruction in (at most) one active thread. The active
- * thread executing an instruction is picked using a RR.
- *
- * @param thread_count IN   Total number of threads in the core.
- * @param active_thread_count IN    Number of active threads in the core.
- * @param next_tid INOUT    Last tid that was picked by the RR for execution.
- * If a thread executed this cycle, `next_tid` updates to its id.
- * @return Number of active threads in the core at the end of the cycle. This
- * value can be lowered from the input number of active threads, reduced by one
- * if the thread that has executed reached a HALT instruction.
+ * @brief The addresses a thread LOADs from.
  */
-int fg_perform_cycle(int thread_count, int active_thread_count, int &next_tid)
-{
-    int tid;
-    int picked_tid = -1;
-    bool is_picked = false;
-    Instruction instruction;
+typedef std::vector<uint32_t> LoadLog;
+
+#if SIM_TRACE
+// Records a core buffers before writing them out
+#define TRACE_BATCH 16384
+// Full buffers waiting for the writer, before the cores wait for it in turn
+#define TRACE_QUEUE 4
 
-    for (int i = 0; i < thread_count; ++i)
+// The event of a trace_record is a 3-bit field, its opcode a 4-bit one
+static_assert(TRACE_HALT < 8, "trace_event does not fit its field");
+static_assert(CMD_COUNT <= 16, "cmd_opcode does not fit its trace field");
+
+/**
+ * @brief A trace file, shared by the cores of an instance. The cores hand it
+ * their full buffers, which a writer thread writes out, so that simulating
+ * does not wait on the file.
+ */
+class TraceFile
+{
+private:
+    struct Chunk
     {
-        tid = (i + next_tid) % thread_count;
-        Thread &thread = g_fg_threads.at(tid);
+        trace_batch batch;
+        std::vector<trace_record> records;
+    };
+
+    std::mutex m_lock;
+    std::condition_variable m_pending_ready;
+    std::condition_variable m_pending_taken;
+    std::deque<Chunk> m_pending;
+    std::vector<std::vector<trace_record> > m_spare;
+    std::thread m_writer;
+    bool m_stopping;
+    FILE * m_file;
+    std::atomic<uint32_t> m_runs;   // the modes of CORE_SimulateMT start together
+    bool m_failed;
 
-        if (!thread.idle() && !is_picked)
+    void write_chunk(const Chunk &chunk)
+    {
+        if (fwrite(&chunk.batch, sizeof(chunk.batch), 1, m_file) != 1 ||
+            fwrite(&chunk.records[0], sizeof(trace_record), chunk.batch.count,
+                   m_file) != chunk.batch.count)
         {
-            picked_tid = tid;
-            is_picked = true;
+            m_failed = true;
         }
     }
 
-    if (is_picked)
+    /**
+     * @brief Body of the writer thread: write out the pending buffers, in the
+     * order they were handed over, until the file is closed.
+     */
+    void drain()
     {
-        Thread &thread = g_fg_threads.at(picked_tid);
-        SIM_MemInstRead(thread.get_pc(), &instruction, picked_tid);
-        thread.execute(instruction);
+        std::unique_lock<std::mutex> guard(m_lock);
 
-        // If the thread finished, remove it from active count.
-        if (thread.is_finished())
+        for (;;)
         {
-            --active_thread_count;
+            m_pending_ready.wait(guard, [this] {
+                return !m_pending.empty() || m_stopping;
+            });
+            if (m_pending.empty())
+            {
+                return;
+            }
+            Chunk chunk = std::move(m_pending.front());
+            m_pending.pop_front();
+            guard.unlock();
+            write_chunk(chunk);
+            guard.lock();
+            m_spare.push_back(std::move(chunk.records));
+            m_pending_taken.notify_all();
         }
+    }
 
-        // Increment count of executed instructions.
-        ++g_fg_retire_count;
+public:
+    TraceFile() : m_stopping(false), m_file(NULL), m_runs(0), m_failed(false) {}
 
-        // Update last tid.
-        next_tid = (picked_tid + 1) % thread_count;
+    ~TraceFile()
+    {
+        close();
     }
 
-    ++g_fg_cycles;
-    return active_thread_count;
-}
+    bool is_open() const
+    {
+        return m_file != NULL;
+    }
 
-/**
- * @brief Perform a single cycle of the machine in blocking mode. This includes
- * idling on all threads waiting for memory operations, as well as executing a
- * single instruction in (at most) one active thread. The active thread
- * executing an instruction is picked using a RR.
- *
- * Whenever switching between threads, some cycles of penalty are taken where
- * the machine cannot execute any instructions.
- *
- * @param thread_count IN   Total number of threads in the core.
- * @param active_thread_count IN    Number of active threads in the core.
- * @param context_switch_penalty IN Number of cycles the cpu cannot execute
- * instructions whenever it is context-switching.
- * @param last_tid INOUT    Last tid that was picked by the RR for execution.
- * If a thread executed this cycle, `last_tid` updates to its id.
- * @return Number of active threads in the core at the end of the cycle. This
- * value can be lowered from the input number of active threads, reduced by one
- * if the thread that has executed reached a HALT instruction.
- */
-int b_perform_cycle(
-    int thread_count,
-    int active_thread_count,
-    int context_switch_penalty,
-    int &last_tid)
-{
-    int tid;
-    int picked_tid = -1;
-    bool is_picked = false;
-    Instruction instruction;
-
-    // Start from 1 to skip the last thread, which we tested separately.
-    for (int i = 0; i < thread_count; ++i)
-    {
-        tid = (i + last_tid) % thread_count;
-        Thread &thread = g_b_threads.at(tid);
-
-        if (!thread.idle() && !is_picked)
-        {
-            // If the picked thread is different from the last active one, do a
-            // context switch (during which all threads are idle).
-            if (tid != last_tid)
+    /**
+     * @brief Start a new trace file, closing the current one.
+     * @return `false` if the file cannot be written.
+     */
+    bool open(const char * fname)
+    {
+        uint32_t header[2] = { TRACE_VERSION, sizeof(trace_record) };
+
+        close();
+        m_file = fopen(fname, "wb");
+        if (m_file == NULL)
+        {
+            return false;
+        }
+        m_runs = 0;
+        m_failed = fwrite(TRACE_MAGIC, 8, 1, m_file) != 1 ||
+                   fwrite(header, sizeof(header), 1, m_file) != 1;
+        try
+        {
+            m_writer = std::thread(&TraceFile::drain, this);
+        }
+        catch (const std::system_error &)
+        {
+            // No host thread to spare: the cores write their buffers out.
+        }
+        return true;
+    }
+
+    /**
+     * @brief Write out the pending buffers, and close the file. The cores
+     * must have written out their own buffers first.
+     * @return `false` if no file was open, or writing it failed.
+     */
+    bool close()
+    {
+        bool ok;
+
+        if (m_file == NULL)
+        {
+            return false;
+        }
+        if (m_writer.joinable())
+        {
             {
-                for (int j = 0; j < context_switch_penalty; ++j)
-                {
-                    for (int k = 0; k < thread_count; ++k)
-                    {
-                        g_b_threads.at(k).idle();
-                    }
-                    ++g_b_cycles;
-                }
+                std::lock_guard<std::mutex> guard(m_lock);
+                m_stopping = true;
             }
-            picked_tid = tid;
-            is_picked = true;
+            m_pending_ready.notify_one();
+            m_writer.join();
+            m_stopping = false;
         }
+        m_spare.clear();
+        ok = !m_failed;
+        ok = fclose(m_file) == 0 && ok;
+        m_file = NULL;
+        m_failed = false;
+        return ok;
     }
 
-    if (is_picked)
+    /**
+     * @brief Number a new run.
+     */
+    uint32_t next_run()
     {
-        Thread &thread = g_b_threads.at(picked_tid);
-        SIM_MemInstRead(thread.get_pc(), &instruction, picked_tid);
-        thread.execute(instruction);
+        return m_runs++;
+    }
 
-        // If the thread finished, remove it from active count.
-        if (thread.is_finished())
+    /**
+     * @brief Hand a full buffer over to the writer, swapping in an empty
+     * one of the same size. Only waits if the writer is behind by
+     * TRACE_QUEUE buffers.
+     */
+    void write(const trace_batch &batch, std::vector<trace_record> &records)
+    {
+        std::unique_lock<std::mutex> guard(m_lock);
+        Chunk chunk;
+
+        chunk.batch = batch;
+        if (!m_writer.joinable())
+        {
+            chunk.records.swap(records);
+            write_chunk(chunk);
+            chunk.records.swap(records);
+            return;
+        }
+        m_pending_taken.wait(guard, [this] {
+            return m_pending.size() < TRACE_QUEUE;
+        });
+        chunk.records.swap(records);
+        if (!m_spare.empty())
         {
-            --active_thread_count;
+            records.swap(m_spare.back());
+            m_spare.pop_back();
         }
+        m_pending.push_back(std::move(chunk));
+        guard.unlock();
+        m_pending_ready.notify_one();
+        records.resize(TRACE_BATCH + 1);
+    }
+};
 
-        // Increment count of executed instructions.
-        ++g_b_retire_count;
+/**
+ * @brief The trace records of a core. Only the core's host thread adds to
+ * them, with no locking; they are written out to the file in large batches,
+ * never between a *_BEGIN record and its *_END (which is pushed right after).
+ * A batch is only written when the next record comes, so the last record
+ * pushed can still be amended with its stall.
+ */
+class TraceBuffer
+{
+private:
+    TraceFile * m_file;
+    std::vector<trace_record> m_records;
+    trace_record * m_next;  // in m_records
+    trace_record * m_full;  // TRACE_BATCH records in
+    uint32_t m_first_tid;
+    uint32_t m_run;
+    uint32_t m_core;
+    uint32_t m_switch_cycles;
+    bool m_switched;        // marks the next record
 
-        // Update last tid.
-        last_tid = picked_tid;
+    void rewind()
+    {
+        m_next = &m_records[0];
+        m_full = m_next + TRACE_BATCH;
     }
 
-    ++g_b_cycles;
-    return active_thread_count;
-}
+public:
+    /**
+     * @param first_tid Image tid of the core's thread 0.
+     * @param core Id of the core in a multi-core run.
+     * @param run Number of the run in the file.
+     * @param switch_cycles Cycles of a context switch of the core.
+     */
+    TraceBuffer(TraceFile * file,
+                int first_tid,
+                int core,
+                uint32_t run,
+                uint32_t switch_cycles) :
+        m_file(file),
+        m_records(TRACE_BATCH + 1),
+        m_first_tid(first_tid),
+        m_run(run),
+        m_core(core),
+        m_switch_cycles(switch_cycles),
+        m_switched(false)
+    {
+        rewind();
+    }
 
-/* ----- External API Functions ----- */
+    ~TraceBuffer()
+    {
+        flush();
+    }
 
-void CORE_BlockedMT()
-{
-    int thread_count = SIM_GetThreadsNum();
-    int active_thread_count = thread_count;
-    int context_switch_penalty = SIM_GetSwitchCycles();
-    int last_tid = 0;
+    /**
+     * @param tid Tid of the thread in the core.
+     */
+    void push(trace_event event,
+              size_t cycle,
+              int tid,
+              size_t pc,
+              int opcode = 0)
+    {
+        trace_record record;
 
-    g_b_threads.assign(thread_count, Thread(SIM_GetLoadLat(),
-                                             SIM_GetStoreLat()));
+        if (m_next >= m_full && event != TRACE_STALL_END)
+        {
+            flush();
+        }
+        // Filled in here and stored whole, rather than field by field
+        record.cycle = cycle;
+        record.event = event;
+        record.switched = m_switched;
+        record.opcode = opcode;
+        record.stall = 0;
+        record.tid = m_first_tid + tid;
+        record.pc = (uint32_t)pc;
+        *m_next++ = record;
+        m_switched = false;
+    }
 
-    while (active_thread_count > 0)
+    /**
+     * @brief Records that the core switches threads, as part of the
+     * TRACE_ISSUE pushed next rather than a record of its own.
+     */
+    void switched()
     {
-        active_thread_count = b_perform_cycle(thread_count,
-                                              active_thread_count,
-                                              context_switch_penalty,
-                                              last_tid);
+        m_switched = true;
     }
-}
-
-void CORE_FinegrainedMT()
-{
-    int thread_count = SIM_GetThreadsNum();
-    int active_thread_count = thread_count;
-    int next_tid = 0;
 
-    g_fg_threads.assign(thread_count, Thread(SIM_GetLoadLat(),
-                                             SIM_GetStoreLat()));
+    /**
+     * @brief Records that the TRACE_ISSUE just pushed waits `wait` cycles
+     * from `cycle`, its next cycle.
+     */
+    void stall(size_t wait, size_t cycle, int tid, size_t pc)
+    {
+        if (wait < TRACE_LONG_STALL)
+        {
+            m_next[-1].stall = wait;
+            return;
+        }
+        m_next[-1].stall = TRACE_LONG_STALL;
+        push(TRACE_STALL_BEGIN, cycle, tid, pc);
+        push(TRACE_STALL_END, cycle + wait, tid, pc);
+    }
 
-    while (active_thread_count > 0)
+    void flush()
     {
-        active_thread_count = fg_perform_cycle(thread_count,
-                                               active_thread_count,
-                                               next_tid);
+        uint32_t count = (uint32_t)(m_next - &m_records[0]);
+
+        if (count > 0)
+        {
+            trace_batch batch = { m_run, m_core, count, m_switch_cycles };
+            m_file->write(batch, m_records);
+            rewind();
+        }
     }
-}
+};
+#endif
 
-double CORE_BlockedMT_CPI()
+/**
+ * @brief The state of a thread, as written to a checkpoint.
+ */
+struct ThreadState
 {
-    return (double)g_b_cycles / (double)g_b_retire_count;
-}
+    tcontext context;
+    uint64_t pc;
+    uint64_t ready_cycle;
+    uint64_t issued;
+    uint64_t cache_hits;
+    uint64_t cache_misses;
+    uint64_t last_run;
+    uint32_t finished;
+    uint32_t branch_stall;
+};
 
-double CORE_FinegrainedMT_CPI()
+class Thread
 {
-    return (double)g_fg_cycles / (double)g_fg_retire_count;
-}
+private:
+    tcontext m_context;
+    SimDataView * m_data;
+    StoreLog * m_store_log;
+    LoadLog * m_load_log;
+    const Op * m_code;
+    uint32_t m_length;  // of the program, the index of the HALT appended
+    size_t m_pc;
 
-void CORE_BlockedMT_CTX(tcontext * context, int threadid)
-{
-    g_b_threads.at(threadid).extract_context(&context[threadid]);
-}
+    MemoryTiming m_timing;
+    size_t m_ready_cycle;
+    size_t m_cache_hits;
+    size_t m_cache_misses;
+    size_t m_issued;
+    size_t m_last_run;
+#if SIM_STATS
+    thread_stats m_stats;
+#endif
+#if SIM_TRACE
+    TraceBuffer * m_trace;
+    int m_tid;
+#endif
 
-void CORE_FinegrainedMT_CTX(tcontext * context, int threadid)
+    bool m_finished;
+    bool m_branch_stall;    // waiting after a taken branch, not for memory
+
+    /**
+     * @brief Get the index a branch to the given register value goes to:
+     * targets past the program's end go to the HALT appended there.
+     */
+    uint32_t jump_target(int32_t value) const
+    {
+        return (uint32_t)value < m_length ? (uint32_t)value : m_length;
+    }
+
+    /**
+     * @brief Access the data cache, if any, counting a hit or a miss.
+     * @return `true` for a hit.
+     */
+    bool access_cache(uint32_t addr)
+    {
+        if (SIM_CacheAccess(m_timing.cache, addr))
+        {
+            ++m_cache_hits;
+            return true;
+        }
+        ++m_cache_misses;
+        return false;
+    }
+
+    /**
+     * @brief Get the latency of a request to the memory, including its wait
+     * for the memory controller.
+     * @param issue Cycle from which the latency counts.
+     */
+    size_t memory_latency(uint32_t addr, size_t issue, size_t latency)
+    {
+        if (m_timing.memctrl == NULL)
+        {
+            return latency;
+        }
+        return SIM_MemCtrlRequest(m_timing.memctrl, addr, issue, latency) -
+               issue;
+    }
+
+    size_t load_latency(uint32_t addr, size_t issue)
+    {
+        if (m_timing.cache == NULL)
+        {
+            return memory_latency(addr, issue, m_timing.load_latency);
+        }
+        if (access_cache(addr))
+        {
+            return m_timing.hit_latency;
+        }
+        return memory_latency(addr, issue, m_timing.miss_latency);
+    }
+
+    size_t store_latency(uint32_t addr, size_t issue)
+    {
+        if (m_timing.cache != NULL && access_cache(addr))
+        {
+            return m_timing.store_latency;
+        }
+        return memory_latency(addr, issue, m_timing.store_latency);
+    }
+
+    /**
+     * @brief Access the data cache, if any, with no counting or timing.
+     */
+    void warm_cache(uint32_t addr)
+    {
+        if (m_timing.cache != NULL)
+        {
+            SIM_CacheAccess(m_timing.cache, addr);
+        }
+    }
+
+    /**
+     * @brief Execute a burst of consecutive instructions, one per cycle. The
+     * burst ends after `budget` instructions, or earlier once the thread
+     * reaches HALT or starts waiting for memory.
+     *
+     * Instructions are dispatched by jumping from handler to handler through a
+     * table of label addresses (GCC computed goto), with no switch or helper
+     * calls in between.
+     *
+     * @param cycle Cycle in which the first instruction executes. Memory
+     * operations make the thread wait until their latency passes, counting
+     * from the cycle they execute in.
+     * @param budget Maximum number of instructions to execute, at least 1.
+     * @return Number of instructions executed. Zero in case the thread is
+     * inactive.
+     * @param yield In functional mode, `true` to end the burst after a
+     * memory operation, where a blocked core may switch threads.
+     * @tparam Functional `true` to execute with no timing: memory operations
+     * go through the data cache, to keep it warm, but take no latency.
+     */
+    template <bool Functional>
+    size_t execute(size_t cycle, size_t budget, bool yield)
+    {
+        static const void * const handlers[OP_KIND_COUNT] = {
+            &&op_nop,
+            &&op_add,
+            &&op_sub,
+            &&op_addi,
+            &&op_subi,
+            &&op_load,
+            &&op_load_imm,
+            &&op_store,
+            &&op_store_imm,
+            &&op_halt,
+            &&op_beq,
+            &&op_beq_imm,
+            &&op_bne,
+            &&op_bne_imm,
+            &&op_jmp,
+            &&op_jmp_imm,
+        };
+
+        int * reg = m_context.reg;
+        const Op * op = m_code + m_pc;
+        size_t executed = 0;
+        uint32_t addr;
+
+        if (m_finished || (!Functional && cycle < m_ready_cycle))
+        {
+            return 0;
+        }
+
+#define DISPATCH() goto *handlers[op->kind]
+#define NEXT() \
+    do { ++op; if (++executed == budget) goto done; DISPATCH(); } while (0)
+#define RETIRE(opcode) \
+    do { \
+        if (!Functional) { \
+            STAT_ADD(m_stats.retired[opcode], 1); \
+            TRACE(m_trace, TRACE_ISSUE, cycle + executed, m_tid, \
+                  op - m_code, opcode); \
+        } \
+    } while (0)
+#define NEXT_MEM(latency, stall) \
+    do { \
+        if (Functional) { \
+            warm_cache(addr); \
+            if (yield) { ++op; ++executed; goto done; } \
+            NEXT(); \
+        } \
+        size_t wait = (latency); \
+        STAT_ADD(m_stats.stall, wait); \
+        ++op; \
+        m_ready_cycle = cycle + ++executed + wait; \
+        m_branch_stall = false; \
+        if (wait > 0) { \
+            TRACE_STALL(m_trace, wait, cycle + executed, m_tid, \
+                        op - 1 - m_code); \
+        } \
+        if (executed == budget || wait > 0) goto done; \
+        DISPATCH(); \
+    } while (0)
+#define BRANCH(target) \
+    do { \
+        uint32_t to = (target); \
+        size_t wait = m_timing.branch_penalty; \
+        if (Functional || wait == 0) { \
+            op = m_code + to; \
+            if (++executed == budget) goto done; \
+            DISPATCH(); \
+        } \
+        STAT_ADD(m_stats.branch_stall_cycles, wait); \
+        m_ready_cycle = cycle + ++executed + wait; \
+        m_branch_stall = true; \
+        TRACE_STALL(m_trace, wait, cycle + executed, m_tid, op - m_code); \
+        op = m_code + to; \
+        goto done; \
+    } while (0)
+
+        DISPATCH();
+
+    op_nop:
+        RETIRE(CMD_NOP);
+        NEXT();
+    op_add:
+        reg[op->dst] = reg[op->src1] + reg[op->src2];
+        RETIRE(CMD_ADD);
+        NEXT();
+    op_sub:
+        reg[op->dst] = reg[op->src1] - reg[op->src2];
+        RETIRE(CMD_SUB);
+        NEXT();
+    op_addi:
+        reg[op->dst] = reg[op->src1] + op->src2;
+        RETIRE(CMD_ADDI);
+        NEXT();
+    op_subi:
+        reg[op->dst] = reg[op->src1] - op->src2;
+        RETIRE(CMD_SUBI);
+        NEXT();
+    op_load:
+        addr = reg[op->src1] + reg[op->src2];
+        read(addr, &reg[op->dst]);
+        RETIRE(CMD_LOAD);
+        NEXT_MEM(load_latency(addr, cycle + executed + 1), load_stall_cycles);
+    op_load_imm:
+        addr = reg[op->src1] + op->src2;
+        read(addr, &reg[op->dst]);
+        RETIRE(CMD_LOAD);
+        NEXT_MEM(load_latency(addr, cycle + executed + 1), load_stall_cycles);
+    op_store:
+        addr = reg[op->dst] + reg[op->src2];
+        write(addr, reg[op->src1]);
+        RETIRE(CMD_STORE);
+        NEXT_MEM(store_latency(addr, cycle + executed + 1), store_stall_cycles);
+    op_store_imm:
+        addr = reg[op->dst] + op->src2;
+        write(addr, reg[op->src1]);
+        RETIRE(CMD_STORE);
+        NEXT_MEM(store_latency(addr, cycle + executed + 1), store_stall_cycles);
+    op_halt:
+        RETIRE(CMD_HALT);
+        if (!Functional)
+        {
+            TRACE(m_trace, TRACE_HALT, cycle + executed, m_tid, op - m_code);
+        }
+        m_finished = true;
+        ++op;
+        ++executed;
+        goto done;
+    op_beq:
+        RETIRE(CMD_BEQ);
+        if (reg[op->dst] == reg[op->src1])
+        {
+            BRANCH(jump_target(reg[op->src2]));
+        }
+        NEXT();
+    op_beq_imm:
+        RETIRE(CMD_BEQ);
+        if (reg[op->dst] == reg[op->src1])
+        {
+            BRANCH(op->src2);
+        }
+        NEXT();
+    op_bne:
+        RETIRE(CMD_BNE);
+        if (reg[op->dst] != reg[op->src1])
+        {
+            BRANCH(jump_target(reg[op->src2]));
+        }
+        NEXT();
+    op_bne_imm:
+        RETIRE(CMD_BNE);
+        if (reg[op->dst] != reg[op->src1])
+        {
+            BRANCH(op->src2);
+        }
+        NEXT();
+    op_jmp:
+        RETIRE(CMD_JMP);
+        BRANCH(jump_target(reg[op->src2]));
+    op_jmp_imm:
+        RETIRE(CMD_JMP);
+        BRANCH(op->src2);
+
+#undef BRANCH
+#undef NEXT_MEM
+#undef RETIRE
+#undef NEXT
+#undef DISPATCH
+
+    done:
+        m_pc = op - m_code;
+        m_issued += executed;
+        if (Functional)
+        {
+            m_ready_cycle = 0;
+            m_branch_stall = false;
+        }
+        else
+        {
+            m_last_run = cycle + executed;
+        }
+        return executed;
+    }
+
+    void read(uint32_t addr, int32_t * dst)
+    {
+        SIM_DataViewRead(m_data, addr, dst);
+        if (m_load_log != NULL)
+        {
+            m_load_log->push_back(addr);
+        }
+    }
+
+    void write(uint32_t addr, int32_t value)
+    {
+        SIM_DataViewWrite(m_data, addr, value);
+        if (m_store_log != NULL)
+        {
+            m_store_log->push_back(std::make_pair(addr, value));
+        }
+    }
+
+public:
+    /**
+     * @param store_log If not NULL, the thread logs its STOREs there.
+     * @param load_log If not NULL, the thread logs its LOADs there.
+     */
+    Thread(SimDataView * data,
+           const MemoryTiming &timing,
+           StoreLog * store_log,
+           LoadLog * load_log = NULL) :
+        m_context{ 0 },
+        m_data(data),
+        m_store_log(store_log),
+        m_load_log(load_log),
+        m_code(NULL),
+        m_length(0),
+        m_pc(0),
+        m_timing(timing),
+        m_ready_cycle(0),
+        m_cache_hits(0),
+        m_cache_misses(0),
+        m_issued(0),
+        m_last_run(0),
+#if SIM_STATS
+        m_stats(),
+#endif
+#if SIM_TRACE
+        m_trace(NULL),
+        m_tid(0),
+#endif
+        m_finished(false),
+        m_branch_stall(false)
+    {}
+
+    /**
+     * @brief Set the code the thread executes, starting from its first
+     * instruction. The code must outlive the thread.
+     * @param length Length of the program, not counting the HALT appended.
+     */
+    void load(const Op * code, uint32_t length)
+    {
+        m_code = code;
+        m_length = length;
+        m_pc = 0;
+    }
+
+    /**
+     * @brief Point the thread at other data, with no logs of its accesses.
+     */
+    void attach(SimDataView * data)
+    {
+        m_data = data;
+        m_store_log = NULL;
+        m_load_log = NULL;
+    }
+
+    /**
+     * @brief Execute a burst of consecutive instructions, one per cycle (see
+     * `execute`).
+     */
+    size_t run(size_t cycle, size_t budget)
+    {
+        return execute<false>(cycle, budget, false);
+    }
+
+    /**
+     * @brief Execute a burst of instructions functionally: they update the
+     * registers, the data memory and the data cache, but take no cycles, and
+     * the thread is left ready.
+     * @param yield `true` to end the burst after a memory operation.
+     * @return Number of instructions executed. Zero in case the thread
+     * finished.
+     */
+    size_t run_functional(size_t budget, bool yield)
+    {
+        return execute<true>(0, budget, yield);
+    }
+
+    /**
+     * @brief Get the current PC of the thread.
+     */
+    size_t get_pc() const
+    {
+        return m_pc;
+    }
+
+    /**
+     * @brief Get the first cycle in which the thread is done waiting for
+     * memory and may execute again.
+     */
+    size_t get_ready_cycle() const
+    {
+        return m_ready_cycle;
+    }
+
+    /**
+     * @brief Check if the thread finished execution (occurs if the thread
+     * reached a HALT command).
+     */
+    bool is_finished() const
+    {
+        return m_finished;
+    }
+
+    /**
+     * @brief Check if the thread still pays the penalty of a taken branch
+     * (rather than waiting for memory) in the given cycle.
+     */
+    bool in_branch_penalty(size_t cycle) const
+    {
+        return m_branch_stall && m_ready_cycle > cycle;
+    }
+
+    /**
+     * @brief Get the number of instructions the thread executed so far.
+     */
+    size_t get_issued() const
+    {
+        return m_issued;
+    }
+
+    /**
+     * @brief Get the cycle after the last one in which the thread executed, 0
+     * if it never did.
+     */
+    size_t get_last_run() const
+    {
+        return m_last_run;
+    }
+
+    size_t get_cache_hits() const
+    {
+        return m_cache_hits;
+    }
+
+    size_t get_cache_misses() const
+    {
+        return m_cache_misses;
+    }
+
+#if SIM_STATS
+    const thread_stats &get_stats() const
+    {
+        return m_stats;
+    }
+#endif
+
+#if SIM_TRACE
+    /**
+     * @brief Trace the thread's timed execution to the given buffer, as the
+     * core's thread `tid`, or stop tracing it for NULL.
+     */
+    void set_trace(TraceBuffer * trace, int tid)
+    {
+        m_trace = trace;
+        m_tid = tid;
+    }
+#endif
+
+    /**
+     * @brief Copy the current context to the given container.
+     * @param dest Empty context to copy values to.
+     */
+    void extract_context(tcontext * dest) const
+    {
+        memcpy(dest, &m_context, sizeof(m_context));
+    }
+
+    void save(ThreadState &state) const
+    {
+        memset(&state, 0, sizeof(state));
+        state.context = m_context;
+        state.pc = m_pc;
+        state.ready_cycle = m_ready_cycle;
+        state.issued = m_issued;
+        state.cache_hits = m_cache_hits;
+        state.cache_misses = m_cache_misses;
+        state.last_run = m_last_run;
+        state.finished = m_finished;
+        state.branch_stall = m_branch_stall;
+    }
+
+    /**
+     * @brief Continue from a saved state. The thread must have the code it
+     * had when saved.
+     * @return `false` if the state's pc is not in the code.
+     */
+    bool restore(const ThreadState &state)
+    {
+        // A thread that ran into the HALT appended to its program is past it
+        if (state.pc > m_length + (state.finished != 0 ? 1 : 0))
+        {
+            return false;
+        }
+        m_context = state.context;
+        m_pc = state.pc;
+        m_ready_cycle = state.ready_cycle;
+        m_issued = state.issued;
+        m_cache_hits = state.cache_hits;
+        m_cache_misses = state.cache_misses;
+        m_last_run = state.last_run;
+        m_finished = state.finished != 0;
+        m_branch_stall = state.branch_stall != 0;
+        return true;
+    }
+};
+
+/**
+ * @brief Set of small ids (thread ids, wheel slots), kept as a bitmask. A
+ * second-level bitmask marks the non-empty words, so a round-robin lookup costs
+ * a couple of find-first-set operations for up to 4096 ids, regardless of how
+ * many are in the set.
+ */
+class IdSet
+{
+private:
+    std::vector<uint64_t> m_words;
+    std::vector<uint64_t> m_summary;
+    int m_count;
+
+    static uint64_t bit(int index)
+    {
+        return (uint64_t)1 << (index & 63);
+    }
+
+    /**
+     * @brief Find the first non-empty word at index `from` or above.
+     * @return Index of the word, or -1 if there is none.
+     */
+    int find_word(size_t from) const
+    {
+        for (size_t s = from >> 6; s < m_summary.size(); ++s)
+        {
+            uint64_t bits = m_summary[s];
+            if (s == from >> 6)
+            {
+                bits &= ~(uint64_t)0 << (from & 63);
+            }
+            if (bits)
+            {
+                return (int)(s << 6) + __builtin_ctzll(bits);
+            }
+        }
+        return -1;
+    }
+
+public:
+    IdSet() : m_count(0) {}
+
+    /**
+     * @brief Resize the set to hold ids `0` to `size - 1`.
+     * @param size Number of possible ids.
+     * @param full `true` to start with every id in the set, `false` to start
+     * with an empty set.
+     */
+    void assign(int size, bool full)
+    {
+        size_t word_count = (size + 63) / 64;
+        m_words.assign(word_count, 0);
+        m_summary.assign((word_count + 63) / 64, 0);
+        m_count = 0;
+
+        if (full)
+        {
+            for (int tid = 0; tid < size; ++tid)
+            {
+                insert(tid);
+            }
+        }
+    }
+
+    bool contains(int tid) const
+    {
+        return m_words[tid >> 6] & bit(tid);
+    }
+
+    bool empty() const
+    {
+        return m_count == 0;
+    }
+
+    int size() const
+    {
+        return m_count;
+    }
+
+    void insert(int tid)
+    {
+        if (contains(tid))
+        {
+            return;
+        }
+        m_words[tid >> 6] |= bit(tid);
+        m_summary[tid >> 12] |= bit(tid >> 6);
+        ++m_count;
+    }
+
+    void erase(int tid)
+    {
+        if (!contains(tid))
+        {
+            return;
+        }
+        uint64_t &word = m_words[tid >> 6];
+        word &= ~bit(tid);
+        if (!word)
+        {
+            m_summary[tid >> 12] &= ~bit(tid >> 6);
+        }
+        --m_count;
+    }
+
+    /**
+     * @brief Find the first id in the set, in round-robin order starting from
+     * `start` (inclusive) and wrapping around.
+     * @return The id found, or -1 if the set is empty.
+     */
+    int find_next(int start) const
+    {
+        if (empty())
+        {
+            return -1;
+        }
+
+        int word = start >> 6;
+        uint64_t bits = m_words[word] & (~(uint64_t)0 << (start & 63));
+        if (bits)
+        {
+            return (word << 6) + __builtin_ctzll(bits);
+        }
+
+        word = find_word(word + 1);
+        if (word < 0)
+        {
+            word = find_word(0);
+        }
+        return (word << 6) + __builtin_ctzll(m_words[word]);
+    }
+};
+
+// Most slots of a wake-up wheel, so that its size does not grow with the
+// latencies
+#define WHEEL_MAX_SLOTS 4096
+
+/**
+ * @brief Queue of thread wake-up events, keyed by absolute cycle. Events up to
+ * `horizon` cycles ahead (and at most WHEEL_MAX_SLOTS) go to a wheel of
+ * per-cycle slots, found through a bitmask of the occupied slots. Events
+ * further ahead go to a heap.
+ */
+class TimingWheel
+{
+private:
+    typedef std::pair<size_t, int> Event;
+
+    std::vector<std::vector<int> > m_slots;
+    IdSet m_occupied;
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event> >
+        m_overflow;
+    size_t m_mask;
+    size_t m_now;
+
+public:
+    TimingWheel() : m_mask(0), m_now(0) {}
+
+    /**
+     * @brief Drop all events and resize the wheel.
+     * @param horizon Number of cycles ahead the wheel should cover.
+     */
+    void reset(size_t horizon)
+    {
+        size_t slot_count = 64;
+        while (slot_count < horizon && slot_count < WHEEL_MAX_SLOTS)
+        {
+            slot_count <<= 1;
+        }
+
+        m_slots.assign(slot_count, std::vector<int>());
+        m_occupied.assign((int)slot_count, false);
+        m_overflow = std::priority_queue<Event, std::vector<Event>,
+                                         std::greater<Event> >();
+        m_mask = slot_count - 1;
+        m_now = 0;
+    }
+
+    /**
+     * @brief Drop all events, keeping the size of the wheel, and go on from
+     * the given cycle.
+     */
+    void restart(size_t cycle)
+    {
+        for (std::vector<int> &slot : m_slots)
+        {
+            slot.clear();
+        }
+        m_occupied.assign((int)m_slots.size(), false);
+        m_overflow = std::priority_queue<Event, std::vector<Event>,
+                                         std::greater<Event> >();
+        m_now = cycle;
+    }
+
+    bool empty() const
+    {
+        return m_occupied.empty() && m_overflow.empty();
+    }
+
+    /**
+     * @brief Schedule a thread to wake up at the start of the given cycle.
+     * @param cycle Wake-up cycle, later than the last released cycle.
+     */
+    void schedule(int tid, size_t cycle)
+    {
+        if (cycle - m_now > m_mask + 1)
+        {
+            m_overflow.push(Event(cycle, tid));
+            return;
+        }
+
+        int slot = (int)(cycle & m_mask);
+        m_slots[slot].push_back(tid);
+        m_occupied.insert(slot);
+    }
+
+    /**
+     * @brief Get the earliest scheduled wake-up cycle. The wheel must not be
+     * empty.
+     */
+    size_t next() const
+    {
+        size_t cycle = m_overflow.empty() ? (size_t)-1 : m_overflow.top().first;
+
+        if (!m_occupied.empty())
+        {
+            size_t first = m_now + 1;
+            size_t slot = m_occupied.find_next((int)(first & m_mask));
+            cycle = std::min(cycle, first + ((slot - first) & m_mask));
+        }
+
+        return cycle;
+    }
+
+    /**
+     * @brief Wake up all threads scheduled up to (and including) the given
+     * cycle.
+     * @param cycle Cycle to release events up to.
+     * @param ready INOUT Set to add the woken threads to.
+     * @param woken OUT If not NULL, the woken threads are appended to it.
+     */
+    void release(size_t cycle, IdSet &ready, std::vector<int> * woken)
+    {
+        while (!empty() && next() <= cycle)
+        {
+            m_now = next();
+
+            int slot = (int)(m_now & m_mask);
+            if (m_occupied.contains(slot))
+            {
+                for (int tid : m_slots[slot])
+                {
+                    ready.insert(tid);
+                }
+                if (woken != NULL)
+                {
+                    woken->insert(woken->end(),
+                                  m_slots[slot].begin(),
+                                  m_slots[slot].end());
+                }
+                m_slots[slot].clear();
+                m_occupied.erase(slot);
+            }
+
+            while (!m_overflow.empty() && m_overflow.top().first == m_now)
+            {
+                ready.insert(m_overflow.top().second);
+                if (woken != NULL)
+                {
+                    woken->push_back(m_overflow.top().second);
+                }
+                m_overflow.pop();
+            }
+        }
+
+        m_now = std::max(m_now, cycle);
+    }
+};
+
+/**
+ * @brief An order the ready threads of a pool can be kept in, besides their
+ * tids, for the policies that pick by it.
+ */
+enum ReadyOrder
+{
+    ORDER_NONE,
+    ORDER_ISSUED,       // fewest instructions issued first (ICOUNT)
+    ORDER_PRIORITY,     // highest priority in the image first
+    ORDER_LAST_RUN,     // least recently run first
+};
+
+/**
+ * @brief The threads of a core, along with the scheduling state needed to pick
+ * a ready thread without scanning all of them: the set of ready threads and
+ * the wake-up queue of the threads waiting for memory.
+ */
+class ThreadPool
+{
+private:
+    Program m_program;
+    std::vector<Thread> m_threads;
+    IdSet m_ready;
+    TimingWheel m_wakeups;
+
+    // The ready threads in the tracked order, if any, along with the key each
+    // was ordered by, lowest first.
+    ReadyOrder m_order;
+    std::set<std::pair<size_t, int> > m_ordered;
+    std::vector<size_t> m_order_key;
+    std::vector<size_t> m_rank;     // static keys of ORDER_PRIORITY
+    std::vector<int> m_woken;
+
+    size_t order_key(int tid) const
+    {
+        switch (m_order)
+        {
+            case ORDER_ISSUED:
+                return m_threads[tid].get_issued();
+            case ORDER_LAST_RUN:
+                return m_threads[tid].get_last_run();
+            default:
+                return m_rank[tid];
+        }
+    }
+
+    void order_insert(int tid)
+    {
+        m_order_key[tid] = order_key(tid);
+        m_ordered.insert(std::make_pair(m_order_key[tid], tid));
+    }
+
+public:
+    /**
+     * @brief Replace the threads with fresh threads, all ready, and decode
+     * their programs from the instruction memory: those of threads
+     * `first_tid` to `first_tid + thread_count - 1`, numbered from 0.
+     * @param data View of the data memory the threads access.
+     * @param order Order to keep the ready threads in, for `pick_ordered`.
+     * @param store_log If not NULL, the threads log their STOREs there.
+     */
+    void reset(const SimMemory * mem,
+               SimDataView * data,
+               int first_tid,
+               int thread_count,
+               const MemoryTiming &timing,
+               ReadyOrder order,
+               StoreLog * store_log)
+    {
+        m_program.decode(mem, first_tid, thread_count);
+        m_threads.assign(thread_count, Thread(data, timing, store_log));
+        for (int tid = 0; tid < thread_count; ++tid)
+        {
+            m_threads[tid].load(m_program.entry(tid), m_program.length(tid));
+        }
+        m_ready.assign(thread_count, true);
+        m_wakeups.reset(timing.max_latency() + 1);
+
+        m_order = order;
+        m_ordered.clear();
+        m_order_key.assign(order != ORDER_NONE ? thread_count : 0, 0);
+        m_rank.assign(order == ORDER_PRIORITY ? thread_count : 0, 0);
+        for (int tid = 0; order == ORDER_PRIORITY && tid < thread_count; ++tid)
+        {
+            m_rank[tid] = (size_t)((int64_t)INT32_MAX -
+                                   SIM_GetThreadPriority_r(mem, first_tid + tid));
+        }
+        for (int tid = 0; order != ORDER_NONE && tid < thread_count; ++tid)
+        {
+            order_insert(tid);
+        }
+    }
+
+    int size() const
+    {
+        return (int)m_threads.size();
+    }
+
+#if SIM_TRACE
+    void set_trace(TraceBuffer * trace)
+    {
+        for (int tid = 0; tid < size(); ++tid)
+        {
+            m_threads[tid].set_trace(trace, tid);
+        }
+    }
+#endif
+
+    Thread &operator[](int tid)
+    {
+        return m_threads[tid];
+    }
+
+    const Thread &operator[](int tid) const
+    {
+        return m_threads[tid];
+    }
+
+    const Thread &at(int tid) const
+    {
+        return m_threads.at(tid);
+    }
+
+    /**
+     * @brief Pick the next ready thread in round-robin order.
+     * @param start First tid to consider.
+     * @return The picked tid, or -1 if no thread is ready.
+     */
+    int pick(int start) const
+    {
+        return m_ready.find_next(start);
+    }
+
+    bool is_ready(int tid) const
+    {
+        return m_ready.contains(tid);
+    }
+
+    /**
+     * @brief Pick the ready threads first in the tracked order, ties going to
+     * the lower tid.
+     * @param count Maximum number of threads to pick.
+     * @param picked OUT The picked tids, in order.
+     */
+    void pick_ordered(size_t count, std::vector<int> &picked) const
+    {
+        picked.clear();
+        for (std::set<std::pair<size_t, int> >::const_iterator it =
+                 m_ordered.begin();
+             it != m_ordered.end() && picked.size() < count;
+             ++it)
+        {
+            picked.push_back(it->second);
+        }
+    }
+
+    /**
+     * @brief Pick the ready thread first in the tracked order, ties going to
+     * the first in round-robin order.
+     * @param start First tid to consider among ties.
+     * @return The picked tid, or -1 if no thread is ready.
+     */
+    int pick_ordered(int start) const
+    {
+        if (m_ordered.empty())
+        {
+            return -1;
+        }
+
+        size_t key = m_ordered.begin()->first;
+        std::set<std::pair<size_t, int> >::const_iterator it =
+            m_ordered.lower_bound(std::make_pair(key, start));
+        if (it == m_ordered.end() || it->first != key)
+        {
+            it = m_ordered.begin();
+        }
+        return it->second;
+    }
+
+    /**
+     * @brief Get the number of instructions the only ready thread can execute
+     * back to back from the given cycle, before any other thread wakes up and
+     * competes with it for the RR.
+     * @return 1 if more than one thread is ready.
+     */
+    size_t burst(size_t cycle) const
+    {
+        if (m_ready.size() > 1)
+        {
+            return 1;
+        }
+        return m_wakeups.empty() ? (size_t)-1 : m_wakeups.next() - cycle;
+    }
+
+    /**
+     * @brief Make all threads whose memory operation completed by the start of
+     * the given cycle ready.
+     */
+    void wake(size_t cycle)
+    {
+        if (m_order == ORDER_NONE)
+        {
+            m_wakeups.release(cycle, m_ready, NULL);
+            return;
+        }
+
+        m_woken.clear();
+        m_wakeups.release(cycle, m_ready, &m_woken);
+        for (int tid : m_woken)
+        {
+            order_insert(tid);
+        }
+    }
+
+    /**
+     * @brief Update the scheduling state of a thread after it executed.
+     * Threads that reached HALT or started waiting for memory leave the ready
+     * set, and the latter are queued to wake up when their latency passes.
+     * @param tid Thread that executed.
+     * @param cycle Last cycle in which it executed.
+     */
+    void update(int tid, size_t cycle)
+    {
+        const Thread &thread = m_threads[tid];
+
+        if (thread.is_finished())
+        {
+            m_ready.erase(tid);
+        }
+        else if (thread.get_ready_cycle() > cycle + 1)
+        {
+            m_ready.erase(tid);
+            m_wakeups.schedule(tid, thread.get_ready_cycle());
+        }
+
+        if (m_order != ORDER_NONE)
+        {
+            m_ordered.erase(std::make_pair(m_order_key[tid], tid));
+            if (m_ready.contains(tid))
+            {
+                order_insert(tid);
+            }
+        }
+    }
+
+    /**
+     * @brief Rebuild the scheduling state from the threads' own state, once
+     * they are restored to the given cycle or ran functionally: the threads
+     * waiting for memory until later are queued to wake up, the other active
+     * threads are ready.
+     */
+    void resume(size_t cycle)
+    {
+        m_ready.assign(size(), false);
+        m_wakeups.restart(cycle);
+        m_ordered.clear();
+
+        for (int tid = 0; tid < size(); ++tid)
+        {
+            const Thread &thread = m_threads[tid];
+
+            if (thread.is_finished())
+            {
+                continue;
+            }
+            if (thread.get_ready_cycle() > cycle)
+            {
+                m_wakeups.schedule(tid, thread.get_ready_cycle());
+                continue;
+            }
+
+            m_ready.insert(tid);
+            if (m_order != ORDER_NONE)
+            {
+                order_insert(tid);
+            }
+        }
+    }
+
+    /**
+     * @brief Skip all upcoming cycles in which no thread can execute, waking
+     * up the earliest waiting threads.
+     *
+     * @param cycle Current cycle.
+     * @return The first cycle, from `cycle` onward, in which some thread is
+     * ready to execute. `cycle` itself if all threads finished.
+     */
+    size_t fast_forward(size_t cycle)
+    {
+        wake(cycle);
+
+        if (!m_ready.empty() || m_wakeups.empty())
+        {
+            return cycle;
+        }
+
+        cycle = m_wakeups.next();
+        wake(cycle);
+        return cycle;
+    }
+};
+
+/**
+ * @brief State of a core simulated in one of the MT modes: its threads, its
+ * private view of the data memory, its data cache, the progress of its run and
+ * performance counters.
+ */
+struct Core
+{
+    ThreadPool threads;
+    SimDataView * data;
+    SimCache * cache;
+    SimCacheConfig cache_config;
+    SimMemCtrl * memctrl;
+    SimMemCtrlConfig memctrl_config;
+
+    mt_mode mode;
+    int context_switch_penalty;
+    SimSwitchConfig switching;
+    SimSMTConfig smt;
+    std::vector<int> picked;    // scratch space of SMT cycles
+    int thread_count;
+    int active_thread_count;
+    int rr_tid;     // last (blocked) or next (fine-grained, SMT) tid of the RR
+    size_t slice_used;  // instructions the last thread ran in a row (timeslice)
+
+    size_t cycles;
+    size_t retire_count;
+    bool from_start;    // ran in detail from the start, with the memory's parameters
+#if SIM_STATS
+    size_t switch_cycles;
+    size_t idle_cycles;
+#endif
+#if SIM_TRACE
+    std::unique_ptr<TraceBuffer> trace;
+#endif
+
+    Core() :
+        data(NULL),
+        cache(NULL),
+        cache_config(),
+        memctrl(NULL),
+        memctrl_config(),
+        mode(MT_BLOCKED),
+        context_switch_penalty(0),
+        switching(),
+        smt(),
+        thread_count(0),
+        active_thread_count(0),
+        rr_tid(0),
+        slice_used(0),
+        cycles(0),
+        retire_count(0),
+        from_start(true)
+#if SIM_STATS
+        ,
+        switch_cycles(0),
+        idle_cycles(0)
+#endif
+    {}
+
+    ~Core()
+    {
+        SIM_DataViewDestroy(data);
+        SIM_CacheDestroy(cache);
+        SIM_MemCtrlDestroy(memctrl);
+    }
+
+    /**
+     * @brief Start a run of the given memory: drop the writes of the last
+     * run, empty the cache and the memory controller, and reset the threads
+     * to threads `first_tid` to `first_tid + count - 1` of the image.
+     * @param run_mode The MT mode the core runs in.
+     * @param store_log If not NULL, the threads log their STOREs there.
+     */
+    void reset(const SimMemory * mem,
+               mt_mode run_mode,
+               int first_tid,
+               int count,
+               StoreLog * store_log)
+    {
+        SimCacheConfig config;
+        SimMemCtrlConfig ctrl_config;
+        MemoryTiming timing;
+        ReadyOrder order = ORDER_NONE;
+
+        SIM_GetCache_r(mem, &config);
+        if (cache == NULL ||
+            memcmp(&config, &cache_config, sizeof(config)) != 0)
+        {
+            SIM_CacheDestroy(cache);
+            cache = SIM_CacheCreate(&config);
+            cache_config = config;
+            if (cache == NULL && config.size != 0)
+            {
+                fprintf(stderr, "Out of memory for the data cache\n");
+                abort();
+            }
+        }
+        else
+        {
+            SIM_CacheReset(cache);
+        }
+
+        SIM_GetMemCtrl_r(mem, &ctrl_config);
+        if (memctrl == NULL ||
+            memcmp(&ctrl_config, &memctrl_config, sizeof(ctrl_config)) != 0)
+        {
+            SIM_MemCtrlDestroy(memctrl);
+            memctrl = SIM_MemCtrlCreate(&ctrl_config);
+            memctrl_config = ctrl_config;
+            if (memctrl == NULL && ctrl_config.banks != 0)
+            {
+                fprintf(stderr, "Out of memory for the memory controller\n");
+                abort();
+            }
+        }
+        else
+        {
+            SIM_MemCtrlReset(memctrl);
+        }
+
+        timing.load_latency = SIM_GetLoadLat_r(mem);
+        timing.store_latency = SIM_GetStoreLat_r(mem);
+        timing.branch_penalty = SIM_GetBranchPenalty_r(mem);
+        timing.cache = cache;
+        timing.hit_latency = config.hit_latency;
+        timing.miss_latency = config.miss_latency;
+        timing.memctrl = memctrl;
+
+        mode = run_mode;
+        context_switch_penalty = SIM_GetSwitchCycles_r(mem);
+        SIM_GetSwitchPolicy_r(mem, &switching);
+        SIM_GetSMT_r(mem, &smt);
+        if (mode == MT_SMT && smt.policy == FETCH_ICOUNT)
+        {
+            order = ORDER_ISSUED;
+        }
+        else if (mode == MT_BLOCKED && switching.policy == SWITCH_PRIORITY)
+        {
+            order = ORDER_PRIORITY;
+        }
+        else if (mode == MT_BLOCKED && switching.policy == SWITCH_LRU)
+        {
+            order = ORDER_LAST_RUN;
+        }
+
+        SIM_DataViewReset(data);
+        threads.reset(mem, data, first_tid, count, timing, order, store_log);
+        thread_count = count;
+        active_thread_count = count;
+        rr_tid = 0;
+        slice_used = 0;
+        cycles = 0;
+        retire_count = 0;
+        from_start = true;
+#if SIM_STATS
+        switch_cycles = 0;
+        idle_cycles = 0;
+#endif
+#if SIM_TRACE
+        trace.reset();
+#endif
+    }
+
+#if SIM_TRACE
+    /**
+     * @brief Trace the run just started to the given file, if open.
+     * @param first_tid Image tid of the core's thread 0.
+     * @param id Id of the core in a multi-core run.
+     * @param run Number of the run in the file.
+     */
+    void start_trace(TraceFile &file, int first_tid, int id, uint32_t run)
+    {
+        if (!file.is_open())
+        {
+            return;
+        }
+        trace.reset(new TraceBuffer(&file, first_tid, id, run,
+                                    context_switch_penalty));
+        threads.set_trace(trace.get());
+        trace->push(TRACE_RUN, cycles, 0, thread_count, mode);
+    }
+#endif
+};
+
+/**
+ * @brief A barrier for a number of host threads, reusable from one phase to
+ * the next.
+ */
+class Barrier
+{
+private:
+    std::mutex m_lock;
+    std::condition_variable m_released;
+    int m_count;
+    int m_waiting;
+    size_t m_phase;
+
+    void release()
+    {
+        m_waiting = 0;
+        ++m_phase;
+        m_released.notify_all();
+    }
+
+public:
+    explicit Barrier(int count) : m_count(count), m_waiting(0), m_phase(0) {}
+
+    /**
+     * @brief Wait until all threads reach the barrier.
+     */
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+        size_t phase = m_phase;
+
+        if (++m_waiting == m_count)
+        {
+            release();
+            return;
+        }
+        m_released.wait(lock, [&] { return m_phase != phase; });
+    }
+
+    /**
+     * @brief Stop waiting for `count` of the threads, e.g. ones that could not
+     * be started.
+     */
+    void drop(int count)
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_count -= count;
+        if (m_waiting > 0 && m_waiting >= m_count)
+        {
+            release();
+        }
+    }
+};
+
+/**
+ * @brief A multi-core run: the image's threads spread over cores, a
+ * contiguous range each, synchronized every quantum. During a quantum, each
+ * core runs on its own view of the data and logs its STOREs; at its end, all
+ * cores replay the logs of all cores, in core order, so their views agree
+ * again.
+ */
+struct MultiCoreRun
+{
+    std::vector<std::unique_ptr<Core> > &cores;
+    size_t quantum;
+    std::vector<StoreLog> logs;
+    Barrier barrier;
+
+    MultiCoreRun(std::vector<std::unique_ptr<Core> > &run_cores,
+                 size_t run_quantum,
+                 int workers) :
+        cores(run_cores),
+        quantum(run_quantum),
+        logs(run_cores.size()),
+        barrier(workers)
+    {}
+};
+
+/**
+ * @brief State of a functional-only run: the threads, run with no timing, and
+ * the data memory they leave. While they run in parallel, each thread has a
+ * view of its own, and the words it accessed are recorded once it finishes,
+ * to tell whether it shared data with the others.
+ */
+struct FunctionalCore
+{
+    Program program;
+    std::vector<Thread> threads;
+    SimDataView * data;
+    std::vector<SimDataView *> views;   // of the host threads
+    size_t retire_count;
+
+    // The words accessed so far, each with the first thread to access it and
+    // whether that thread STOREd it.
+    std::mutex lock;
+    std::unordered_map<uint32_t, std::pair<int, bool> > accessed;
+    std::atomic<bool> shared;
+
+    FunctionalCore() : data(NULL), retire_count(0), shared(false) {}
+
+    ~FunctionalCore()
+    {
+        SIM_DataViewDestroy(data);
+        for (SimDataView * view : views)
+        {
+            SIM_DataViewDestroy(view);
+        }
+    }
+};
+
+// Instructions a thread runs at a time when a core runs functionally
+#define FUNCTIONAL_BURST 64
+
+// Windows to sample again with, when too few were sampled to estimate the
+// error
+#define MIN_SAMPLE_WINDOWS 30
+
+#define CHECKPOINT_MAGIC "MTSIMCKP"
+#define CHECKPOINT_VERSION 3
+
+/**
+ * @brief The header of a checkpoint file. It is followed by a `ThreadState`
+ * per thread, the states of the data cache and of the memory controller (if
+ * the core has them), and the data pages the run wrote. Like binary images,
+ * checkpoints are written in the host's byte order and layout.
+ */
+struct CheckpointHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t mode;
+    uint32_t thread_count;
+    int32_t active_thread_count;
+    int32_t rr_tid;
+    uint32_t has_cache;
+    uint32_t has_memctrl;
+    uint32_t slice_used;
+    uint64_t code_hash;     // of the threads' programs
+    uint64_t cycles;
+    uint64_t retire_count;
+};
+
+#define RESULT_MAGIC "MTSIMRES"
+#define RESULT_VERSION 1
+
+/**
+ * @brief The key of a result in the result store. The parameters a mode does
+ * not depend on are 0, so that e.g. fine-grained runs share their results
+ * across switch penalties.
+ */
+struct ResultKey
+{
+    uint64_t image_hash[2];     // of SIM_MemHash_r
+    uint32_t mode;
+    int32_t thread_count;
+    int32_t load_latency;
+    int32_t store_latency;
+    int32_t branch_penalty;
+    int32_t switch_cycles;      // blocked MT only
+    SimSwitchConfig switching;  // blocked MT only, timeslice of SWITCH_TIMESLICE only
+    SimSMTConfig smt;           // SMT only
+    SimCacheConfig cache;       // 0 for no cache
+    SimMemCtrlConfig memctrl;   // 0 for no controller
+};
+
+/**
+ * @brief The header of a result file. It is followed by the final
+ * `ThreadState` of each thread, in the host's byte order and layout, as in
+ * checkpoints.
+ */
+struct ResultHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t checkpoint_version;    // of the ThreadState layout
+    ResultKey key;
+    uint64_t cycles;
+    uint64_t retire_count;
+};
+
+/**
+ * @brief An independent simulation: a memory simulator, and a core for each MT
+ * mode, plus the cores of a multi-core run. The cores never write the memory's
+ * data, but a view of it each, so all start from the loaded image and can be
+ * simulated at the same time.
+ */
+struct _sim_instance
+{
+    SimMemory * mem;
+    bool owns_mem;
+#if SIM_TRACE
+    TraceFile trace;    // outlives the cores' buffers
+#endif
+    Core blocked;
+    Core finegrained;
+    Core smt;
+    FunctionalCore functional;
+    std::vector<std::unique_ptr<Core> > cores;
+    std::vector<int> core_first_tid;    // then the number of threads
+
+    _sim_instance(SimMemory * memory, bool owns_memory) :
+        mem(memory),
+        owns_mem(owns_memory)
+    {
+        blocked.data = SIM_DataViewCreate(memory);
+        finegrained.data = SIM_DataViewCreate(memory);
+        smt.data = SIM_DataViewCreate(memory);
+        functional.data = SIM_DataViewCreate(memory);
+    }
+
+    ~_sim_instance()
+    {
+        if (owns_mem)
+        {
+            SIM_MemDestroy(mem);
+        }
+    }
+
+    /**
+     * @brief Check that the construction allocated everything.
+     */
+    bool is_valid() const
+    {
+        return blocked.data != NULL &&
+               finegrained.data != NULL &&
+               smt.data != NULL &&
+               functional.data != NULL;
+    }
+};
+
+/* ----- Helper Functions ----- */
+
+/**
+ * @brief Get the instance behind the non-reentrant API, which simulates the
+ * default memory.
+ */
+SimInstance * default_instance()
+{
+    static SimInstance instance(SIM_MemDefault(), false);
+    return &instance;
+}
+
+/**
+ * @brief Get the core of the instance that runs the given MT mode.
+ */
+Core &mode_core(SimInstance * sim, mt_mode mode)
+{
+    switch (mode)
+    {
+        case MT_FINEGRAINED:
+            return sim->finegrained;
+        case MT_SMT:
+            return sim->smt;
+        case MT_BLOCKED:
+        default:
+            return sim->blocked;
+    }
+}
+
+#if SIM_TRACE
+/**
+ * @brief Stop tracing the runs of the instance's cores, writing out their
+ * buffered records.
+ */
+void stop_traces(SimInstance * sim)
+{
+    Core * cores[3] = { &sim->blocked, &sim->finegrained, &sim->smt };
+
+    for (Core * core : cores)
+    {
+        core->threads.set_trace(NULL);
+        core->trace.reset();
+    }
+    for (std::unique_ptr<Core> &core : sim->cores)
+    {
+        if (core)
+        {
+            core->threads.set_trace(NULL);
+            core->trace.reset();
+        }
+    }
+}
+#endif
+
+/**
+ * @brief Hash (FNV-1a) the programs of the first `thread_count` threads of the
+ * image, to tell whether a checkpoint was taken of the same programs.
+ */
+uint64_t code_hash(const SimMemory * mem, int thread_count)
+{
+    uint64_t hash = 14695981039346656037ull;
+
+    for (int tid = 0; tid < thread_count; ++tid)
+    {
+        uint32_t length;
+        const Instruction * code = SIM_MemInstCode_r(mem, tid, &length);
+        const unsigned char * bytes = (const unsigned char *)code;
+
+        for (size_t i = 0; i < sizeof(length); ++i)
+        {
+            hash = (hash ^ ((length >> (8 * i)) & 0xff)) * 1099511628211ull;
+        }
+        for (size_t i = 0; i < length * sizeof(Instruction); ++i)
+        {
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+        }
+    }
+    return hash;
+}
+
+/**
+ * @brief Read the state of a core's run from an open checkpoint file, over a
+ * core freshly reset to the start of the run.
+ * @return `true` on success.
+ */
+bool restore_core(Core &core, const SimMemory * mem, mt_mode mode, FILE * file)
+{
+    CheckpointHeader header;
+    ThreadState state;
+    int active_thread_count = 0;
+
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != CHECKPOINT_VERSION ||
+        header.mode != (uint32_t)mode ||
+        header.thread_count != (uint32_t)core.thread_count ||
+        header.code_hash != code_hash(mem, core.thread_count) ||
+        header.active_thread_count < 0 ||
+        header.active_thread_count > core.thread_count ||
+        header.rr_tid < 0 ||
+        header.rr_tid >= core.thread_count ||
+        header.has_cache != (core.cache != NULL) ||
+        header.has_memctrl != (core.memctrl != NULL))
+    {
+        return false;
+    }
+
+    for (int tid = 0; tid < core.thread_count; ++tid)
+    {
+        if (fread(&state, sizeof(state), 1, file) != 1 ||
+            !core.threads[tid].restore(state))
+        {
+            return false;
+        }
+        active_thread_count += state.finished == 0;
+    }
+    if (active_thread_count != header.active_thread_count)
+    {
+        return false;
+    }
+
+    if ((core.cache != NULL && SIM_CacheRestore(core.cache, file) < 0) ||
+        (core.memctrl != NULL && SIM_MemCtrlRestore(core.memctrl, file) < 0) ||
+        SIM_DataViewRestore(core.data, file) < 0)
+    {
+        return false;
+    }
+
+    core.active_thread_count = header.active_thread_count;
+    core.rr_tid = header.rr_tid;
+    core.slice_used = header.slice_used;
+    core.cycles = header.cycles;
+    core.retire_count = header.retire_count;
+    core.from_start = false;
+    core.threads.resume(core.cycles);
+    return true;
+}
+
+/**
+ * @brief Get the key of the result of a full run of the given mode, with the
+ * memory's image and parameters. The parameters the mode does not depend on
+ * are left 0.
+ */
+void result_key(const SimMemory * mem, mt_mode mode, ResultKey &key)
+{
+    memset(&key, 0, sizeof(key));
+    SIM_MemHash_r(mem, key.image_hash);
+    key.mode = mode;
+    key.thread_count = SIM_GetThreadsNum_r(mem);
+    key.load_latency = SIM_GetLoadLat_r(mem);
+    key.store_latency = SIM_GetStoreLat_r(mem);
+    key.branch_penalty = SIM_GetBranchPenalty_r(mem);
+    SIM_GetCache_r(mem, &key.cache);
+    if (key.cache.size == 0)
+    {
+        memset(&key.cache, 0, sizeof(key.cache));
+    }
+    SIM_GetMemCtrl_r(mem, &key.memctrl);
+    if (key.memctrl.banks == 0)
+    {
+        memset(&key.memctrl, 0, sizeof(key.memctrl));
+    }
+
+    if (mode == MT_BLOCKED)
+    {
+        key.switch_cycles = SIM_GetSwitchCycles_r(mem);
+        SIM_GetSwitchPolicy_r(mem, &key.switching);
+        if (key.switching.policy != SWITCH_TIMESLICE)
+        {
+            key.switching.timeslice = 0;
+        }
+    }
+    else if (mode == MT_SMT)
+    {
+        SIM_GetSMT_r(mem, &key.smt);
+    }
+}
+
+/**
+ * @brief Get the path of the file of a result in the store's directory,
+ * named after the hash (FNV-1a) of its key.
+ */
+std::string result_path(const char * dir, const ResultKey &key)
+{
+    const unsigned char * bytes = (const unsigned char *)&key;
+    uint64_t hash = 14695981039346656037ull;
+    char name[32];
+
+    for (size_t i = 0; i < sizeof(key); ++i)
+    {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    snprintf(name, sizeof(name), "/%016llx.res", (unsigned long long)hash);
+    return std::string(dir) + name;
+}
+
+/**
+ * @brief Switching policies of the single-issue MT modes, for
+ * `mt_perform_cycle`. A policy picks the ready thread that runs next, tells
+ * whether running it takes a context switch, bounds the burst it runs for,
+ * and follows the threads that ran. Its calls are static and inline, so the
+ * cycle loop of each mode carries no runtime policy checks.
+ */
+
+/**
+ * @brief Fine-grained MT: a different thread every cycle, in RR order, with
+ * no switch penalty. `rr_tid` is the next tid the RR considers. While the
+ * picked thread is the only ready one, the cycles until the next thread wakes
+ * up are performed along with it, as a burst of instructions.
+ */
+struct FinegrainedPolicy
+{
+    static int pick(Core &core)
+    {
+        return core.threads.pick(core.rr_tid);
+    }
+
+    static bool switches(const Core &, int)
+    {
+        return false;
+    }
+
+    static size_t budget(const Core &core, int, size_t end)
+    {
+        return std::min(core.threads.burst(core.cycles), end - core.cycles);
+    }
+
+    static void ran(Core &core, int tid, size_t)
+    {
+        core.rr_tid = tid + 1 < core.thread_count ? tid + 1 : 0;
+    }
+};
+
+/**
+ * @brief Blocked MT (SWITCH_RR): the last thread to run keeps the core until
+ * it stalls or finishes, then the next ready one in RR order gets it, after a
+ * context switch. `rr_tid` is the last tid that ran. The other blocked
+ * policies only pick differently.
+ *
+ * A taken branch is not a stall: under every policy, the core idles through
+ * the branch penalty of the last thread rather than switching.
+ */
+struct BlockedPolicy
+{
+    static int pick(Core &core)
+    {
+        if (in_branch(core))
+        {
+            return -1;
+        }
+        return core.threads.pick(core.rr_tid);
+    }
+
+    static bool in_branch(const Core &core)
+    {
+        return core.threads[core.rr_tid].in_branch_penalty(core.cycles);
+    }
+
+    /**
+     * @brief The first thread of a run gets the core with no context switch,
+     * whichever the policy picks.
+     */
+    static bool switches(const Core &core, int tid)
+    {
+        return tid != core.rr_tid && core.retire_count > 0;
+    }
+
+    static size_t budget(const Core &core, int, size_t end)
+    {
+        return core.cycles < end ? end - core.cycles : 1;
+    }
+
+    static void ran(Core &core, int tid, size_t)
+    {
+        core.rr_tid = tid;
+    }
+};
+
+/**
+ * @brief Blocked MT (SWITCH_LATENCY): as RR, but while the stall of the last
+ * thread has no more cycles left than a context switch takes, the core idles
+ * and waits for it rather than switching.
+ */
+struct LatencyPolicy : BlockedPolicy
+{
+    static int pick(Core &core)
+    {
+        const Thread &last = core.threads[core.rr_tid];
+
+        if (in_branch(core))
+        {
+            return -1;
+        }
+        if (!last.is_finished() &&
+            last.get_ready_cycle() > core.cycles &&
+            last.get_ready_cycle() - core.cycles <=
+                (size_t)core.context_switch_penalty)
+        {
+            return -1;
+        }
+        return core.threads.pick(core.rr_tid);
+    }
+};
+
+/**
+ * @brief Blocked MT (SWITCH_TIMESLICE): as RR, but a thread that ran a
+ * timeslice of instructions in a row also gives up the core, to the next ready
+ * thread in RR order (or starts another slice, if no other thread is ready).
+ * `slice_used` counts the instructions of the last thread's slice.
+ */
+struct TimeslicePolicy : BlockedPolicy
+{
+    static int pick(Core &core)
+    {
+        if (in_branch(core))
+        {
+            return -1;
+        }
+        if (core.slice_used < core.switching.timeslice)
+        {
+            return core.threads.pick(core.rr_tid);
+        }
+        core.slice_used = 0;
+        return core.threads.pick(core.rr_tid + 1 < core.thread_count ?
+                                     core.rr_tid + 1 : 0);
+    }
+
+    static size_t budget(const Core &core, int tid, size_t end)
+    {
+        size_t used = tid == core.rr_tid ? core.slice_used : 0;
+        return std::min(BlockedPolicy::budget(core, tid, end),
+                        core.switching.timeslice - used);
+    }
+
+    static void ran(Core &core, int tid, size_t executed)
+    {
+        core.slice_used =
+            (tid == core.rr_tid ? core.slice_used : 0) + executed;
+        core.rr_tid = tid;
+    }
+};
+
+/**
+ * @brief Blocked MT (SWITCH_PRIORITY, SWITCH_LRU): once the last thread
+ * stalls, the ready thread first in the pool's order gets the core (the
+ * highest priority, or the least recently run one), ties going to the next in
+ * RR order. A thread that wakes up first in order does not preempt the
+ * running one. The first thread of a run is picked in order as well.
+ */
+struct OrderedPolicy : BlockedPolicy
+{
+    static int pick(Core &core)
+    {
+        if (in_branch(core))
+        {
+            return -1;
+        }
+        if (core.retire_count == 0)
+        {
+            return core.threads.pick_ordered(0);
+        }
+        if (core.threads.is_ready(core.rr_tid))
+        {
+            return core.rr_tid;
+        }
+        return core.threads.pick_ordered(
+            core.rr_tid + 1 < core.thread_count ? core.rr_tid + 1 : 0);
+    }
+};
+
+/**
+ * @brief Perform a single cycle of the machine in a single-issue MT mode.
+ * This includes waking up threads whose memory operations completed, as well
+ * as executing an instruction in (at most) one active thread, picked by the
+ * policy. Whenever switching between threads, some cycles of penalty are
+ * taken where the machine cannot execute any instructions.
+ *
+ * The picked thread goes on for the following cycles the policy allows, as a
+ * burst of instructions (it stops earlier if it stalls or finishes).
+ *
+ * @param core INOUT    The simulated core. Its count of active threads lowers
+ * if the thread that executed reached a HALT instruction.
+ * @param end IN    Cycle the thread must not run into, e.g. the end of a
+ * quantum. A blocked thread executes at least one instruction anyway.
+ * @tparam Policy The switching policy, e.g. `BlockedPolicy`.
+ */
+template <class Policy>
+void mt_perform_cycle(Core &core, size_t end)
+{
+    int picked_tid;
+    size_t executed;
+
+    core.threads.wake(core.cycles);
+    picked_tid = Policy::pick(core);
+
+    if (picked_tid < 0)
+    {
+        STAT_ADD(core.idle_cycles, 1);
+        ++core.cycles;
+        return;
+    }
+
+    // If the policy switches threads, do a context switch (during which all
+    // threads are idle).
+    if (Policy::switches(core, picked_tid))
+    {
+        STAT_ADD(core.switch_cycles, core.context_switch_penalty);
+        TRACE_SWITCH(core.trace);
+        core.cycles += core.context_switch_penalty;
+    }
+
+    Thread &thread = core.threads[picked_tid];
+    executed = thread.run(core.cycles, Policy::budget(core, picked_tid, end));
+    core.threads.update(picked_tid, core.cycles + executed - 1);
+
+    // If the thread finished, remove it from active count.
+    if (thread.is_finished())
+    {
+        --core.active_thread_count;
+    }
+
+    // Increment count of executed instructions, one per cycle.
+    core.retire_count += executed;
+    core.cycles += executed;
+
+    Policy::ran(core, picked_tid, executed);
+}
+
+/**
+ * @brief Pick the ready threads that issue in an SMT cycle.
+ *
+ * @param threads IN    The threads of the core.
+ * @param config IN The issue width and fetch policy.
+ * @param next_tid IN   First tid to consider in round-robin order.
+ * @param picked OUT    Up to `config.width` distinct ready tids, in the order
+ * they issue.
+ */
+void smt_pick(const ThreadPool &threads,
+              const SimSMTConfig &config,
+              int next_tid,
+              std::vector<int> &picked)
+{
+    if (config.policy == FETCH_ICOUNT)
+    {
+        threads.pick_ordered(config.width, picked);
+        return;
+    }
+
+    int first = threads.pick(next_tid);
+    int tid = first;
+
+    picked.clear();
+    while (tid >= 0 && picked.size() < config.width)
+    {
+        picked.push_back(tid);
+        tid = threads.pick(tid + 1 < threads.size() ? tid + 1 : 0);
+        if (tid == first)
+        {
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Perform a single cycle of the machine in SMT mode. This includes
+ * waking up threads whose memory operations completed, as well as executing
+ * an instruction in each of up to W ready threads, picked by the fetch policy.
+ *
+ * While a single thread is ready, the cycles until the next thread wakes up
+ * are performed along with it, as a burst of instructions.
+ *
+ * @param core INOUT    The simulated core, with its issue width and fetch
+ * policy. Its `rr_tid` is the first tid the RR considers, and updates to the
+ * tid after the last one that executed. Its count of active threads lowers by
+ * the threads that reached a HALT instruction.
+ * @param end IN    Cycle a burst must not run into. Later than the current
+ * cycle.
+ */
+void smt_perform_cycle(Core &core, size_t end)
+{
+    std::vector<int> &picked = core.picked;
+    size_t burst;
+    size_t executed;
+
+    core.threads.wake(core.cycles);
+    burst = std::min(core.threads.burst(core.cycles), end - core.cycles);
+    if (burst > 1)
+    {
+        picked.assign(1, core.threads.pick(core.rr_tid));
+    }
+    else
+    {
+        smt_pick(core.threads, core.smt, core.rr_tid, picked);
+    }
+
+    if (picked.empty() || picked[0] < 0)
+    {
+        STAT_ADD(core.idle_cycles, 1);
+        ++core.cycles;
+        return;
+    }
+
+    for (int tid : picked)
+    {
+        Thread &thread = core.threads[tid];
+        executed = thread.run(core.cycles, burst);
+        core.threads.update(tid, core.cycles + executed - 1);
+
+        // If the thread finished, remove it from active count.
+        if (thread.is_finished())
+        {
+            --core.active_thread_count;
+        }
+        core.retire_count += executed;
+    }
+
+    // A burst takes a cycle per instruction, a cycle of picked threads one.
+    core.cycles += burst > 1 ? executed : 1;
+
+    core.rr_tid = picked.back() + 1 < core.thread_count ? picked.back() + 1 : 0;
+}
+
+/**
+ * @brief Run a core until all its threads finish, or until it reaches the
+ * given cycle, a cycle (or burst) at a time.
+ * @tparam PerformCycle Performs a cycle of the core's MT mode.
+ */
+template <void (*PerformCycle)(Core &, size_t)>
+bool run_cycles(Core &core, size_t end)
+{
+    while (core.active_thread_count > 0)
+    {
+        size_t idle_from = core.cycles;
+        core.cycles = core.threads.fast_forward(core.cycles);
+        STAT_ADD(core.idle_cycles, core.cycles - idle_from);
+        if (core.cycles >= end)
+        {
+            return false;
+        }
+        PerformCycle(core, end);
+    }
+    return true;
+}
+
+/**
+ * @brief Run a core in its MT mode until all its threads finish, or until it
+ * reaches the given cycle.
+ * @param end First cycle not to run (a blocked core may run past it, to the
+ * end of a context switch), or `(size_t)-1` to run to the end.
+ * @return `true` if all threads finished.
+ */
+bool run_core(Core &core, size_t end)
+{
+    switch (core.mode)
+    {
+        case MT_FINEGRAINED:
+            return run_cycles<mt_perform_cycle<FinegrainedPolicy> >(core, end);
+        case MT_SMT:
+            return run_cycles<smt_perform_cycle>(core, end);
+        case MT_BLOCKED:
+        default:
+            break;
+    }
+
+    switch (core.switching.policy)
+    {
+        case SWITCH_LATENCY:
+            return run_cycles<mt_perform_cycle<LatencyPolicy> >(core, end);
+        case SWITCH_TIMESLICE:
+            return run_cycles<mt_perform_cycle<TimeslicePolicy> >(core, end);
+        case SWITCH_PRIORITY:
+        case SWITCH_LRU:
+            return run_cycles<mt_perform_cycle<OrderedPolicy> >(core, end);
+        case SWITCH_RR:
+        default:
+            return run_cycles<mt_perform_cycle<BlockedPolicy> >(core, end);
+    }
+}
+
+/**
+ * @brief Run a core in its MT mode for (about) the given number of
+ * instructions, or until all its threads finish.
+ * @return Number of instructions executed.
+ */
+size_t run_detailed(Core &core, size_t count)
+{
+    size_t first = core.retire_count;
+    size_t width = core.mode == MT_SMT ? core.smt.width : 1;
+
+    while (core.active_thread_count > 0 && core.retire_count - first < count)
+    {
+        size_t left = count - (core.retire_count - first);
+        run_core(core, core.cycles + std::max(left / width, (size_t)1));
+    }
+    return core.retire_count - first;
+}
+
+/**
+ * @brief Run a core functionally (see `Thread::run_functional`), each active
+ * thread for its share of instructions: they take turns in RR order, up to
+ * `FUNCTIONAL_BURST` instructions each. They are then scheduled to go on in
+ * detail from the current cycle.
+ * @param share INOUT The instructions of each thread, decreased by those it
+ * executed.
+ * @param active Scratch space for the active tids.
+ * @return Number of instructions executed.
+ */
+size_t run_functional(Core &core,
+                      std::vector<size_t> &share,
+                      std::vector<int> &active)
+{
+    size_t executed = 0;
+
+    active.clear();
+    for (int i = 0; i < core.thread_count; ++i)
+    {
+        int tid = (core.rr_tid + i) % core.thread_count;
+        if (!core.threads[tid].is_finished() && share[tid] > 0)
+        {
+            active.push_back(tid);
+        }
+    }
+    if (active.empty())
+    {
+        return 0;
+    }
+
+    while (!active.empty())
+    {
+        size_t kept = 0;
+        for (size_t i = 0; i < active.size(); ++i)
+        {
+            int tid = active[i];
+            Thread &thread = core.threads[tid];
+            size_t ran = thread.run_functional(
+                std::min(share[tid], (size_t)FUNCTIONAL_BURST),
+                core.mode == MT_BLOCKED);
+
+            executed += ran;
+            share[tid] -= ran;
+            if (thread.is_finished())
+            {
+                --core.active_thread_count;
+                continue;
+            }
+            if (share[tid] > 0)
+            {
+                active[kept++] = active[i];
+            }
+        }
+        active.resize(kept);
+    }
+
+    core.threads.resume(core.cycles);
+    return executed;
+}
+
+/**
+ * @brief Share the instructions of a functional part among the active
+ * threads of a core as they shared the detailed part before it, or equally if
+ * they issued none there. The threads then stay as far apart as the detailed
+ * run left them, as they do in a full run, rather than drift to other
+ * relative positions (on which the CPI of the next window depends).
+ * @param issued The instructions each thread issued as of the start of the
+ * detailed part.
+ * @param share OUT The instructions of each thread.
+ */
+void share_functional(const Core &core,
+                      size_t count,
+                      const std::vector<size_t> &issued,
+                      std::vector<size_t> &share)
+{
+    size_t detailed = 0;
+    size_t active = 0;
+
+    for (int tid = 0; tid < core.thread_count; ++tid)
+    {
+        if (!core.threads[tid].is_finished())
+        {
+            detailed += core.threads[tid].get_issued() - issued[tid];
+            ++active;
+        }
+    }
+
+    share.assign(core.thread_count, 0);
+    for (int tid = 0; tid < core.thread_count && active > 0; ++tid)
+    {
+        if (core.threads[tid].is_finished())
+        {
+            continue;
+        }
+        share[tid] = detailed == 0 ?
+            count / active :
+            (size_t)((double)count *
+                     (core.threads[tid].get_issued() - issued[tid]) /
+                     detailed);
+    }
+}
+
+/**
+ * @brief The windows of a sampled run, for a ratio estimate of the CPI: the
+ * cycles of all windows over their instructions.
+ */
+struct SampleStats
+{
+    size_t windows;
+    double cycles;
+    double instructions;
+    double cycles_sq;
+    double instructions_sq;
+    double products;
+    size_t total;   // instructions of the run, detailed or functional
+
+    SampleStats() :
+        windows(0),
+        cycles(0),
+        instructions(0),
+        cycles_sq(0),
+        instructions_sq(0),
+        products(0),
+        total(0)
+    {}
+
+    void add(size_t window_cycles, size_t window_instructions)
+    {
+        ++windows;
+        cycles += window_cycles;
+        instructions += window_instructions;
+        cycles_sq += (double)window_cycles * window_cycles;
+        instructions_sq += (double)window_instructions * window_instructions;
+        products += (double)window_cycles * window_instructions;
+    }
+
+    double cpi() const
+    {
+        return cycles / instructions;
+    }
+
+    /**
+     * @brief Get the half-width of the 95% confidence interval of the CPI,
+     * relative to it. Infinite for fewer than two windows, unless they
+     * measured the whole run.
+     */
+    double error() const
+    {
+        if (instructions >= total)
+        {
+            return 0;
+        }
+        if (windows < 2)
+        {
+            return HUGE_VAL;
+        }
+
+        double ratio = cpi();
+        double variance = (cycles_sq - 2 * ratio * products +
+                           ratio * ratio * instructions_sq) / (windows - 1);
+        double sampled = instructions / (double)total;
+        double mean = instructions / windows;
+
+        // The windows are a sample of the whole run, without replacement.
+        variance = std::max(variance, 0.0) * std::max(1 - sampled, 0.0);
+        return 1.96 * sqrt(variance / windows) / mean / ratio;
+    }
+};
+
+/**
+ * @brief Run a core to the end in sampling mode: each period starts with a
+ * detailed warm-up, then a measured window, and goes on functionally.
+ */
+void sample_core(Core &core,
+                 const sample_config &config,
+                 size_t period,
+                 SampleStats &stats)
+{
+    std::vector<int> active;
+    std::vector<size_t> issued(core.thread_count);
+    std::vector<size_t> share;
+    size_t first_cycle;
+    size_t executed;
+
+    stats = SampleStats();
+    core.from_start = false;
+    while (core.active_thread_count > 0)
+    {
+        for (int tid = 0; tid < core.thread_count; ++tid)
+        {
+            issued[tid] = core.threads[tid].get_issued();
+        }
+        first_cycle = core.cycles;
+        executed = run_detailed(core, config.warmup);
+        stats.total += executed;
+        if (core.active_thread_count == 0 && stats.windows == 0)
+        {
+            // The whole run fit in the warm-up.
+            stats.add(core.cycles - first_cycle, executed);
+            break;
+        }
+
+        first_cycle = core.cycles;
+        executed = run_detailed(core, config.window);
+        if (executed > 0)
+        {
+            stats.add(core.cycles - first_cycle, executed);
+        }
+        stats.total += executed;
+
+        share_functional(core,
+                         period - config.warmup - config.window,
+                         issued,
+                         share);
+        stats.total += run_functional(core, share, active);
+    }
+}
+
+/**
+ * @brief Run a thread functionally to HALT.
+ * @return Number of instructions executed.
+ */
+size_t run_to_halt(Thread &thread)
+{
+    size_t executed = 0;
+
+    while (!thread.is_finished())
+    {
+        executed += thread.run_functional((size_t)-1, false);
+    }
+    return executed;
+}
+
+/**
+ * @brief Sort the addresses of a log by word, dropping duplicates.
+ */
+void sort_words(LoadLog &words)
+{
+    for (uint32_t &addr : words)
+    {
+        addr &= ~(uint32_t)3;
+    }
+    std::sort(words.begin(), words.end());
+    words.erase(std::unique(words.begin(), words.end()), words.end());
+}
+
+/**
+ * @brief Record the words a thread of a functional run accessed, and apply
+ * its STOREs to the run's data, unless it shared data with the threads that
+ * finished before it: LOADed or STOREd a word one of them STOREd, or STOREd a
+ * word one of them LOADed. Sorts the logs, by word.
+ * @param written Scratch space for the STOREd words.
+ * @return `false` if the thread shared data.
+ */
+bool merge_accesses(FunctionalCore &core,
+                    int tid,
+                    LoadLog &loads,
+                    const StoreLog &stores,
+                    LoadLog &written)
+{
+    written.clear();
+    for (const StoreLog::value_type &store : stores)
+    {
+        written.push_back(store.first);
+    }
+    sort_words(written);
+    sort_words(loads);
+
+    std::lock_guard<std::mutex> guard(core.lock);
+    for (uint32_t addr : written)
+    {
+        if (!core.accessed.insert(
+                std::make_pair(addr, std::make_pair(tid, true))).second)
+        {
+            return false;
+        }
+    }
+    for (uint32_t addr : loads)
+    {
+        const std::pair<int, bool> &first = core.accessed.insert(
+            std::make_pair(addr, std::make_pair(tid, false))).first->second;
+        if (first.first != tid && first.second)
+        {
+            return false;
+        }
+    }
+
+    for (const StoreLog::value_type &store : stores)
+    {
+        SIM_DataViewWrite(core.data, store.first, store.second);
+    }
+    return true;
+}
+
+/**
+ * @brief The work of a host thread in a functional run: running threads to
+ * HALT, one after the other, each on the host thread's view. Stops once any
+ * thread turns out to share data.
+ * @param next INOUT The next thread to run, shared by the host threads.
+ */
+void functional_work(FunctionalCore &core,
+                     SimDataView * view,
+                     std::atomic<int> &next,
+                     std::atomic<size_t> &retire_count)
+{
+    MemoryTiming timing = MemoryTiming();
+    LoadLog loads;
+    StoreLog stores;
+    LoadLog written;
+    size_t executed = 0;
+
+    for (int tid = next++;
+         tid < (int)core.threads.size() && !core.shared;
+         tid = next++)
+    {
+        loads.clear();
+        stores.clear();
+        SIM_DataViewReset(view);
+        core.threads[tid] = Thread(view, timing, &stores, &loads);
+        core.threads[tid].load(core.program.entry(tid),
+                               core.program.length(tid));
+        executed += run_to_halt(core.threads[tid]);
+        // The view and logs are reused by the next thread: leave this one on
+        // the run's data.
+        core.threads[tid].attach(core.data);
+
+        if (!merge_accesses(core, tid, loads, stores, written))
+        {
+            core.shared = true;
+        }
+    }
+    retire_count += executed;
+}
+
+/**
+ * @brief The work of a host thread in a multi-core run: running its cores
+ * quantum by quantum, in step with the other host threads.
+ * @param core_ids The cores the host thread runs.
+ */
+void mc_work(MultiCoreRun &run, const std::vector<int> &core_ids)
+{
+    size_t end = run.quantum;
+
+    for (;;)
+    {
+        for (int id : core_ids)
+        {
+            run_core(*run.cores[id], end);
+        }
+        run.barrier.wait();
+
+        // All cores are at the end of the quantum: make their STOREs visible.
+        // Quanta in which all cores wait are skipped.
+        size_t first_cycle = (size_t)-1;
+        for (size_t id = 0; id < run.cores.size(); ++id)
+        {
+            if (run.cores[id]->active_thread_count > 0)
+            {
+                first_cycle = std::min(first_cycle, run.cores[id]->cycles);
+            }
+        }
+        if (first_cycle != (size_t)-1)
+        {
+            for (int id : core_ids)
+            {
+                SimDataView * data = run.cores[id]->data;
+                for (const StoreLog &log : run.logs)
+                {
+                    for (const StoreLog::value_type &store : log)
+                    {
+                        SIM_DataViewWrite(data, store.first, store.second);
+                    }
+                }
+            }
+        }
+        run.barrier.wait();
+
+        for (int id : core_ids)
+        {
+            run.logs[id].clear();
+        }
+        if (first_cycle == (size_t)-1)
+        {
+            return;
+        }
+        end = (first_cycle / run.quantum + 1) * run.quantum;
+        if (end <= first_cycle)
+        {
+            end = (size_t)-1;   // overflow
+        }
+    }
+}
+
+/* ----- External API Functions ----- */
+
+SimInstance * CORE_Create()
+{
+    SimMemory * mem = SIM_MemCreate();
+    SimInstance * sim;
+
+    if (mem == NULL)
+    {
+        return NULL;
+    }
+
+    sim = CORE_Attach(mem);
+    if (sim == NULL)
+    {
+        SIM_MemDestroy(mem);
+    }
+    return sim;
+}
+
+SimInstance * CORE_Attach(SimMemory * mem)
+{
+    SimInstance * sim = new (std::nothrow) SimInstance(mem, true);
+
+    if (sim != NULL && !sim->is_valid())
+    {
+        // Leave the memory to the caller.
+        sim->owns_mem = false;
+        delete sim;
+        sim = NULL;
+    }
+    return sim;
+}
+
+void CORE_Destroy(SimInstance * sim)
+{
+    delete sim;
+}
+
+int CORE_Load(SimInstance * sim, const char * memImgFname)
+{
+    return SIM_MemReset_r(sim->mem, memImgFname);
+}
+
+SimMemory * CORE_Memory(SimInstance * sim)
+{
+    return sim->mem;
+}
+
+void CORE_BlockedMT_r(SimInstance * sim)
+{
+    CORE_Start_r(sim, MT_BLOCKED);
+    CORE_RunUntil_r(sim, MT_BLOCKED, (size_t)-1);
+}
+
+void CORE_FinegrainedMT_r(SimInstance * sim)
+{
+    CORE_Start_r(sim, MT_FINEGRAINED);
+    CORE_RunUntil_r(sim, MT_FINEGRAINED, (size_t)-1);
+}
+
+void CORE_SMT_r(SimInstance * sim)
+{
+    CORE_Start_r(sim, MT_SMT);
+    CORE_RunUntil_r(sim, MT_SMT, (size_t)-1);
+}
+
+void CORE_Start_r(SimInstance * sim, mt_mode mode)
+{
+    Core &core = mode_core(sim, mode);
+
+    core.reset(sim->mem, mode, 0, SIM_GetThreadsNum_r(sim->mem), NULL);
+#if SIM_TRACE
+    core.start_trace(sim->trace, 0, 0, sim->trace.next_run());
+#endif
+}
+
+bool CORE_RunUntil_r(SimInstance * sim, mt_mode mode, size_t cycle)
+{
+    return run_core(mode_core(sim, mode), cycle);
+}
+
+int CORE_Checkpoint_r(SimInstance * sim, mt_mode mode, const char * fname)
+{
+    const Core &core = mode_core(sim, mode);
+    CheckpointHeader header;
+    ThreadState state;
+    FILE * file;
+    bool ok;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = CHECKPOINT_VERSION;
+    header.mode = mode;
+    header.thread_count = core.thread_count;
+    header.active_thread_count = core.active_thread_count;
+    header.rr_tid = core.rr_tid;
+    header.slice_used = (uint32_t)core.slice_used;
+    header.has_cache = core.cache != NULL;
+    header.has_memctrl = core.memctrl != NULL;
+    header.code_hash = code_hash(sim->mem, core.thread_count);
+    header.cycles = core.cycles;
+    header.retire_count = core.retire_count;
+
+    file = fopen(fname, "wb");
+    if (file == NULL)
+    {
+        return -1;
+    }
+
+    ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (int tid = 0; ok && tid < core.thread_count; ++tid)
+    {
+        core.threads.at(tid).save(state);
+        ok = fwrite(&state, sizeof(state), 1, file) == 1;
+    }
+    ok = ok &&
+         (core.cache == NULL || SIM_CacheSave(core.cache, file) == 0) &&
+         (core.memctrl == NULL || SIM_MemCtrlSave(core.memctrl, file) == 0) &&
+         SIM_DataViewSave(core.data, file) == 0;
+
+    return fclose(file) == 0 && ok ? 0 : -1;
+}
+
+int CORE_Restore_r(SimInstance * sim, mt_mode mode, const char * fname)
+{
+    Core &core = mode_core(sim, mode);
+    FILE * file;
+    bool ok;
+
+    // Start over, with the memory's current timing parameters.
+    CORE_Start_r(sim, mode);
+
+    file = fopen(fname, "rb");
+    if (file == NULL)
+    {
+        return -1;
+    }
+    ok = restore_core(core, sim->mem, mode, file);
+    fclose(file);
+
+    if (!ok)
+    {
+        CORE_Start_r(sim, mode);
+        return -1;
+    }
+    return 0;
+}
+
+int CORE_ResultLookup_r(SimInstance * sim, mt_mode mode, const char * dir)
+{
+    Core &core = mode_core(sim, mode);
+    ResultKey key;
+    ResultHeader header;
+    std::vector<ThreadState> states;
+    FILE * file;
+    bool ok;
+
+    result_key(sim->mem, mode, key);
+    file = fopen(result_path(dir, key).c_str(), "rb");
+    if (file == NULL)
+    {
+        return errno == ENOENT ? 0 : -1;
+    }
+
+    // A file of another key (the names collided) or version is a miss.
+    ok = fread(&header, sizeof(header), 1, file) == 1 &&
+         memcmp(header.magic, RESULT_MAGIC, sizeof(header.magic)) == 0 &&
+         header.version == RESULT_VERSION &&
+         header.checkpoint_version == CHECKPOINT_VERSION &&
+         memcmp(&header.key, &key, sizeof(key)) == 0;
+    if (ok)
+    {
+        states.resize(key.thread_count);
+        ok = fread(states.data(), sizeof(ThreadState), states.size(), file) ==
+             states.size();
+    }
+    fclose(file);
+    for (size_t tid = 0; ok && tid < states.size(); ++tid)
+    {
+        ok = states[tid].finished != 0;
+    }
+    if (!ok)
+    {
+        return 0;
+    }
+
+    core.reset(sim->mem, mode, 0, key.thread_count, NULL);
+    for (int tid = 0; tid < key.thread_count; ++tid)
+    {
+        if (!core.threads[tid].restore(states[tid]))
+        {
+            core.reset(sim->mem, mode, 0, key.thread_count, NULL);
+            return 0;
+        }
+    }
+    core.active_thread_count = 0;
+    core.cycles = header.cycles;
+    core.retire_count = header.retire_count;
+    core.threads.resume(core.cycles);
+    return 1;
+}
+
+int CORE_ResultStore_r(SimInstance * sim, mt_mode mode, const char * dir)
+{
+    const Core &core = mode_core(sim, mode);
+    ResultHeader header;
+    ThreadState state;
+    std::string path;
+    std::string temp;
+    FILE * file;
+    int fd;
+    bool ok;
+
+    if (!core.from_start || core.active_thread_count != 0 ||
+        core.thread_count != SIM_GetThreadsNum_r(sim->mem))
+    {
+        return -1;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RESULT_MAGIC, sizeof(header.magic));
+    header.version = RESULT_VERSION;
+    header.checkpoint_version = CHECKPOINT_VERSION;
+    result_key(sim->mem, mode, header.key);
+    header.cycles = core.cycles;
+    header.retire_count = core.retire_count;
+
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST)
+    {
+        return -1;
+    }
+
+    // Write a temporary file of a unique name, then rename it into place: a
+    // reader opens either the whole result or none.
+    path = result_path(dir, header.key);
+    temp = path + ".XXXXXX";
+    fd = mkstemp(&temp[0]);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    fchmod(fd, 0644);   // rather than mkstemp's 0600, for other readers
+    file = fdopen(fd, "wb");
+    if (file == NULL)
+    {
+        close(fd);
+        unlink(temp.c_str());
+        return -1;
+    }
+
+    ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (int tid = 0; ok && tid < core.thread_count; ++tid)
+    {
+        core.threads.at(tid).save(state);
+        ok = fwrite(&state, sizeof(state), 1, file) == 1;
+    }
+    ok = fclose(file) == 0 && ok && rename(temp.c_str(), path.c_str()) == 0;
+
+    if (!ok)
+    {
+        unlink(temp.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+int CORE_Functional_r(SimInstance * sim)
+{
+    FunctionalCore &core = sim->functional;
+    int thread_count = SIM_GetThreadsNum_r(sim->mem);
+    MemoryTiming timing = MemoryTiming();
+    std::atomic<int> next(0);
+    std::atomic<size_t> retire_count(0);
+    int workers;
+
+    workers = std::min((int)std::thread::hardware_concurrency(), thread_count);
+    if (workers < 1)
+    {
+        workers = 1;
+    }
+    while ((int)core.views.size() < workers)
+    {
+        SimDataView * view = SIM_DataViewCreate(sim->mem);
+        if (view == NULL)
+        {
+            return -1;
+        }
+        core.views.push_back(view);
+    }
+
+    core.program.decode(sim->mem, 0, thread_count);
+    core.threads.assign(thread_count, Thread(core.data, timing, NULL));
+    SIM_DataViewReset(core.data);
+    core.shared = false;
+
+    // Run the threads in parallel, as if they shared no data.
+    std::vector<std::thread> threads;
+    for (int w = 1; w < workers; ++w)
+    {
+        try
+        {
+            threads.push_back(std::thread(functional_work,
+                                          std::ref(core),
+                                          core.views[w],
+                                          std::ref(next),
+                                          std::ref(retire_count)));
+        }
+        catch (const std::system_error &)
+        {
+            // No host thread to spare: this one runs the rest.
+            break;
+        }
+    }
+    functional_work(core, core.views[0], next, retire_count);
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+    std::unordered_map<uint32_t, std::pair<int, bool> >().swap(core.accessed);
+    core.retire_count = retire_count;
+
+    if (core.shared)
+    {
+        // Run them again, one after the other in tid order, on shared data.
+        SIM_DataViewReset(core.data);
+        core.retire_count = 0;
+        for (int tid = 0; tid < thread_count; ++tid)
+        {
+            core.threads[tid] = Thread(core.data, timing, NULL);
+            core.threads[tid].load(core.program.entry(tid),
+                               core.program.length(tid));
+            core.retire_count += run_to_halt(core.threads[tid]);
+        }
+    }
+    return core.shared ? 1 : 0;
+}
+
+int CORE_Sample_r(SimInstance * sim,
+                  mt_mode mode,
+                  const sample_config * config,
+                  sample_result * result)
+{
+    Core &core = mode_core(sim, mode);
+    SampleStats stats;
+    size_t period = config->period;
+
+    if ((mode != MT_BLOCKED && mode != MT_FINEGRAINED && mode != MT_SMT) ||
+        config->window == 0 ||
+        config->period < config->warmup + config->window ||
+        !(config->target_error >= 0))
+    {
+        return -1;
+    }
+
+    for (;;)
+    {
+        CORE_Start_r(sim, mode);
+        sample_core(core, *config, period, stats);
+
+        double error = stats.error();
+        if (config->target_error == 0 || error <= config->target_error)
+        {
+            break;
+        }
+
+        // Sample again, with as many windows as this run suggests the target
+        // needs.
+        double windows = stats.windows < 2 ?
+                         MIN_SAMPLE_WINDOWS :
+                         ceil(stats.windows * (error / config->target_error) *
+                              (error / config->target_error));
+        size_t shorter = std::max((size_t)(stats.total / windows),
+                                  config->warmup + config->window);
+        if (shorter >= period)
+        {
+            break;
+        }
+        period = shorter;
+    }
+
+    result->cpi = stats.cpi();
+    result->error = stats.error();
+    result->windows = stats.windows;
+    result->period = period;
+    result->instructions = stats.total;
+    return 0;
+}
+
+int CORE_MultiCore_r(SimInstance * sim,
+                     int cores,
+                     mt_mode mode,
+                     size_t quantum)
+{
+    int thread_count = SIM_GetThreadsNum_r(sim->mem);
+    int workers;
+
+    if (cores < 1 || cores > thread_count || quantum == 0 ||
+        (mode != MT_BLOCKED && mode != MT_FINEGRAINED && mode != MT_SMT))
+    {
+        return -1;
+    }
+
+    // Keep the cores (and their views) of the last run.
+    sim->cores.resize(cores);
+    for (std::unique_ptr<Core> &core : sim->cores)
+    {
+        if (!core)
+        {
+            core.reset(new (std::nothrow) Core());
+        }
+        if (!core)
+        {
+            return -1;
+        }
+        if (core->data == NULL)
+        {
+            core->data = SIM_DataViewCreate(sim->mem);
+        }
+        if (core->data == NULL)
+        {
+            return -1;
+        }
+    }
+
+    sim->core_first_tid.resize(cores + 1);
+    for (int id = 0; id <= cores; ++id)
+    {
+        sim->core_first_tid[id] = (int)((long)thread_count * id / cores);
+    }
+
+    workers = std::min((int)std::thread::hardware_concurrency(), cores);
+    if (workers < 1)
+    {
+        workers = 1;
+    }
+
+    MultiCoreRun run(sim->cores, quantum, workers);
+    for (int id = 0; id < cores; ++id)
+    {
+        sim->cores[id]->reset(sim->mem,
+                              mode,
+                              sim->core_first_tid[id],
+                              sim->core_first_tid[id + 1] -
+                                  sim->core_first_tid[id],
+                              &run.logs[id]);
+    }
+#if SIM_TRACE
+    uint32_t trace_run = sim->trace.next_run();
+    for (int id = 0; id < cores; ++id)
+    {
+        sim->cores[id]->start_trace(sim->trace,
+                                    sim->core_first_tid[id],
+                                    id,
+                                    trace_run);
+    }
+#endif
+
+    // Spread the cores over the host threads, this one being the first.
+    std::vector<std::vector<int> > core_ids(workers);
+    for (int id = 0; id < cores; ++id)
+    {
+        core_ids[id % workers].push_back(id);
+    }
+
+    std::vector<std::thread> threads;
+    for (int w = 1; w < workers; ++w)
+    {
+        try
+        {
+            threads.push_back(std::thread(mc_work,
+                                          std::ref(run),
+                                          std::cref(core_ids[w])));
+        }
+        catch (const std::system_error &)
+        {
+            // No host thread to spare: run its cores on this one.
+            core_ids[0].insert(core_ids[0].end(),
+                               core_ids[w].begin(),
+                               core_ids[w].end());
+            run.barrier.drop(1);
+        }
+    }
+    mc_work(run, core_ids[0]);
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+    return 0;
+}
+
+double CORE_BlockedMT_CPI_r(SimInstance * sim)
+{
+    return (double)sim->blocked.cycles / (double)sim->blocked.retire_count;
+}
+
+double CORE_FinegrainedMT_CPI_r(SimInstance * sim)
+{
+    return (double)sim->finegrained.cycles /
+           (double)sim->finegrained.retire_count;
+}
+
+double CORE_SMT_CPI_r(SimInstance * sim)
+{
+    return (double)sim->smt.cycles / (double)sim->smt.retire_count;
+}
+
+double CORE_MultiCore_CPI_r(SimInstance * sim)
+{
+    return (double)CORE_MultiCore_Cycles_r(sim) /
+           (double)CORE_MultiCore_Instructions_r(sim);
+}
+
+size_t CORE_BlockedMT_Cycles_r(SimInstance * sim)
+{
+    return sim->blocked.cycles;
+}
+
+size_t CORE_FinegrainedMT_Cycles_r(SimInstance * sim)
+{
+    return sim->finegrained.cycles;
+}
+
+size_t CORE_SMT_Cycles_r(SimInstance * sim)
+{
+    return sim->smt.cycles;
+}
+
+size_t CORE_MultiCore_Cycles_r(SimInstance * sim)
+{
+    size_t cycles = 0;
+    for (const std::unique_ptr<Core> &core : sim->cores)
+    {
+        cycles = std::max(cycles, core->cycles);
+    }
+    return cycles;
+}
+
+size_t CORE_BlockedMT_Instructions_r(SimInstance * sim)
+{
+    return sim->blocked.retire_count;
+}
+
+size_t CORE_FinegrainedMT_Instructions_r(SimInstance * sim)
+{
+    return sim->finegrained.retire_count;
+}
+
+size_t CORE_SMT_Instructions_r(SimInstance * sim)
+{
+    return sim->smt.retire_count;
+}
+
+size_t CORE_Functional_Instructions_r(SimInstance * sim)
+{
+    return sim->functional.retire_count;
+}
+
+size_t CORE_MultiCore_Instructions_r(SimInstance * sim)
+{
+    size_t retire_count = 0;
+    for (const std::unique_ptr<Core> &core : sim->cores)
+    {
+        retire_count += core->retire_count;
+    }
+    return retire_count;
+}
+
+size_t CORE_BlockedMT_CacheHits_r(SimInstance * sim, int threadid)
+{
+    return sim->blocked.threads.at(threadid).get_cache_hits();
+}
+
+size_t CORE_FinegrainedMT_CacheHits_r(SimInstance * sim, int threadid)
+{
+    return sim->finegrained.threads.at(threadid).get_cache_hits();
+}
+
+size_t CORE_SMT_CacheHits_r(SimInstance * sim, int threadid)
+{
+    return sim->smt.threads.at(threadid).get_cache_hits();
+}
+
+size_t CORE_BlockedMT_CacheMisses_r(SimInstance * sim, int threadid)
+{
+    return sim->blocked.threads.at(threadid).get_cache_misses();
+}
+
+size_t CORE_FinegrainedMT_CacheMisses_r(SimInstance * sim, int threadid)
+{
+    return sim->finegrained.threads.at(threadid).get_cache_misses();
+}
+
+size_t CORE_SMT_CacheMisses_r(SimInstance * sim, int threadid)
+{
+    return sim->smt.threads.at(threadid).get_cache_misses();
+}
+
+void CORE_BlockedMT_CTX_r(SimInstance * sim, tcontext * context, int threadid)
+{
+    sim->blocked.threads.at(threadid).extract_context(&context[threadid]);
+}
+
+void CORE_FinegrainedMT_CTX_r(SimInstance * sim,
+                              tcontext * context,
+                              int threadid)
+{
+    sim->finegrained.threads.at(threadid).extract_context(&context[threadid]);
+}
+
+void CORE_SMT_CTX_r(SimInstance * sim, tcontext * context, int threadid)
+{
+    sim->smt.threads.at(threadid).extract_context(&context[threadid]);
+}
+
+void CORE_Functional_CTX_r(SimInstance * sim, tcontext * context, int threadid)
+{
+    sim->functional.threads.at(threadid).extract_context(&context[threadid]);
+}
+
+void CORE_MultiCore_CTX_r(SimInstance * sim, tcontext * context, int threadid)
+{
+    // The core whose range of threads holds the thread.
+    std::vector<int>::const_iterator next =
+        std::upper_bound(sim->core_first_tid.begin(),
+                         sim->core_first_tid.end(),
+                         threadid);
+    size_t id = next - sim->core_first_tid.begin() - 1;
+
+    sim->cores.at(id)->threads.at(threadid - sim->core_first_tid[id])
+        .extract_context(&context[threadid]);
+}
+
+int CORE_GetStats_r(SimInstance * sim, mt_mode mode, core_stats * stats)
+{
+#if SIM_STATS
+    const Core &core = mode_core(sim, mode);
+
+    memset(stats, 0, sizeof(*stats));
+    stats->cycles = core.cycles;
+    stats->switch_cycles = core.switch_cycles;
+    stats->idle_cycles = core.idle_cycles;
+    for (int tid = 0; tid < core.threads.size(); ++tid)
+    {
+        const thread_stats &thread = core.threads.at(tid).get_stats();
+        for (int opcode = 0; opcode < CMD_COUNT; ++opcode)
+        {
+            stats->retired[opcode] += thread.retired[opcode];
+        }
+        stats->load_stall_cycles += thread.load_stall_cycles;
+        stats->store_stall_cycles += thread.store_stall_cycles;
+        stats->branch_stall_cycles += thread.branch_stall_cycles;
+    }
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+int CORE_GetThreadStats_r(SimInstance * sim,
+                          mt_mode mode,
+                          int threadid,
+                          thread_stats * stats)
+{
+#if SIM_STATS
+    *stats = mode_core(sim, mode).threads.at(threadid).get_stats();
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+int CORE_TraceOpen_r(SimInstance * sim, const char * fname)
+{
+#if SIM_TRACE
+    stop_traces(sim);
+    return sim->trace.open(fname) ? 0 : -1;
+#else
+    return -1;
+#endif
+}
+
+int CORE_TraceClose_r(SimInstance * sim)
+{
+#if SIM_TRACE
+    stop_traces(sim);
+    return sim->trace.close() ? 0 : -1;
+#else
+    return -1;
+#endif
+}
+
+void CORE_DataRead_r(SimInstance * sim,
+                     mt_mode mode,
+                     uint32_t addr,
+                     int32_t * dst)
+{
+    SIM_DataViewRead(mode_core(sim, mode).data, addr, dst);
+}
+
+void CORE_Functional_DataRead_r(SimInstance * sim, uint32_t addr, int32_t * dst)
+{
+    SIM_DataViewRead(sim->functional.data, addr, dst);
+}
+
+/**
+ * @brief Simulate blocked MT on a host thread of CORE_SimulateMT_r, keeping
+ * what it throws for the caller to rethrow.
+ */
+void blocked_work(SimInstance * sim, std::exception_ptr &error)
+{
+    try
+    {
+        CORE_BlockedMT_r(sim);
+    }
+    catch (...)
+    {
+        error = std::current_exception();
+    }
+}
+
+void CORE_SimulateMT_r(SimInstance * sim)
+{
+    std::exception_ptr error;
+    std::thread blocked;
+
+    try
+    {
+        blocked = std::thread(blocked_work, sim, std::ref(error));
+    }
+    catch (const std::system_error &)
+    {
+        // No host thread to spare: run the modes one after the other.
+        CORE_BlockedMT_r(sim);
+        CORE_FinegrainedMT_r(sim);
+        return;
+    }
+
+    try
+    {
+        CORE_FinegrainedMT_r(sim);
+    }
+    catch (...)
+    {
+        // The blocked run uses the instance: it must end first.
+        blocked.join();
+        throw;
+    }
+    blocked.join();
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+void CORE_BlockedMT()
+{
+    CORE_BlockedMT_r(default_instance());
+}
+
+void CORE_FinegrainedMT()
+{
+    CORE_FinegrainedMT_r(default_instance());
+}
+
+void CORE_SMT()
+{
+    CORE_SMT_r(default_instance());
+}
+
+void CORE_SimulateMT()
+{
+    CORE_SimulateMT_r(default_instance());
+}
+
+int CORE_Functional()
+{
+    return CORE_Functional_r(default_instance());
+}
+
+void CORE_Start(mt_mode mode)
+{
+    CORE_Start_r(default_instance(), mode);
+}
+
+bool CORE_RunUntil(mt_mode mode, size_t cycle)
+{
+    return CORE_RunUntil_r(default_instance(), mode, cycle);
+}
+
+int CORE_GetStats(mt_mode mode, core_stats * stats)
+{
+    return CORE_GetStats_r(default_instance(), mode, stats);
+}
+
+int CORE_GetThreadStats(mt_mode mode, int threadid, thread_stats * stats)
+{
+    return CORE_GetThreadStats_r(default_instance(), mode, threadid, stats);
+}
+
+int CORE_Sample(mt_mode mode,
+                const sample_config * config,
+                sample_result * result)
+{
+    return CORE_Sample_r(default_instance(), mode, config, result);
+}
+
+int CORE_Checkpoint(mt_mode mode, const char * fname)
+{
+    return CORE_Checkpoint_r(default_instance(), mode, fname);
+}
+
+int CORE_Restore(mt_mode mode, const char * fname)
+{
+    return CORE_Restore_r(default_instance(), mode, fname);
+}
+
+int CORE_ResultLookup(mt_mode mode, const char * dir)
+{
+    return CORE_ResultLookup_r(default_instance(), mode, dir);
+}
+
+int CORE_ResultStore(mt_mode mode, const char * dir)
+{
+    return CORE_ResultStore_r(default_instance(), mode, dir);
+}
+
+int CORE_TraceOpen(const char * fname)
+{
+    return CORE_TraceOpen_r(default_instance(), fname);
+}
+
+int CORE_TraceClose()
+{
+    return CORE_TraceClose_r(default_instance());
+}
+
+double CORE_BlockedMT_CPI()
+{
+    return CORE_BlockedMT_CPI_r(default_instance());
+}
+
+double CORE_FinegrainedMT_CPI()
+{
+    return CORE_FinegrainedMT_CPI_r(default_instance());
+}
+
+double CORE_SMT_CPI()
+{
+    return CORE_SMT_CPI_r(default_instance());
+}
+
+void CORE_BlockedMT_CTX(tcontext * context, int threadid)
+{
+    CORE_BlockedMT_CTX_r(default_instance(), context, threadid);
+}
+
+void CORE_FinegrainedMT_CTX(tcontext * context, int threadid)
+{
+    CORE_FinegrainedMT_CTX_r(default_instance(), context, threadid);
+}
+
+void CORE_SMT_CTX(tcontext * context, int threadid)
+{
+    CORE_SMT_CTX_r(default_instance(), context, threadid);
+}
+
+void CORE_Functional_CTX(tcontext * context, int threadid)
 {
-    g_fg_threads.at(threadid).extract_context(&context[threadid]);
+    CORE_Functional_CTX_r(default_instance(), context, threadid);
 }
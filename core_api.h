@@ -8,6 +8,8 @@ extern "C" {
 #endif
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #define REGS_COUNT 8
 
@@ -21,6 +23,10 @@ typedef enum
     CMD_LOAD,    // dst <- Mem[src1 + src2]  (src2 may be an immediate)
     CMD_STORE,   // Mem[dst + src2] <- src1  (src2 may be an immediate)
     CMD_HALT,
+    CMD_BEQ,     // if dst == src1: pc <- src2  (src2 may be an immediate)
+    CMD_BNE,     // if dst != src1: pc <- src2  (src2 may be an immediate)
+    CMD_JMP,     // pc <- src2  (src2 may be an immediate)
+    CMD_COUNT,   // number of opcodes
 } cmd_opcode;
 
 typedef struct _inst
@@ -38,21 +44,346 @@ typedef struct _regs
 } tcontext;
 
 
-/* Simulates blocked MT and fine-grained MT behavior, respectively */
+/* Simulates blocked MT and fine-grained MT behavior, respectively. Both start
+ * from the loaded memory image: the STOREs of one are not seen by the other */
 void CORE_BlockedMT();
 
 void CORE_FinegrainedMT();
 
+/* Simulates simultaneous MT: up to W instructions issue each cycle, each from
+ * a different ready thread, picked by the fetch policy (see the SMT parameters
+ * in sim_api.h). Starts from the loaded memory image as well */
+void CORE_SMT();
+
+/* Simulates both blocked MT and fine-grained MT, at the same time */
+void CORE_SimulateMT();
+
+/* Runs each thread's program to HALT with no timing model, for the final
+ * register files and data only. The threads run in parallel on the host's
+ * cores, each seeing only its own STOREs; then, if no thread LOADed or STOREd
+ * a word another one STOREd, all STOREs are applied and the results are
+ * those of any timed mode. Otherwise, the threads run again one after the
+ * other, in tid order. Returns 0 if the threads shared no data, 1 if they
+ * did (and ran in order), <0 if out of memory */
+int CORE_Functional();
+
+typedef enum
+{
+    MT_BLOCKED = 0,
+    MT_FINEGRAINED,
+    MT_SMT,
+} mt_mode;
+
+/* A run of a mode can also be simulated in steps: CORE_Start starts it from
+ * the loaded memory image, and CORE_RunUntil continues it up to (not
+ * including) the given cycle. A blocked run may stop a few cycles past it,
+ * not to split a context switch. Returns true once all threads finished. The
+ * calls of the mode below (e.g. CORE_BlockedMT_CTX) report the run so far */
+void CORE_Start(mt_mode mode);
+
+bool CORE_RunUntil(mt_mode mode, size_t cycle);
+
+/* Performance counters of the last run of a mode, for a thread and for the
+ * whole core. A thread's stall cycles are those it waited for its LOADs and
+ * STOREs, and after its taken branches (other threads may run meanwhile).
+ * Idle cycles are those in which no thread ran (none was ready, or blocked MT
+ * waited for the last thread), switch cycles the context-switch penalty of
+ * blocked MT.
+ * The counters are only kept when built with SIM_STATS=1 (make STATS=1):
+ * otherwise they cost nothing, and the calls below return <0 */
+typedef struct _thread_stats
+{
+    size_t retired[CMD_COUNT];  // by opcode
+    size_t load_stall_cycles;
+    size_t store_stall_cycles;
+    size_t branch_stall_cycles;
+} thread_stats;
+
+typedef struct _core_stats
+{
+    size_t cycles;
+    size_t retired[CMD_COUNT];  // of all threads
+    size_t load_stall_cycles;   // of all threads
+    size_t store_stall_cycles;  // of all threads
+    size_t branch_stall_cycles; // of all threads
+    size_t switch_cycles;
+    size_t idle_cycles;
+} core_stats;
+
+int CORE_GetStats(mt_mode mode, core_stats * stats);
+
+int CORE_GetThreadStats(mt_mode mode, int threadid, thread_stats * stats);
+
+/* Sampling parameters, to estimate the CPI of a long run quickly. The run
+ * goes by periods of `period` instructions: each starts with `warmup`
+ * instructions simulated in detail, then a window of `window` instructions
+ * measured in detail, and executes the rest functionally (registers, data and
+ * data cache only, no timing) */
+typedef struct _sample_config
+{
+    size_t period;
+    size_t warmup;
+    size_t window;
+    double target_error;    // of the estimate, relative, 0 for none
+} sample_config;
+
+typedef struct _sample_result
+{
+    double cpi;             // estimated
+    double error;           // half-width of its 95% confidence interval, relative
+    size_t windows;
+    size_t period;          // shortened to meet the target error
+    size_t instructions;    // of the whole run
+} sample_result;
+
+/* Estimates the CPI of a mode by sampling, with a 95% confidence interval.
+ * If the interval is wider than the target error, the run is sampled again
+ * with a period short enough to meet it (as estimated from the first run).
+ * The calls of the mode below then report the final state, and the cycles and
+ * instructions of the detailed parts only. Returns 0 for success, <0 if the
+ * window is empty or does not fit in the period */
+int CORE_Sample(mt_mode mode, const sample_config * config, sample_result * result);
+
+/* Write the state of a run of the given mode to a file: its threads, cycle and
+ * retire counters, RR position, data cache, memory controller, and the data
+ * pages it wrote. Returns 0 for success, <0 in case of error */
+int CORE_Checkpoint(mt_mode mode, const char * fname);
+
+/* Restore a run of the given mode from a checkpoint file, to continue it with
+ * CORE_RunUntil. The memory must have the image and number of threads the
+ * checkpoint was taken with, and the same cache and controller geometry; the
+ * latencies and the SMT parameters may differ, to fork the run from there.
+ * Returns 0 for success, <0 in case of error (the run is then back at its
+ * start) */
+int CORE_Restore(mt_mode mode, const char * fname);
+
+/* Persistent store of the results of full runs, in a directory any number of
+ * processes may share. A result is keyed by the content hash of the image
+ * (see SIM_MemHash_r) and the parameters its mode depends on: N, the
+ * latencies, the branch penalty, the data cache and the memory controller,
+ * plus the switch penalty and policy of blocked MT and the SMT parameters of
+ * SMT. It holds the final register files and the cycle and retire counts,
+ * hence the CPI. Each result is a file of its own, written under a temporary
+ * name and renamed into place: readers take no locks and never see a partial
+ * result, and workers storing a key at once just write the same result */
+
+/* Look up the result of a full run of the mode, with the memory's current
+ * image and parameters. On a hit, the run is left at its end as if it ran:
+ * the calls of the mode report its register files, cycles, instructions, CPI
+ * and cache hits, while its statistics and data read as those of a run that
+ * did not start. Returns 1 on a hit, 0 on a miss, <0 in case of error */
+int CORE_ResultLookup(mt_mode mode, const char * dir);
+
+/* Store the result of the last run of the mode, which must have run to its
+ * end from its start (e.g. by CORE_BlockedMT, not sampled nor restored),
+ * creating the directory if needed. Returns 0 for success, <0 in case of
+ * error */
+int CORE_ResultStore(mt_mode mode, const char * dir);
+
+/* Cycle trace of the timed runs, for a timeline view (see sim_trace). The
+ * file starts with TRACE_MAGIC, a uint32_t TRACE_VERSION and the uint32_t
+ * size of a record, followed by batches of the records of a core, each batch
+ * a trace_batch header and fixed-size records, in the host's byte order. The
+ * records of a run's core are in issue order, but the batches of separate
+ * runs and cores interleave; a *_BEGIN record is always followed by its *_END
+ * in the same batch. Tracing is only built in with SIM_TRACE=1 (make
+ * TRACE=1): otherwise it costs nothing, and the calls below return <0 */
+#define TRACE_MAGIC "MTSIMTRC"
+#define TRACE_VERSION 3
+
+/* The stall of a TRACE_ISSUE that waits this long or longer is recorded as a
+ * TRACE_STALL_BEGIN and TRACE_STALL_END pair, right after the issue */
+#define TRACE_LONG_STALL 255
+
+typedef enum
+{
+    TRACE_RUN = 0,      // a core starts a run: tid is its first tid, pc its
+                        // number of threads and opcode its mt_mode
+    TRACE_ISSUE,        // tid issues the instruction at pc
+    TRACE_STALL_BEGIN,  // tid starts waiting for its LOAD/STORE or taken
+                        // branch at pc, if TRACE_LONG_STALL cycles or more
+    TRACE_STALL_END,    // and may issue again
+    TRACE_HALT,         // tid finished, at the HALT at pc
+} trace_event;
+
+typedef struct _trace_batch
+{
+    uint32_t run;           // numbered from 0 in the file
+    uint32_t core;          // of a multi-core run, 0 otherwise
+    uint32_t count;         // of the records that follow
+    uint32_t switch_cycles; // of a context switch of the core
+} trace_batch;
+
+typedef struct _trace_record
+{
+    uint64_t cycle : 48;
+    uint64_t event : 3;     // trace_event
+    uint64_t switched : 1;  // of TRACE_ISSUE: the core switched to tid in
+                            // the switch_cycles right before
+    uint64_t opcode : 4;    // cmd_opcode of TRACE_ISSUE
+    uint64_t stall : 8;     // of TRACE_ISSUE: the cycles tid then waits,
+                            // from the next cycle (or TRACE_LONG_STALL)
+    uint32_t tid;
+    uint32_t pc;
+} trace_record;
+
+/* Trace all following timed runs (not the functional parts of a sampled run)
+ * to a file, until CORE_TraceClose. Returns 0 for success, <0 in case of
+ * error */
+int CORE_TraceOpen(const char * fname);
+
+/* Write out the buffered records and close the trace. Returns 0 for success,
+ * <0 if writing failed or no trace was open */
+int CORE_TraceClose();
+
 /* Get thread register file through the context pointer */
 void CORE_BlockedMT_CTX(tcontext context[], int threadid);
 
 void CORE_FinegrainedMT_CTX(tcontext context[], int threadid);
 
+void CORE_SMT_CTX(tcontext context[], int threadid);
+
+void CORE_Functional_CTX(tcontext context[], int threadid);
+
 /* Return performance in CPI metric */
 double CORE_BlockedMT_CPI();
 
 double CORE_FinegrainedMT_CPI();
 
+double CORE_SMT_CPI();
+
+/* ----- Reentrant API ----- */
+
+struct _sim_memory;
+
+/*
+ * A SimInstance is an independent simulation: a memory simulator (see
+ * sim_api.h) along with the state of both cores. Each call above has a `_r`
+ * counterpart taking the instance to operate on. The calls above operate on a
+ * default instance over the default memory, so separate instances can be run
+ * from separate host threads at the same time.
+ */
+typedef struct _sim_instance SimInstance;
+
+/* Create an empty simulation instance. Returns NULL if out of memory */
+SimInstance * CORE_Create();
+
+/* Create a simulation instance over an existing memory simulator, taking
+ * ownership of it. Returns NULL if out of memory (the memory is then left to
+ * the caller) */
+SimInstance * CORE_Attach(struct _sim_memory * mem);
+
+/* Destroy an instance created by CORE_Create/CORE_Attach, along with its memory */
+void CORE_Destroy(SimInstance * sim);
+
+/* Load a memory image into the instance, as SIM_MemReset does.
+ * Returns 0 for success, <0 in case of error */
+int CORE_Load(SimInstance * sim, const char * memImgFname);
+
+/* Get the memory simulator of the instance, for the SIM_*_r calls */
+struct _sim_memory * CORE_Memory(SimInstance * sim);
+
+void CORE_BlockedMT_r(SimInstance * sim);
+
+void CORE_FinegrainedMT_r(SimInstance * sim);
+
+void CORE_SMT_r(SimInstance * sim);
+
+void CORE_SimulateMT_r(SimInstance * sim);
+
+int CORE_Functional_r(SimInstance * sim);
+
+void CORE_Start_r(SimInstance * sim, mt_mode mode);
+
+bool CORE_RunUntil_r(SimInstance * sim, mt_mode mode, size_t cycle);
+
+int CORE_Sample_r(SimInstance * sim, mt_mode mode, const sample_config * config, sample_result * result);
+
+int CORE_Checkpoint_r(SimInstance * sim, mt_mode mode, const char * fname);
+
+int CORE_Restore_r(SimInstance * sim, mt_mode mode, const char * fname);
+
+int CORE_ResultLookup_r(SimInstance * sim, mt_mode mode, const char * dir);
+
+int CORE_ResultStore_r(SimInstance * sim, mt_mode mode, const char * dir);
+
+int CORE_TraceOpen_r(SimInstance * sim, const char * fname);
+
+int CORE_TraceClose_r(SimInstance * sim);
+
+/* Simulates a multi-core machine: the image's threads are spread over `cores`
+ * cores, a contiguous range of tids each, all running the given MT mode (SMT
+ * with the memory's SMT parameters). The cores run in parallel on the host's
+ * cores, and synchronize every `quantum` cycles. They share the data memory,
+ * each seeing the STOREs of the others from the end of the quantum they were
+ * made in (those of the later core win when two write a word in the same
+ * quantum). Each core has its own data cache and memory controller. Starts
+ * from the loaded memory image as well. Returns 0 for success, <0 if out of
+ * memory or if `cores` is not between 1 and the number of threads */
+int CORE_MultiCore_r(SimInstance * sim, int cores, mt_mode mode, size_t quantum);
+
+void CORE_BlockedMT_CTX_r(SimInstance * sim, tcontext context[], int threadid);
+
+void CORE_FinegrainedMT_CTX_r(SimInstance * sim, tcontext context[], int threadid);
+
+void CORE_SMT_CTX_r(SimInstance * sim, tcontext context[], int threadid);
+
+void CORE_Functional_CTX_r(SimInstance * sim, tcontext context[], int threadid);
+
+void CORE_MultiCore_CTX_r(SimInstance * sim, tcontext context[], int threadid);
+
+int CORE_GetStats_r(SimInstance * sim, mt_mode mode, core_stats * stats);
+
+int CORE_GetThreadStats_r(SimInstance * sim, mt_mode mode, int threadid, thread_stats * stats);
+
+/* Read a data word as the last run of a mode left it, or the functional run */
+void CORE_DataRead_r(SimInstance * sim, mt_mode mode, uint32_t addr, int32_t * dst);
+
+void CORE_Functional_DataRead_r(SimInstance * sim, uint32_t addr, int32_t * dst);
+
+double CORE_BlockedMT_CPI_r(SimInstance * sim);
+
+double CORE_FinegrainedMT_CPI_r(SimInstance * sim);
+
+double CORE_SMT_CPI_r(SimInstance * sim);
+
+/* The cycles of a multi-core run are those of its slowest core, and its
+ * instructions those of all cores */
+double CORE_MultiCore_CPI_r(SimInstance * sim);
+
+/* Return the number of cycles and of retired instructions of the last run */
+size_t CORE_BlockedMT_Cycles_r(SimInstance * sim);
+
+size_t CORE_FinegrainedMT_Cycles_r(SimInstance * sim);
+
+size_t CORE_SMT_Cycles_r(SimInstance * sim);
+
+size_t CORE_MultiCore_Cycles_r(SimInstance * sim);
+
+size_t CORE_BlockedMT_Instructions_r(SimInstance * sim);
+
+size_t CORE_FinegrainedMT_Instructions_r(SimInstance * sim);
+
+size_t CORE_SMT_Instructions_r(SimInstance * sim);
+
+size_t CORE_Functional_Instructions_r(SimInstance * sim);
+
+size_t CORE_MultiCore_Instructions_r(SimInstance * sim);
+
+/* Return the data cache hits and misses of a thread in the last run, its LOADs
+ * and STOREs (0 if the image has no data cache, see sim_api.h) */
+size_t CORE_BlockedMT_CacheHits_r(SimInstance * sim, int threadid);
+
+size_t CORE_FinegrainedMT_CacheHits_r(SimInstance * sim, int threadid);
+
+size_t CORE_SMT_CacheHits_r(SimInstance * sim, int threadid);
+
+size_t CORE_BlockedMT_CacheMisses_r(SimInstance * sim, int threadid);
+
+size_t CORE_FinegrainedMT_CacheMisses_r(SimInstance * sim, int threadid);
+
+size_t CORE_SMT_CacheMisses_r(SimInstance * sim, int threadid);
+
 #ifdef __cplusplus
 }
 #endif
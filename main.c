@@ -4,9 +4,15 @@
 #include "core_api.h"
 #include "sim_api.h"
 
+// The cycle trace is only built in with make TRACE=1
+#ifndef SIM_TRACE
+#define SIM_TRACE 0
+#endif
+
 int main(int argc, char const * argv[])
 {
     char const * memFname = argv[1];
+    char const * traceFname = NULL;
 
     if (SIM_MemReset(memFname) != 0)
     {
@@ -14,6 +20,21 @@ int main(int argc, char const * argv[])
         exit(2);
     }
 
+    // Optionally trace the runs
+    if (argc > 2)
+    {
+#if SIM_TRACE
+        traceFname = argv[2];
+        if (CORE_TraceOpen(traceFname) != 0)
+        {
+            fprintf(stderr, "Failed opening trace %s\n", traceFname);
+            exit(2);
+        }
+#else
+        fprintf(stderr, "Ignoring %s: tracing is not built in (make TRACE=1)\n", argv[2]);
+#endif
+    }
+
     int threads = SIM_GetThreadsNum();
 
     // Allocate register files
@@ -30,8 +51,39 @@ int main(int argc, char const * argv[])
         }
     }
 
-    // Start blocked MT simulation
-    CORE_BlockedMT();
+    // Simulate both modes, each from the loaded memory image. With a result
+    // store (SIM_RESULT_CACHE=<dir>), the modes it has results of are not
+    // simulated again, and the results of the others are added to it. Traced
+    // runs are always simulated.
+    char const * cacheDir = traceFname != NULL ? NULL : getenv("SIM_RESULT_CACHE");
+    bool blockedHit = cacheDir != NULL && CORE_ResultLookup(MT_BLOCKED, cacheDir) == 1;
+    bool finegrainedHit = cacheDir != NULL && CORE_ResultLookup(MT_FINEGRAINED, cacheDir) == 1;
+
+    if (!blockedHit && !finegrainedHit)
+    {
+        CORE_SimulateMT();
+    }
+    else if (!blockedHit)
+    {
+        CORE_BlockedMT();
+    }
+    else if (!finegrainedHit)
+    {
+        CORE_FinegrainedMT();
+    }
+    if (cacheDir != NULL &&
+        ((!blockedHit && CORE_ResultStore(MT_BLOCKED, cacheDir) != 0) ||
+         (!finegrainedHit && CORE_ResultStore(MT_FINEGRAINED, cacheDir) != 0)))
+    {
+        fprintf(stderr, "Failed storing the results in %s\n", cacheDir);
+    }
+    if (traceFname != NULL && CORE_TraceClose() != 0)
+    {
+        fprintf(stderr, "Failed writing trace %s\n", traceFname);
+        exit(2);
+    }
+
+    // Print blocked MT results
     printf("\n---- Blocked MT Simulation ----\n");
     for (int k = 0; k < threads; k++)
     {
@@ -44,8 +96,7 @@ int main(int argc, char const * argv[])
     }
     printf("\nBlocked MT CPI for this program %lf\n", CORE_BlockedMT_CPI());
 
-    // Start finegrained MT simulation
-    CORE_FinegrainedMT();
+    // Print finegrained MT results
     printf("\n-----Finegrained MT Simulation -----\n");
     for (int k = 0; k < SIM_GetThreadsNum(); k++)
     {
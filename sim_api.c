@@ -1,7 +1,10 @@
 /* 046267 Computer Architecture - HW #4 */
 /* Main memory simulator implementation                */
 
+#define _POSIX_C_SOURCE 200809L // for mmap and posix_memalign
+
 #include "core_api.h"
+#include "sim_api.h"
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -9,279 +12,1984 @@
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+ * The data memory is a sparse, 32 bit byte-addressed space of 4 KiB pages,
+ * allocated on first write. Pages are found through a two level radix table:
+ * the top bits of the page number select a table, the rest a page within it.
+ * Pages never written read as zero.
+ */
+#define PAGE_BITS 12
+#define PAGE_WORDS (1u << (PAGE_BITS - 2))
+#define TABLE_BITS 10
+#define DIR_BITS (32 - PAGE_BITS - TABLE_BITS)
+#define NO_PAGE UINT32_MAX // a page number no address maps to
+
+typedef struct {
+    int32_t *pages[1u << TABLE_BITS];
+} page_table;
+
+typedef struct {
+    page_table *tables[1u << DIR_BITS];
+} page_dir;
+
+struct _sim_memory {
+    uint32_t prog_start; // the addr of the code block
+    Instruction* code; // the programs of all threads, back to back, cache line aligned
+    uint32_t code_size; // number of instructions in code
+    uint32_t code_capacity;
+    uint32_t* thread_code; // offset of each thread's program in code
+    uint32_t* thread_length; // number of instructions in each thread's program
+    int32_t* thread_priority; // priority of each thread, or NULL if all are 0
+    page_dir* data; // where the data is kept
+    int load_store_latency[2];//load store
+    int switch_; //the cycles that switch between cycles takes
+    int branch_penalty; // the cycles a taken branch makes its thread wait
+    int threadnumber;
+    int inst_threads; // the number of threads in the image
+    SimCacheConfig cache; // the data cache of the cores simulating the image
+    SimMemCtrlConfig memctrl; // their memory controller
+    SimSMTConfig smt;
+    SimSwitchConfig switching; // the switch policy of the blocked MT cores
+    bool shared_image; // the instructions and data belong to the memory this was cloned from
+    char* image; // a binary image the tables above point into, or NULL
+    size_t image_size;
+    bool image_mapped;
+};
+
+typedef struct {
+    uint32_t page; // page number
+    int32_t *words;
+} view_page;
+
+struct _sim_data_view {
+    const SimMemory *mem; // the image the view is over
+    page_dir dirty; // private copies of the pages written since the last reset
+    view_page *owned; // all pages allocated by the view, the dirty ones first
+    size_t dirty_count;
+    size_t owned_count;
+    size_t owned_capacity;
+    // lookaside of the last page accessed
+    uint32_t last_page;
+    int32_t *last_words;
+    bool last_dirty;
+};
+
+static const int32_t zero_page[PAGE_WORDS]; // stands for the pages never written
+
+#define CODE_ALIGN 64 // cache line
+
+/*
+ * The programs loaded so far, to find the threads whose code is identical to
+ * that of an earlier thread. An open addressing hash table of programs, by
+ * their offset and length in the code arena.
+ */
+typedef struct {
+    uint64_t hash;
+    uint32_t start;
+    uint32_t length; // 0 for a free slot
+} program_entry;
+
+typedef struct {
+    program_entry *entries;
+    size_t capacity; // a power of 2
+    size_t count;
+} program_set;
 
-static const char *cmdStr[] = {"NOP", "ADD", "SUB","ADDI", "SUBI","LOAD", "STORE", "HALT"};
-uint32_t prog_start; // the addr of the code block
-uint32_t data_start; // the addr of the data block
-Instruction** instructions; // where the instructions are kept
-int32_t data[100]; // where the data is kept
-uint32_t ticks; // the current clk tick
-uint32_t read_tick; // the clk tick of the first attempt to read
-uint32_t write_tick;// the clk tick for write
-int load_store_latency[2];//load store
-int switch_; //the cycles that switch between cycles takes
-int threadnumber;
+/*
+ * The code blocks parsed so far, by their text in the image, so that a block
+ * repeated verbatim (e.g. by SPMD threads) is parsed only once.
+ */
+typedef struct {
+    uint64_t hash;
+    const char *text; // the lines of the block, in the mapped image
+    size_t size; // 0 for a free slot
+    uint32_t start; // the program parsed from them
+    uint32_t length;
+} block_entry;
 
 typedef struct {
-    uint32_t addr;
-    int32_t val;
-    bool valid;
-    uint32_t ticks; // for LRU
-} cache_line;
+    block_entry *entries;
+    size_t capacity; // a power of 2
+    size_t count;
+} block_set;
+
+static SimMemory default_mem; // behind the non-reentrant API
+
+/*
+ * The data cache keeps the tags of each set together, so that a lookup
+ * compares them all at once (4 ways per SSE2 compare). A tag is the number of
+ * the line's memory block, stored as (block << 1) | 1 so that 0 marks an
+ * invalid way.
+ */
+#define CACHE_MAX_WAYS 64
+
+struct _sim_cache {
+    uint32_t ways;
+    uint32_t line_bits; // log2 of the line size
+    uint32_t set_mask; // sets - 1
+    cache_policy policy;
+    uint32_t *tags; // [sets][ways]
+    uint64_t *state; // LRU: the time each way was last used, [sets][ways]. PLRU: a tree per set, [sets]
+    uint64_t now; // LRU time
+};
+
+/*
+ * The memory controller computes the completion of each request as it is
+ * issued: from the cycle each bank is free, and from the completions of the
+ * outstanding requests, kept in a binary min-heap with a slot per MSHR.
+ */
+struct _sim_memctrl {
+    uint32_t banks;
+    uint32_t mshrs;
+    uint32_t bank_cycles;
+    uint32_t interleave_bits;
+    uint64_t *bank_free; // the cycle each bank is free from
+    uint64_t *pending; // the completions of the outstanding requests, a heap
+    uint32_t pending_count;
+};
+
+static int32_t *page_find(const page_dir *dir, uint32_t page) {
+    const page_table *table = dir->tables[page >> TABLE_BITS];
+    return table == NULL ? NULL : table->pages[page & ((1u << TABLE_BITS) - 1)];
+}
+
+/* Get the slot of a page in the directory, allocating its table if needed */
+static int32_t **page_slot(page_dir *dir, uint32_t page) {
+    page_table **table = &dir->tables[page >> TABLE_BITS];
+    if (*table == NULL) {
+        *table = calloc(1, sizeof(page_table));
+        if (*table == NULL) {
+            return NULL;
+        }
+    }
+    return &(*table)->pages[page & ((1u << TABLE_BITS) - 1)];
+}
+
+/* Get a page of the image for writing, allocating it zeroed if needed */
+static int32_t *page_touch(page_dir *dir, uint32_t page) {
+    int32_t **slot = page_slot(dir, page);
+    if (slot == NULL) {
+        return NULL;
+    }
+    if (*slot == NULL) {
+        *slot = calloc(PAGE_WORDS, sizeof(int32_t));
+    }
+    return *slot;
+}
+
+/* Free the directory's tables and pages, except for the pages in [keep, keep + keep_size) */
+static void page_dir_free(page_dir *dir, const char *keep, size_t keep_size) {
+    for (uint32_t t = 0; t < (1u << DIR_BITS); t++) {
+        if (dir->tables[t] == NULL) {
+            continue;
+        }
+        for (uint32_t p = 0; p < (1u << TABLE_BITS); p++) {
+            const char *page = (const char *) dir->tables[t]->pages[p];
+            if (keep == NULL || page < keep || page >= keep + keep_size) {
+                free(dir->tables[t]->pages[p]);
+            }
+        }
+        free(dir->tables[t]);
+    }
+}
 
+/* Append a zeroed instruction to the code arena, growing it if needed */
+static Instruction *code_append(SimMemory *mem) {
+    if (mem->code_size == mem->code_capacity) {
+        uint32_t capacity = mem->code_capacity == 0 ? 256 : 2 * mem->code_capacity;
+        void *code;
+        if (posix_memalign(&code, CODE_ALIGN, capacity * sizeof(Instruction)) != 0) {
+            return NULL;
+        }
+        if (mem->code != NULL) {
+            memcpy(code, mem->code, mem->code_size * sizeof(Instruction));
+        }
+        free(mem->code);
+        mem->code = code;
+        mem->code_capacity = capacity;
+    }
+    Instruction *inst = &mem->code[mem->code_size++];
+    memset(inst, 0, sizeof(*inst)); // padding too, so programs compare with memcmp
+    return inst;
+}
 
-uint32_t get_start(char *line) {
-    line = strtok(line, "\n");
-    strtok(line, "@");
-    line = strtok(NULL, "@");
-    return (uint32_t) strtol(line, NULL, 0);
+/* FNV-1a, 8 bytes at a time */
+static uint64_t hash_bytes(const void *bytes, size_t size) {
+    const unsigned char *p = bytes;
+    uint64_t hash = 14695981039346656037ull;
+    uint64_t word;
+    for (; size >= sizeof(word); size -= sizeof(word), p += sizeof(word)) {
+        memcpy(&word, p, sizeof(word));
+        hash = (hash ^ word) * 1099511628211ull;
+    }
+    for (; size > 0; size--, p++) {
+        hash = (hash ^ *p) * 1099511628211ull;
+    }
+    return hash;
 }
 
-void get_data(char *line, int data_i) {
-    line = strtok(line, "\n");
-    data[data_i] = (int32_t) strtol(line, NULL, 0);
+/*
+ * A 128 bit content hash of two independent lanes, 8 bytes at a time: FNV-1a
+ * as above, and a lane mixing each word in fully (SplitMix64's finalizer).
+ */
+static void hash128_update(uint64_t hash[2], const void *bytes, size_t size) {
+    const unsigned char *p = bytes;
+    uint64_t word;
+    while (size > 0) {
+        size_t n = size < sizeof(word) ? size : sizeof(word);
+        word = 0;
+        memcpy(&word, p, n);
+        hash[0] = (hash[0] ^ word) * 1099511628211ull;
+        word ^= hash[1];
+        word = (word ^ (word >> 30)) * 0xBF58476D1CE4E5B9ull;
+        word = (word ^ (word >> 27)) * 0x94D049BB133111EBull;
+        hash[1] = word ^ (word >> 31);
+        p += n;
+        size -= n;
+    }
 }
 
-int get_dst(char *dst) {
-    strtok(dst, ",");
-    strtok(dst, "$");
-    dst = strtok(NULL, "$");
-    return atoi(dst);
+/*
+ * Keep the program just appended to the end of the code arena, at `start`,
+ * unless an identical one was loaded before. In that case the new copy is
+ * dropped from the arena.
+ * Returns the offset of the program in the arena, or UINT32_MAX if out of memory.
+ */
+static uint32_t intern_program(SimMemory *mem, program_set *set, uint32_t start) {
+    uint32_t length = mem->code_size - start;
+    if (length == 0) {
+        return start;
+    }
+    uint64_t hash = hash_bytes(&mem->code[start], length * sizeof(Instruction));
+
+    if (2 * (set->count + 1) > set->capacity) {
+        size_t capacity = set->capacity == 0 ? 64 : 2 * set->capacity;
+        program_entry *entries = calloc(capacity, sizeof(*entries));
+        if (entries == NULL) {
+            return UINT32_MAX;
+        }
+        for (size_t i = 0; i < set->capacity; i++) {
+            program_entry *entry = &set->entries[i];
+            if (entry->length == 0) {
+                continue;
+            }
+            size_t slot = entry->hash & (capacity - 1);
+            while (entries[slot].length != 0) {
+                slot = (slot + 1) & (capacity - 1);
+            }
+            entries[slot] = *entry;
+        }
+        free(set->entries);
+        set->entries = entries;
+        set->capacity = capacity;
+    }
+
+    size_t slot = hash & (set->capacity - 1);
+    for (; set->entries[slot].length != 0; slot = (slot + 1) & (set->capacity - 1)) {
+        program_entry *entry = &set->entries[slot];
+        if (entry->hash == hash && entry->length == length &&
+            memcmp(&mem->code[entry->start], &mem->code[start], length * sizeof(Instruction)) == 0) {
+            mem->code_size = start;
+            return entry->start;
+        }
+    }
+    set->entries[slot].hash = hash;
+    set->entries[slot].start = start;
+    set->entries[slot].length = length;
+    set->count++;
+    return start;
 }
 
-int get_dst_br(char *dst) {
-    strtok(dst, "\n");
-    strtok(dst, "$");
-    dst = strtok(NULL, "$");
-    return atoi(dst);
+static block_entry *block_find(const block_set *set, uint64_t hash, const char *text, size_t size) {
+    if (set->capacity == 0) {
+        return NULL;
+    }
+    for (size_t slot = hash & (set->capacity - 1); set->entries[slot].size != 0;
+         slot = (slot + 1) & (set->capacity - 1)) {
+        block_entry *entry = &set->entries[slot];
+        if (entry->hash == hash && entry->size == size && memcmp(entry->text, text, size) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
 }
 
-int get_src1(char *src1) {
-    strtok(src1, ",");
-    src1 = strtok(NULL, ",");
-    strtok(src1, "$");
-    src1 = strtok(NULL, "$");
-    return atoi(src1);
+/* Add a block, which must not be in the set yet. Returns <0 if out of memory */
+static int block_add(block_set *set, const block_entry *block) {
+    if (2 * (set->count + 1) > set->capacity) {
+        size_t capacity = set->capacity == 0 ? 64 : 2 * set->capacity;
+        block_entry *entries = calloc(capacity, sizeof(*entries));
+        if (entries == NULL) {
+            return -1;
+        }
+        for (size_t i = 0; i < set->capacity; i++) {
+            if (set->entries[i].size == 0) {
+                continue;
+            }
+            size_t slot = set->entries[i].hash & (capacity - 1);
+            while (entries[slot].size != 0) {
+                slot = (slot + 1) & (capacity - 1);
+            }
+            entries[slot] = set->entries[i];
+        }
+        free(set->entries);
+        set->entries = entries;
+        set->capacity = capacity;
+    }
+
+    size_t slot = block->hash & (set->capacity - 1);
+    while (set->entries[slot].size != 0) {
+        slot = (slot + 1) & (set->capacity - 1);
+    }
+    set->entries[slot] = *block;
+    set->count++;
+    return 0;
 }
 
-int get_src2(char *src2) {
-    strtok(src2, ",");
-    strtok(NULL, ",");
-    src2 = strtok(NULL, ",");
-    strtok(src2, "$");
-    src2 = strtok(NULL, "$");
-    src2 = strtok(src2, "\n");
-    return atoi(src2);
+static void out_of_memory() {
+    fprintf(stderr, "Out of memory for the simulated data memory\n");
+    abort();
 }
 
-int get_src2_imm(char *src2, int inst_num, int tid) {
-	instructions[tid][inst_num].isSrc2Imm = 0; //assert
-    strtok(src2, ",");
-    strtok(NULL, ",");
-    src2 = strtok(NULL, ",");
-    if (strchr(src2, '$') == NULL) {
-        strtok(src2, " ");
-        instructions[tid][inst_num].isSrc2Imm = 1;
+/*
+ * The image parser works in a single pass over the image file, mapped into
+ * memory, without copying or allocating: each line is tokenized in place, and
+ * the opcode is found by switching on its length.
+ */
+typedef struct {
+    const char *fname; // for error messages
+    const char *pos; // the start of the next line
+    const char *end;
+    const char *line; // the current line, not including the line break
+    const char *line_end;
+    int line_no;
+} image_reader;
+
+/* Read the next line of the image. Returns false at the end of the image */
+static bool next_line(image_reader *r) {
+    if (r->pos == r->end) {
+        return false;
+    }
+    r->line = r->pos;
+    r->line_end = memchr(r->pos, '\n', r->end - r->pos);
+    if (r->line_end == NULL) {
+        r->line_end = r->end;
+        r->pos = r->end;
     } else {
-        strtok(src2, "$");
-        src2 = strtok(NULL, "$");
-        assert(instructions[tid][inst_num].isSrc2Imm == 0);
+        r->pos = r->line_end + 1;
+    }
+    if (r->line_end > r->line && r->line_end[-1] == '\r') {
+        r->line_end--;
+    }
+    r->line_no++;
+    return true;
+}
+
+static int parse_error(const image_reader *r, const char *at, const char *msg) {
+    fprintf(stderr, "%s:%d:%d: %s\n", r->fname, r->line_no, (int) (at - r->line) + 1, msg);
+    return -1;
+}
+
+static bool is_empty_line(const image_reader *r) {
+    return r->line == r->line_end || r->line[0] == '#';
+}
+
+static bool is_block_start(const image_reader *r) {
+    size_t len = r->line_end - r->line;
+    return (len >= 1 && r->line[0] == 'T') ||
+           (len >= 2 && r->line[1] == '@' && (r->line[0] == 'I' || r->line[0] == 'D'));
+}
+
+static const char *skip_blanks(const char *pos, const char *end) {
+    while (pos < end && (*pos == ' ' || *pos == '\t')) {
+        pos++;
+    }
+    return pos;
+}
+
+static int digit_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return 16;
+}
+
+/*
+ * Parse an integer at *pos, as strtol does: base 0 takes a 0x prefix for hex
+ * and a leading 0 for octal. The value is truncated to 32 bits. On success,
+ * *pos moves past the number.
+ */
+static bool parse_number(const char **pos, const char *end, int base, int32_t *value) {
+    const char *p = skip_blanks(*pos, end);
+    bool negative = false;
+    uint32_t result = 0;
+
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p++ == '-';
+    }
+    if (base == 0) {
+        base = 10;
+        if (p < end && *p == '0') {
+            base = 8;
+            if (end - p > 2 && (p[1] == 'x' || p[1] == 'X') && digit_value(p[2]) < 16) {
+                base = 16;
+                p += 2;
+            }
+        }
     }
-    src2 = strtok(src2, "\n");
-    if (strchr(src2, 'x') == NULL) {
-        return atoi(src2);
+    const char *digits = p;
+    if (base == 10) {
+        while (p < end && *p >= '0' && *p <= '9') {
+            result = result * 10 + (*p++ - '0');
+        }
     } else {
-        return (uint32_t) strtol(src2, NULL, 0);
-    }
-}
-
-void add_sub(char *line, int inst_num, int tid) {
-    char dst[50];
-    instructions[tid][inst_num].isSrc2Imm = 0;
-    memset(dst, '\0', sizeof(dst));
-    strcpy(dst, line);
-    instructions[tid][inst_num].dst_index = get_dst(dst);
-    char src1[50];
-    memset(src1, '\0', sizeof(src1));
-    strcpy(src1, line);
-    instructions[tid][inst_num].src1_index = get_src1(src1);
-    char src2[50];
-    memset(src2, '\0', sizeof(src2));
-    strcpy(src2, line);
-    instructions[tid][inst_num].src2_index_imm = get_src2_imm(src2, inst_num, tid);
-}
-
-void halt(char *line, int inst_num, int tid) {
-    char dst[50];
-    memset(dst, '\0', sizeof(dst));
-    strcpy(dst, line);
-    instructions[tid][inst_num].dst_index = get_dst(dst);
-    instructions[tid][inst_num].isSrc2Imm=0;
-    instructions[tid][inst_num].src1_index=0;
-    instructions[tid][inst_num].src2_index_imm=0;
-}
-
-
-void load_store(char *line, int inst_num, int tid) {
-    char dst[50];
-    memset(dst, '\0', sizeof(dst));
-    strcpy(dst, line);
-    instructions[tid][inst_num].dst_index = get_dst(dst);
-    char src1[50];
-    memset(src1, '\0', sizeof(src1));
-    strcpy(src1, line);
-    instructions[tid][inst_num].src1_index = get_src1(src1);
-    char src2[50];
-    memset(src2, '\0', sizeof(src2));
-    strcpy(src2, line);
-    instructions[tid][inst_num].src2_index_imm = get_src2_imm(src2, inst_num, tid);
-}
-
-
-void get_inst(char *line, int inst_num, int tid) {
-    char command[50];
-    memset(command, '\0', sizeof(command));
-    strcpy(command, line);
-    strtok(command, " ");
-    int opc = 0;
-    while (strcmp(command, cmdStr[opc]) != 0) {
-        ++opc;
-    }
-    instructions[tid][inst_num].opcode = opc;
-    switch (opc) {
-        case CMD_NOP: // NOP
+        while (p < end && digit_value(*p) < base) {
+            result = result * base + digit_value(*p++);
+        }
+    }
+    if (p == digits) {
+        return false;
+    }
+    *value = (int32_t) (negative ? 0u - result : result);
+    *pos = p;
+    return true;
+}
+
+/* Parse a "$<num>" register operand */
+static int parse_register(const image_reader *r, const char **pos, int *reg) {
+    const char *p = skip_blanks(*pos, r->line_end);
+    const char *at = p;
+    int32_t value;
+
+    if (p == r->line_end || *p != '$') {
+        return parse_error(r, p, "expected a register");
+    }
+    p++;
+    // the common case, a single digit
+    if (r->line_end - p >= 1 && *p >= '0' && *p < '0' + REGS_COUNT &&
+        (r->line_end - p == 1 || p[1] < '0' || p[1] > '9')) {
+        *reg = *p - '0';
+        *pos = p + 1;
+        return 0;
+    }
+    if (!parse_number(&p, r->line_end, 10, &value) || value < 0 || value >= REGS_COUNT) {
+        return parse_error(r, at, "invalid register");
+    }
+    *reg = value;
+    *pos = p;
+    return 0;
+}
+
+static int parse_comma(const image_reader *r, const char **pos) {
+    const char *p = skip_blanks(*pos, r->line_end);
+    if (p == r->line_end || *p != ',') {
+        return parse_error(r, p, "expected ','");
+    }
+    *pos = p + 1;
+    return 0;
+}
+
+/* Parse the last operand: a register, or an immediate (in hex if it has an 'x') */
+static int parse_src2(const image_reader *r, const char **pos, Instruction *inst) {
+    const char *p = skip_blanks(*pos, r->line_end);
+    int32_t value;
+
+    if (p < r->line_end && *p == '$') {
+        inst->isSrc2Imm = false;
+        return parse_register(r, pos, &inst->src2_index_imm);
+    }
+
+    inst->isSrc2Imm = true;
+    int base = memchr(p, 'x', r->line_end - p) != NULL ? 0 : 10;
+    if (!parse_number(&p, r->line_end, base, &value)) {
+        return parse_error(r, p, "expected a register or an immediate");
+    }
+    inst->src2_index_imm = value;
+    *pos = p;
+    return 0;
+}
+
+/* Check if the current line is an instruction of the code block being read */
+static bool is_code_line(const image_reader *r) {
+    return !is_empty_line(r) && r->line[0] != 'D' && !is_block_start(r);
+}
+
+/*
+ * Find the text of the code block starting at the next line: up to the line
+ * ending it, or to the end of the image.
+ */
+static void scan_code_block(const image_reader *r, block_entry *block, int *lines) {
+    image_reader scan = *r;
+    const char *end = r->end;
+
+    *lines = 0;
+    while (next_line(&scan)) {
+        if (!is_code_line(&scan)) {
+            end = scan.line;
+            break;
+        }
+        ++*lines;
+    }
+    block->text = r->pos;
+    block->size = end - r->pos;
+    block->hash = hash_bytes(block->text, block->size);
+}
+
+/* Parse an instruction line into `inst`, which is zeroed */
+static int parse_inst(const image_reader *r, Instruction *inst) {
+    const char *p = skip_blanks(r->line, r->line_end);
+    const char *name = p;
+
+    while (p < r->line_end && *p != ' ' && *p != '\t') {
+        p++;
+    }
+
+    int opcode = -1;
+    switch (p - name) {
+        case 3:
+            if (memcmp(name, "NOP", 3) == 0) opcode = CMD_NOP;
+            else if (memcmp(name, "ADD", 3) == 0) opcode = CMD_ADD;
+            else if (memcmp(name, "SUB", 3) == 0) opcode = CMD_SUB;
+            else if (memcmp(name, "BEQ", 3) == 0) opcode = CMD_BEQ;
+            else if (memcmp(name, "BNE", 3) == 0) opcode = CMD_BNE;
+            else if (memcmp(name, "JMP", 3) == 0) opcode = CMD_JMP;
             break;
-        case CMD_ADDI:
-        case CMD_SUBI:
-            add_sub(line, inst_num, tid);
+        case 4:
+            if (memcmp(name, "ADDI", 4) == 0) opcode = CMD_ADDI;
+            else if (memcmp(name, "SUBI", 4) == 0) opcode = CMD_SUBI;
+            else if (memcmp(name, "LOAD", 4) == 0) opcode = CMD_LOAD;
+            else if (memcmp(name, "HALT", 4) == 0) opcode = CMD_HALT;
             break;
-        case CMD_ADD:
-        case CMD_SUB:
-            add_sub(line, inst_num, tid);
+        case 5:
+            if (memcmp(name, "STORE", 5) == 0) opcode = CMD_STORE;
             break;
-        case CMD_LOAD:
-        case CMD_STORE:
-            load_store(line, inst_num, tid);
+    }
+    if (opcode < 0) {
+        return parse_error(r, name, "unknown instruction");
+    }
+    inst->opcode = opcode;
+
+    switch (opcode) {
+        case CMD_NOP:
+            // ignores its operands, if any: "$d" or "$d, $s, src2"
+            if (skip_blanks(p, r->line_end) == r->line_end) {
+                break;
+            }
+            if (parse_register(r, &p, &inst->dst_index) != 0) {
+                return -1;
+            }
+            p = skip_blanks(p, r->line_end);
+            if (p < r->line_end && *p == ',' &&
+                (parse_comma(r, &p) != 0 ||
+                 parse_register(r, &p, &inst->src1_index) != 0 ||
+                 parse_comma(r, &p) != 0 ||
+                 parse_src2(r, &p, inst) != 0)) {
+                return -1;
+            }
             break;
         case CMD_HALT:
-            halt(line, inst_num, tid);
+            // the operand is optional
+            if (skip_blanks(p, r->line_end) != r->line_end &&
+                parse_register(r, &p, &inst->dst_index) != 0) {
+                return -1;
+            }
+            break;
+        case CMD_JMP:
+            // the target is the only operand
+            if (parse_src2(r, &p, inst) != 0) {
+                return -1;
+            }
             break;
+        default:
+            if (parse_register(r, &p, &inst->dst_index) != 0 ||
+                parse_comma(r, &p) != 0 ||
+                parse_register(r, &p, &inst->src1_index) != 0 ||
+                parse_comma(r, &p) != 0 ||
+                parse_src2(r, &p, inst) != 0) {
+                return -1;
+            }
+            break;
+    }
+    p = skip_blanks(p, r->line_end);
+    if (p != r->line_end) {
+        return parse_error(r, p, "unexpected text after the instruction");
+    }
+    return 0;
+}
+
+/* Parse the address of an "I@<address>" or "D@<address>" line */
+static int parse_start(const image_reader *r, uint32_t *addr) {
+    const char *p = r->line + 2;
+    int32_t value;
+    if (!parse_number(&p, r->line_end, 0, &value)) {
+        return parse_error(r, p, "expected an address");
     }
+    *addr = (uint32_t) value;
+    return 0;
 }
 
-int SIM_MemReset(const char *memImgFname) {
-    FILE *img = fopen(memImgFname, "r");
-    int tid;
-    char line[1024];
-    if (img == 0) {
-        return -1; // can't open img file
+/* Parse a header value, e.g. "L20", or a thread number, e.g. "T3" */
+static int parse_header(const image_reader *r, int *value) {
+    const char *p = r->line + 1;
+    int32_t number;
+    if (!parse_number(&p, r->line_end, 10, &number)) {
+        return parse_error(r, p, "expected a number");
     }
-    while (fgets(line, 1024, img) != NULL) {
-        if (line[0] == '#' || line[0] == '\n')   // comment or empty line
-        {
-            continue;
+    *value = number;
+    return 0;
+}
+
+static bool is_power_of_2(uint32_t value) {
+    return value != 0 && (value & (value - 1)) == 0;
+}
+
+static bool cache_config_valid(const SimCacheConfig *config) {
+    if (config->size == 0) {
+        return true; // no cache
+    }
+    if (config->ways == 0 || config->ways > CACHE_MAX_WAYS || config->line_size < 4 ||
+        !is_power_of_2(config->line_size) || config->size % config->line_size != 0 ||
+        (config->size / config->line_size) % config->ways != 0 ||
+        (config->policy != CACHE_LRU && config->policy != CACHE_PLRU)) {
+        return false;
+    }
+    // tree PLRU needs a power of 2 ways
+    return is_power_of_2(config->size / config->line_size / config->ways) &&
+           (config->policy == CACHE_LRU || is_power_of_2(config->ways));
+}
+
+static bool memctrl_config_valid(const SimMemCtrlConfig *config) {
+    return config->banks == 0 ||
+           (config->mshrs > 0 && config->interleave >= 4 && is_power_of_2(config->interleave));
+}
+
+static bool smt_config_valid(const SimSMTConfig *config) {
+    return config->width > 0 && (config->policy == FETCH_RR || config->policy == FETCH_ICOUNT);
+}
+
+static bool switch_config_valid(const SimSwitchConfig *config) {
+    return config->policy >= SWITCH_RR && config->policy < SWITCH_POLICY_COUNT &&
+           (config->policy != SWITCH_TIMESLICE || config->timeslice > 0);
+}
+
+static bool reg_valid(int index) {
+    return index >= 0 && index < REGS_COUNT;
+}
+
+/* An instruction of a binary image must index the handler table and the register file */
+static bool inst_valid(const Instruction *inst) {
+    return (int) inst->opcode >= 0 && (int) inst->opcode < CMD_COUNT &&
+           reg_valid(inst->dst_index) && reg_valid(inst->src1_index) &&
+           (inst->isSrc2Imm || reg_valid(inst->src2_index_imm));
+}
+
+/* Parse comma separated numbers of a header line, e.g. "C32768,8,64,2,100" */
+static int parse_fields(const image_reader *r, const char **pos, uint32_t *fields[], size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        int32_t value;
+        if (i > 0 && parse_comma(r, pos) != 0) {
+            return -1;
         }
-        if(line[0] == 'S') {
-        	load_store_latency[1]=atoi(&line[1]);
-        	continue;
-        }
-        if(line[0] == 'L') {
-        	load_store_latency[0]=atoi(&line[1]);
-        	continue;
-        }
-        if(line[0] == 'O') {
-        	switch_=atoi(&line[1]);
-        	continue;
-        }
-        if(line[0] == 'N'){
-			threadnumber=atoi(&line[1]);
-			instructions = malloc(sizeof(*instructions)*threadnumber);
-			for(int i=0; i<threadnumber; i++){
-				instructions[i]=malloc(sizeof(instructions[i])*100);
-			}
-			break;
-		}
+        if (!parse_number(pos, r->line_end, 10, &value) || value < 0) {
+            return parse_error(r, *pos, "expected a non-negative number");
+        }
+        *fields[i] = (uint32_t) value;
     }
+    return 0;
+}
 
-    while (fgets(line, 1024, img) != NULL) {
-        if (line[0] == '#' || line[0] == '\n')   // comment or empty line
-        {
-            continue;
+/* Parse a cache line, "C<size>,<ways>,<line size>,<hit latency>,<miss latency>[,LRU|PLRU]" */
+static int parse_cache(const image_reader *r, SimCacheConfig *config) {
+    uint32_t *fields[] = {&config->size, &config->ways, &config->line_size,
+                          &config->hit_latency, &config->miss_latency};
+    const char *p = r->line + 1;
+
+    if (parse_fields(r, &p, fields, sizeof(fields) / sizeof(fields[0])) != 0) {
+        return -1;
+    }
+    config->policy = CACHE_LRU;
+    p = skip_blanks(p, r->line_end);
+    if (p < r->line_end) {
+        if (parse_comma(r, &p) != 0) {
+            return -1;
         }
-        if(line[0] == 'T'){
-        	tid=atoi(&line[1]);
-        }
-        else if (line[0] == 'I' && line[1] == '@')     // start of code block
-        {
-            prog_start = get_start(line);
-            int inst = 0;
-            fgets(line, 1024, img);
-            // get next instructions
-            while (line[0] != '\n' && line[0] != '#' && line[0] != 'D') {
-                get_inst(line, inst, tid);
-                ++inst;
-                if (fgets(line, 1024, img) == NULL)   //EOF
-                {
-                    break;
-                }
-            }
-        } else if (line[0] == 'D' && line[1] == '@')     // start of data block
-        {
-            data_start = get_start(line);
-            int data_i = 0;
-            fgets(line, 1024, img);
-            while (line[0] != '\n' && line[0] != '#' && line[0] != 'I') {
-                get_data(line, data_i);
-                ++data_i;
-                if (fgets(line, 1024, img) == NULL) {
-                    break;
-                }
-            }
+        p = skip_blanks(p, r->line_end);
+        size_t len = r->line_end - p;
+        if (len >= 4 && memcmp(p, "PLRU", 4) == 0) {
+            config->policy = CACHE_PLRU;
+            p += 4;
+        } else if (len >= 3 && memcmp(p, "LRU", 3) == 0) {
+            p += 3;
+        } else {
+            return parse_error(r, p, "expected LRU or PLRU");
         }
     }
-    fclose(img);
+    if (skip_blanks(p, r->line_end) != r->line_end) {
+        return parse_error(r, p, "unexpected text after the cache configuration");
+    }
+    if (!cache_config_valid(config)) {
+        return parse_error(r, r->line + 1, "invalid cache configuration");
+    }
     return 0;
 }
 
-void SIM_MemFree(){
-	for(int i=0; i<threadnumber; i++){
-		free(instructions[i]);
-	}
-	free(instructions);
+/* Parse a memory controller line, "M<banks>,<MSHRs>,<bank busy cycles>[,<interleave bytes>]" */
+static int parse_memctrl(const image_reader *r, SimMemCtrlConfig *config) {
+    uint32_t *fields[] = {&config->banks, &config->mshrs, &config->bank_cycles};
+    const char *p = r->line + 1;
+
+    if (parse_fields(r, &p, fields, sizeof(fields) / sizeof(fields[0])) != 0) {
+        return -1;
+    }
+    config->interleave = 64;
+    p = skip_blanks(p, r->line_end);
+    if (p < r->line_end) {
+        uint32_t *interleave[] = {&config->interleave};
+        if (parse_comma(r, &p) != 0 || parse_fields(r, &p, interleave, 1) != 0) {
+            return -1;
+        }
+    }
+    if (skip_blanks(p, r->line_end) != r->line_end) {
+        return parse_error(r, p, "unexpected text after the memory controller configuration");
+    }
+    if (!memctrl_config_valid(config)) {
+        return parse_error(r, r->line + 1, "invalid memory controller configuration");
+    }
+    return 0;
 }
 
-void SIM_MemDataRead(uint32_t addr, int32_t *dst) {
-    int addr_i = addr - data_start;
-    addr_i = addr_i / 4;
-    *dst = data[addr_i];
+/* Parse a switch policy line, "B<RR|LATENCY|TIMESLICE|PRIORITY|LRU>[,<timeslice>]" */
+static int parse_switch(const image_reader *r, SimSwitchConfig *config) {
+    static const char *const names[SWITCH_POLICY_COUNT] = {"RR", "LATENCY", "TIMESLICE", "PRIORITY", "LRU"};
+    const char *p = skip_blanks(r->line + 1, r->line_end);
+    size_t len = r->line_end - p;
+    size_t i;
+
+    for (i = 0; i < SWITCH_POLICY_COUNT; i++) {
+        size_t name_len = strlen(names[i]);
+        if (len >= name_len && memcmp(p, names[i], name_len) == 0) {
+            p += name_len;
+            break;
+        }
+    }
+    if (i == SWITCH_POLICY_COUNT) {
+        return parse_error(r, p, "expected RR, LATENCY, TIMESLICE, PRIORITY or LRU");
+    }
+    config->policy = (switch_policy) i;
+    config->timeslice = 0;
+    p = skip_blanks(p, r->line_end);
+    if (p < r->line_end) {
+        uint32_t *timeslice[] = {&config->timeslice};
+        if (parse_comma(r, &p) != 0 || parse_fields(r, &p, timeslice, 1) != 0) {
+            return -1;
+        }
+    }
+    if (skip_blanks(p, r->line_end) != r->line_end) {
+        return parse_error(r, p, "unexpected text after the switch policy");
+    }
+    if (!switch_config_valid(config)) {
+        return parse_error(r, r->line + 1, "expected a positive timeslice");
+    }
+    return 0;
 }
 
-void SIM_MemDataWrite(uint32_t addr, int32_t val) {
-    int addr_i = addr - data_start;
-    addr_i = addr_i / 4; // addr is aligned to 4 byte
-    data[addr_i] = val;
+/* Parse a thread priority line, "P<priority>", of a thread of the image */
+static int parse_priority(const image_reader *r, SimMemory *mem, int tid) {
+    int priority;
+
+    if (parse_header(r, &priority) != 0) {
+        return -1;
+    }
+    if (mem->thread_priority == NULL) {
+        mem->thread_priority = calloc(mem->inst_threads, sizeof(*mem->thread_priority));
+        if (mem->thread_priority == NULL) {
+            return parse_error(r, r->line, "out of memory");
+        }
+    }
+    mem->thread_priority[tid] = priority;
+    return 0;
 }
 
-void SIM_MemInstRead(uint32_t line, Instruction *dst, int tid) {
-    dst->opcode = instructions[tid][line].opcode;
-    dst->dst_index = instructions[tid][line].dst_index;
-    dst->src1_index = instructions[tid][line].src1_index;
-    dst->src2_index_imm = instructions[tid][line].src2_index_imm;
-    dst->isSrc2Imm = instructions[tid][line].isSrc2Imm;
+/* Parse an SMT line, "W<width>[,RR|ICOUNT]" */
+static int parse_smt(const image_reader *r, SimSMTConfig *config) {
+    uint32_t *fields[] = {&config->width};
+    const char *p = r->line + 1;
+
+    if (parse_fields(r, &p, fields, 1) != 0) {
+        return -1;
+    }
+    config->policy = FETCH_RR;
+    p = skip_blanks(p, r->line_end);
+    if (p < r->line_end) {
+        if (parse_comma(r, &p) != 0) {
+            return -1;
+        }
+        p = skip_blanks(p, r->line_end);
+        size_t len = r->line_end - p;
+        if (len >= 6 && memcmp(p, "ICOUNT", 6) == 0) {
+            config->policy = FETCH_ICOUNT;
+            p += 6;
+        } else if (len >= 2 && memcmp(p, "RR", 2) == 0) {
+            p += 2;
+        } else {
+            return parse_error(r, p, "expected RR or ICOUNT");
+        }
+    }
+    if (skip_blanks(p, r->line_end) != r->line_end) {
+        return parse_error(r, p, "unexpected text after the SMT configuration");
+    }
+    if (!smt_config_valid(config)) {
+        return parse_error(r, r->line + 1, "expected a positive issue width");
+    }
+    return 0;
 }
 
-int SIM_GetLoadLat() {
-    return load_store_latency[0];
+/*
+ * Map the image file into memory. Falls back to reading it, e.g. for pipes.
+ * Returns the image's size in *size, or NULL on failure. Release with
+ * unmap_image.
+ */
+static char *map_image(const char *fname, size_t *size, bool *mapped) {
+    int fd = open(fname, O_RDONLY);
+    struct stat st;
+    char *image = NULL;
+
+    if (fd < 0) {
+        return NULL;
+    }
+    *mapped = false;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        // writable, as binary images are used in place; writes stay private
+        image = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (image != MAP_FAILED) {
+            *size = st.st_size;
+            *mapped = true;
+            close(fd);
+            return image;
+        }
+        image = NULL;
+    }
+
+    size_t capacity = 0;
+    *size = 0;
+    for (;;) {
+        if (*size == capacity) {
+            capacity = capacity == 0 ? 65536 : 2 * capacity;
+            char *grown = realloc(image, capacity);
+            if (grown == NULL) {
+                free(image);
+                close(fd);
+                return NULL;
+            }
+            image = grown;
+        }
+        ssize_t n = read(fd, image + *size, capacity - *size);
+        if (n < 0) {
+            free(image);
+            close(fd);
+            return NULL;
+        }
+        if (n == 0) {
+            break;
+        }
+        *size += n;
+    }
+    close(fd);
+    return image;
 }
 
-int SIM_GetStoreLat() {
-    return load_store_latency[1];
+static void unmap_image(char *image, size_t size, bool mapped) {
+    if (mapped) {
+        munmap(image, size);
+    } else {
+        free(image);
+    }
 }
 
-int SIM_GetThreadsNum() {
-	return threadnumber;
+/*
+ * Binary images, compiled from textual ones by SIM_MemSave_r. The loader maps
+ * the file and uses its tables in place: the code arena, the thread tables,
+ * and the data pages. Sections are 64 bytes aligned, data pages 4 KiB aligned,
+ * and all values are in the host's byte order.
+ */
+#define BIN_MAGIC "MTSIMBIN"
+#define BIN_VERSION 6
+#define PAGE_BYTES (PAGE_WORDS * sizeof(int32_t))
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t inst_size; // sizeof(Instruction), as the code is used in place
+    int32_t load_latency;
+    int32_t store_latency;
+    int32_t switch_cycles;
+    int32_t branch_penalty;
+    int32_t threads; // N
+    int32_t image_threads; // the number of threads with a program in the image
+    uint32_t prog_start;
+    uint32_t code_size; // number of instructions
+    uint32_t page_count; // number of data pages
+    SimCacheConfig cache;
+    SimMemCtrlConfig memctrl;
+    SimSMTConfig smt;
+    SimSwitchConfig switching;
+    uint64_t code_offset; // Instruction[code_size]
+    uint64_t threads_offset; // uint32_t thread_code[image_threads], then thread_length[image_threads]
+    uint64_t priorities_offset; // int32_t thread_priority[image_threads], or 0 if all are 0
+    uint64_t pages_offset; // uint32_t page numbers[page_count]
+    uint64_t page_data_offset; // the data pages, PAGE_BYTES each
+} bin_header;
+
+static uint64_t align_up(uint64_t offset, uint64_t alignment) {
+    return (offset + alignment - 1) / alignment * alignment;
 }
 
-int SIM_GetSwitchCycles() {
-    return switch_;
+/* Whether `count` elements of `elem` bytes at `offset` fit in `size` bytes, written so as not to overflow */
+static bool section_fits(uint64_t offset, uint64_t count, uint64_t elem, uint64_t size) {
+    return offset <= size && count <= (size - offset) / elem;
+}
+
+static bool is_binary_image(const char *image, size_t size) {
+    return size >= sizeof(BIN_MAGIC) - 1 && memcmp(image, BIN_MAGIC, sizeof(BIN_MAGIC) - 1) == 0;
+}
+
+/* Point the memory's tables into a binary image. Returns <0 if it is invalid */
+static int load_binary(SimMemory *mem, char *image, size_t size, const char *fname) {
+    bin_header header;
+
+    if (size < sizeof(header)) {
+        fprintf(stderr, "%s: truncated binary image\n", fname);
+        return -1;
+    }
+    memcpy(&header, image, sizeof(header));
+    if (header.version != BIN_VERSION || header.inst_size != sizeof(Instruction)) {
+        fprintf(stderr, "%s: binary image of another version, or compiled for another host\n", fname);
+        return -1;
+    }
+    if (header.image_threads < 0 || header.threads < 0 || header.threads > header.image_threads ||
+        header.code_offset % CODE_ALIGN != 0 || header.page_data_offset % PAGE_BYTES != 0 ||
+        header.threads_offset % sizeof(uint32_t) != 0 || header.priorities_offset % sizeof(int32_t) != 0 ||
+        header.pages_offset % sizeof(uint32_t) != 0 ||
+        !section_fits(header.code_offset, header.code_size, sizeof(Instruction), size) ||
+        !section_fits(header.threads_offset, 2 * (uint64_t) header.image_threads, sizeof(uint32_t), size) ||
+        !section_fits(header.priorities_offset, header.image_threads, sizeof(int32_t), size) ||
+        !section_fits(header.pages_offset, header.page_count, sizeof(uint32_t), size) ||
+        (header.page_count > 0 && !section_fits(header.page_data_offset, header.page_count, PAGE_BYTES, size))) {
+        fprintf(stderr, "%s: corrupt binary image\n", fname);
+        return -1;
+    }
+
+    mem->code = (Instruction *) (image + header.code_offset);
+    mem->code_size = header.code_size;
+    mem->thread_code = (uint32_t *) (image + header.threads_offset);
+    mem->thread_length = mem->thread_code + header.image_threads;
+    mem->thread_priority = header.priorities_offset != 0 ? (int32_t *) (image + header.priorities_offset) : NULL;
+    for (int tid = 0; tid < header.image_threads; tid++) {
+        if ((uint64_t) mem->thread_code[tid] + mem->thread_length[tid] > header.code_size) {
+            fprintf(stderr, "%s: corrupt binary image\n", fname);
+            return -1;
+        }
+    }
+    for (uint32_t i = 0; i < header.code_size; i++) {
+        if (!inst_valid(&mem->code[i])) {
+            fprintf(stderr, "%s: corrupt binary image\n", fname);
+            return -1;
+        }
+    }
+
+    const uint32_t *page_numbers = (const uint32_t *) (image + header.pages_offset);
+    for (uint32_t i = 0; i < header.page_count; i++) {
+        int32_t **slot = page_numbers[i] < (1u << (DIR_BITS + TABLE_BITS)) ?
+                         page_slot(mem->data, page_numbers[i]) : NULL;
+        if (slot == NULL) {
+            fprintf(stderr, "%s: corrupt binary image, or out of memory\n", fname);
+            return -1;
+        }
+        *slot = (int32_t *) (image + header.page_data_offset + i * PAGE_BYTES);
+    }
+
+    mem->load_store_latency[0] = header.load_latency;
+    mem->load_store_latency[1] = header.store_latency;
+    mem->switch_ = header.switch_cycles;
+    mem->branch_penalty = header.branch_penalty;
+    mem->threadnumber = header.threads;
+    mem->inst_threads = header.image_threads;
+    mem->prog_start = header.prog_start;
+    if (header.load_latency < 0 || header.store_latency < 0 ||
+        header.switch_cycles < 0 || header.branch_penalty < 0 ||
+        !cache_config_valid(&header.cache) || !memctrl_config_valid(&header.memctrl) ||
+        !smt_config_valid(&header.smt) || !switch_config_valid(&header.switching)) {
+        fprintf(stderr, "%s: corrupt binary image\n", fname);
+        return -1;
+    }
+    mem->cache = header.cache;
+    mem->memctrl = header.memctrl;
+    mem->smt = header.smt;
+    mem->switching = header.switching;
+    return 0;
+}
+
+/* Write `size` bytes at `offset` of the file, zero padding from `*pos` */
+static bool write_at(FILE *file, uint64_t *pos, uint64_t offset, const void *bytes, size_t size) {
+    for (; *pos < offset; ++*pos) {
+        if (fputc(0, file) == EOF) {
+            return false;
+        }
+    }
+    *pos += size;
+    return size == 0 || fwrite(bytes, size, 1, file) == 1;
+}
+
+SimMemory *SIM_MemCreate() {
+    return calloc(1, sizeof(SimMemory));
+}
+
+void SIM_MemDestroy(SimMemory *mem) {
+    if (mem == NULL) {
+        return;
+    }
+    SIM_MemFree_r(mem);
+    free(mem);
+}
+
+SimMemory *SIM_MemClone(const SimMemory *mem) {
+    SimMemory *clone = malloc(sizeof(SimMemory));
+    if (clone == NULL) {
+        return NULL;
+    }
+    *clone = *mem;
+    clone->shared_image = true;
+    return clone;
+}
+
+SimMemory *SIM_MemDefault() {
+    return &default_mem;
+}
+
+int SIM_MemReset(const char *memImgFname) {
+    return SIM_MemReset_r(&default_mem, memImgFname);
+}
+
+/*
+ * Record the program just loaded for a thread, from `start` to the end of the
+ * code arena, and the block of text it was parsed from.
+ */
+static int finish_program(SimMemory *mem, program_set *programs, block_set *blocks,
+                          block_entry *block, int tid, uint32_t start) {
+    mem->thread_length[tid] = mem->code_size - start;
+    mem->thread_code[tid] = intern_program(mem, programs, start);
+    if (mem->thread_code[tid] == UINT32_MAX) {
+        return -1;
+    }
+    if (block->size == 0) {
+        return 0;
+    }
+    block->start = mem->thread_code[tid];
+    block->length = mem->thread_length[tid];
+    return block_add(blocks, block);
+}
+
+int SIM_MemReset_r(SimMemory *mem, const char *memImgFname) {
+    size_t size = 0;
+    bool mapped = false;
+    char *image = map_image(memImgFname, &size, &mapped);
+    image_reader r = {memImgFname, image, image + size, NULL, NULL, 0};
+    program_set programs = {NULL, 0, 0};
+    block_set blocks = {NULL, 0, 0};
+    block_entry block; // the text of the current code block
+    int block_lines;
+    enum { IN_HEADER, IN_BODY, IN_CODE, IN_DATA } state = IN_HEADER;
+    int tid = -1;
+    bool known_tid = false; // the current thread is one of the image's threads
+    uint32_t code_start = 0; // where the current thread's code starts in the arena
+    uint32_t addr = 0; // the address of the next data word
+    int result = 0;
+
+    if (image == NULL) {
+        return -1; // can't open img file
+    }
+    SIM_MemFree_r(mem);
+    memset(mem, 0, sizeof(*mem));
+    mem->smt.width = 1;
+    mem->data = calloc(1, sizeof(page_dir));
+    if (mem->data == NULL) {
+        unmap_image(image, size, mapped);
+        return -1;
+    }
+
+    if (is_binary_image(image, size)) {
+        // the memory keeps the image, whether it loads or not, to free it with the tables
+        mem->image = image;
+        mem->image_size = size;
+        mem->image_mapped = mapped;
+        return load_binary(mem, image, size, memImgFname);
+    }
+    posix_madvise(image, size, POSIX_MADV_SEQUENTIAL);
+
+    while (result == 0 && next_line(&r)) {
+        // lines of a code or data block, up to an empty line or the next block
+        if (state == IN_CODE) {
+            if (is_code_line(&r)) {
+                if (known_tid) {
+                    Instruction *inst = code_append(mem);
+                    result = inst == NULL ? parse_error(&r, r.line, "out of memory")
+                                          : parse_inst(&r, inst);
+                }
+                continue;
+            }
+            if (known_tid && finish_program(mem, &programs, &blocks, &block, tid, code_start) != 0) {
+                result = parse_error(&r, r.line, "out of memory");
+                break;
+            }
+            state = IN_BODY;
+        } else if (state == IN_DATA) {
+            if (!is_empty_line(&r) && !is_block_start(&r)) {
+                const char *p = r.line;
+                int32_t value;
+                int32_t *words = page_touch(mem->data, addr >> PAGE_BITS);
+                if (!parse_number(&p, r.line_end, 0, &value)) {
+                    result = parse_error(&r, p, "expected a data word");
+                } else if (words == NULL) {
+                    result = parse_error(&r, r.line, "out of memory");
+                } else {
+                    words[(addr >> 2) & (PAGE_WORDS - 1)] = value;
+                    addr += 4;
+                }
+                continue;
+            }
+            state = IN_BODY;
+        }
+
+        if (is_empty_line(&r)) {  // comment or empty line
+            continue;
+        }
+
+        if (state == IN_HEADER) {
+            switch (r.line[0]) {
+                case 'L':
+                    result = parse_header(&r, &mem->load_store_latency[0]);
+                    if (result == 0 && mem->load_store_latency[0] < 0) {
+                        result = parse_error(&r, r.line + 1, "expected a non-negative load latency");
+                    }
+                    break;
+                case 'S':
+                    result = parse_header(&r, &mem->load_store_latency[1]);
+                    if (result == 0 && mem->load_store_latency[1] < 0) {
+                        result = parse_error(&r, r.line + 1, "expected a non-negative store latency");
+                    }
+                    break;
+                case 'O':
+                    result = parse_header(&r, &mem->switch_);
+                    if (result == 0 && mem->switch_ < 0) {
+                        result = parse_error(&r, r.line + 1, "expected a non-negative switch penalty");
+                    }
+                    break;
+                case 'J':
+                    result = parse_header(&r, &mem->branch_penalty);
+                    if (result == 0 && mem->branch_penalty < 0) {
+                        result = parse_error(&r, r.line + 1, "expected a non-negative branch penalty");
+                    }
+                    break;
+                case 'C':
+                    result = parse_cache(&r, &mem->cache);
+                    break;
+                case 'M':
+                    result = parse_memctrl(&r, &mem->memctrl);
+                    break;
+                case 'W':
+                    result = parse_smt(&r, &mem->smt);
+                    break;
+                case 'B':
+                    result = parse_switch(&r, &mem->switching);
+                    break;
+                case 'N':
+                    result = parse_header(&r, &mem->threadnumber);
+                    if (result != 0) {
+                        break;
+                    }
+                    if (mem->threadnumber <= 0) {
+                        result = parse_error(&r, r.line + 1, "expected a positive number of threads");
+                        break;
+                    }
+                    mem->inst_threads = mem->threadnumber;
+                    mem->thread_code = calloc(mem->threadnumber, sizeof(*mem->thread_code));
+                    mem->thread_length = calloc(mem->threadnumber, sizeof(*mem->thread_length));
+                    if (mem->thread_code == NULL || mem->thread_length == NULL) {
+                        result = parse_error(&r, r.line, "out of memory");
+                    }
+                    state = IN_BODY;
+                    break;
+            }
+            continue;
+        }
+
+        if (r.line[0] == 'T') {
+            result = parse_header(&r, &tid);
+        } else if (r.line[0] == 'P') {
+            if (tid >= 0 && tid < mem->inst_threads) {
+                result = parse_priority(&r, mem, tid);
+            }
+        } else if (is_block_start(&r) && r.line[0] == 'I') {  // start of code block
+            result = parse_start(&r, &mem->prog_start);
+            known_tid = tid >= 0 && tid < mem->inst_threads;
+            if (known_tid) {
+                // a block seen before verbatim is not parsed again
+                scan_code_block(&r, &block, &block_lines);
+                const block_entry *seen = block_find(&blocks, block.hash, block.text, block.size);
+                if (seen != NULL) {
+                    mem->thread_code[tid] = seen->start;
+                    mem->thread_length[tid] = seen->length;
+                    r.pos = block.text + block.size;
+                    r.line_no += block_lines;
+                    continue;
+                }
+            }
+            code_start = mem->code_size;
+            state = IN_CODE;
+        } else if (is_block_start(&r) && r.line[0] == 'D') {  // start of data block, any number of them
+            result = parse_start(&r, &addr);
+            state = IN_DATA;
+        }
+    }
+
+    if (result == 0 && state == IN_CODE && known_tid &&
+        finish_program(mem, &programs, &blocks, &block, tid, code_start) != 0) {
+        result = parse_error(&r, r.line_end, "out of memory");
+    }
+    free(programs.entries);
+    free(blocks.entries);
+    unmap_image(image, size, mapped);
+    return result;
+}
+
+void SIM_MemFree(){
+	SIM_MemFree_r(&default_mem);
+}
+
+void SIM_MemFree_r(SimMemory *mem){
+	if (!mem->shared_image) {
+		if (mem->image == NULL) {
+			free(mem->code);
+			free(mem->thread_code);
+			free(mem->thread_length);
+			free(mem->thread_priority);
+		}
+		if (mem->data != NULL) {
+			page_dir_free(mem->data, mem->image, mem->image_size);
+			free(mem->data);
+		}
+		if (mem->image != NULL) {
+			unmap_image(mem->image, mem->image_size, mem->image_mapped);
+		}
+	}
+	mem->image = NULL;
+	mem->code = NULL;
+	mem->thread_code = NULL;
+	mem->thread_length = NULL;
+	mem->thread_priority = NULL;
+	mem->data = NULL;
+}
+
+void SIM_MemDataRead(uint32_t addr, int32_t *dst) {
+    SIM_MemDataRead_r(&default_mem, addr, dst);
+}
+
+void SIM_MemDataRead_r(const SimMemory *mem, uint32_t addr, int32_t *dst) {
+    const int32_t *words = page_find(mem->data, addr >> PAGE_BITS);
+    *dst = words == NULL ? 0 : words[(addr >> 2) & (PAGE_WORDS - 1)];
+}
+
+void SIM_MemDataWrite(uint32_t addr, int32_t val) {
+    SIM_MemDataWrite_r(&default_mem, addr, val);
+}
+
+void SIM_MemDataWrite_r(SimMemory *mem, uint32_t addr, int32_t val) {
+    int32_t *words = page_touch(mem->data, addr >> PAGE_BITS);
+    if (words == NULL) {
+        out_of_memory();
+    }
+    words[(addr >> 2) & (PAGE_WORDS - 1)] = val; // addr is aligned to 4 byte
+}
+
+void SIM_MemInstRead(uint32_t line, Instruction *dst, int tid) {
+    SIM_MemInstRead_r(&default_mem, line, dst, tid);
+}
+
+void SIM_MemInstRead_r(const SimMemory *mem, uint32_t line, Instruction *dst, int tid) {
+    if (line >= mem->thread_length[tid]) {
+        memset(dst, 0, sizeof(*dst));
+        dst->opcode = CMD_HALT;
+        return;
+    }
+    *dst = mem->code[mem->thread_code[tid] + line];
+}
+
+const Instruction *SIM_MemInstCode_r(const SimMemory *mem, int tid, uint32_t *length) {
+    *length = mem->thread_length[tid];
+    return &mem->code[mem->thread_code[tid]];
+}
+
+void SIM_MemHash_r(const SimMemory *mem, uint64_t hash[2]) {
+    static const int32_t zeros[PAGE_WORDS];
+
+    hash[0] = 14695981039346656037ull;
+    hash[1] = 0x9E3779B97F4A7C15ull;
+    hash128_update(hash, &mem->inst_threads, sizeof(mem->inst_threads));
+    for (int tid = 0; tid < mem->inst_threads; tid++) {
+        int32_t priority = mem->thread_priority != NULL ? mem->thread_priority[tid] : 0;
+        hash128_update(hash, &mem->thread_length[tid], sizeof(mem->thread_length[tid]));
+        hash128_update(hash, &priority, sizeof(priority));
+        hash128_update(hash, &mem->code[mem->thread_code[tid]],
+                       mem->thread_length[tid] * sizeof(Instruction));
+    }
+
+    // The pages in address order, but for those only holding zeros
+    for (uint32_t t = 0; mem->data != NULL && t < (1u << DIR_BITS); t++) {
+        for (uint32_t p = 0; mem->data->tables[t] != NULL && p < (1u << TABLE_BITS); p++) {
+            const int32_t *words = mem->data->tables[t]->pages[p];
+            uint32_t page = (t << TABLE_BITS) | p;
+            if (words == NULL || memcmp(words, zeros, sizeof(zeros)) == 0) {
+                continue;
+            }
+            hash128_update(hash, &page, sizeof(page));
+            hash128_update(hash, words, PAGE_WORDS * sizeof(int32_t));
+        }
+    }
+}
+
+int SIM_GetLoadLat() {
+    return SIM_GetLoadLat_r(&default_mem);
+}
+
+int SIM_GetLoadLat_r(const SimMemory *mem) {
+    return mem->load_store_latency[0];
+}
+
+int SIM_GetStoreLat() {
+    return SIM_GetStoreLat_r(&default_mem);
+}
+
+int SIM_GetStoreLat_r(const SimMemory *mem) {
+    return mem->load_store_latency[1];
+}
+
+int SIM_GetThreadsNum() {
+	return SIM_GetThreadsNum_r(&default_mem);
+}
+
+int SIM_GetThreadsNum_r(const SimMemory *mem) {
+	return mem->threadnumber;
+}
+
+int SIM_GetSwitchCycles() {
+    return SIM_GetSwitchCycles_r(&default_mem);
+}
+
+int SIM_GetSwitchCycles_r(const SimMemory *mem) {
+    return mem->switch_;
+}
+
+int SIM_GetBranchPenalty() {
+    return SIM_GetBranchPenalty_r(&default_mem);
+}
+
+int SIM_GetBranchPenalty_r(const SimMemory *mem) {
+    return mem->branch_penalty;
+}
+
+int SIM_SetLoadLat_r(SimMemory *mem, int cycles) {
+    if (cycles < 0) {
+        return -1;
+    }
+    mem->load_store_latency[0] = cycles;
+    return 0;
+}
+
+int SIM_SetStoreLat_r(SimMemory *mem, int cycles) {
+    if (cycles < 0) {
+        return -1;
+    }
+    mem->load_store_latency[1] = cycles;
+    return 0;
+}
+
+int SIM_SetSwitchCycles_r(SimMemory *mem, int cycles) {
+    if (cycles < 0) {
+        return -1;
+    }
+    mem->switch_ = cycles;
+    return 0;
+}
+
+int SIM_SetBranchPenalty_r(SimMemory *mem, int cycles) {
+    if (cycles < 0) {
+        return -1;
+    }
+    mem->branch_penalty = cycles;
+    return 0;
+}
+
+int SIM_SetThreadsNum_r(SimMemory *mem, int threads) {
+    if (threads < 1 || threads > mem->inst_threads) {
+        return -1;
+    }
+    mem->threadnumber = threads;
+    return 0;
+}
+
+void SIM_GetCache_r(const SimMemory *mem, SimCacheConfig *config) {
+    *config = mem->cache;
+}
+
+int SIM_SetCache_r(SimMemory *mem, const SimCacheConfig *config) {
+    if (!cache_config_valid(config)) {
+        return -1;
+    }
+    mem->cache = *config;
+    return 0;
+}
+
+SimCache *SIM_CacheCreate(const SimCacheConfig *config) {
+    SimCache *cache;
+    void *tags;
+    uint32_t sets;
+
+    if (config->size == 0 || !cache_config_valid(config)) {
+        return NULL;
+    }
+    cache = calloc(1, sizeof(SimCache));
+    if (cache == NULL) {
+        return NULL;
+    }
+    sets = config->size / config->line_size / config->ways;
+    cache->ways = config->ways;
+    cache->line_bits = __builtin_ctz(config->line_size);
+    cache->set_mask = sets - 1;
+    cache->policy = config->policy;
+    // sets aligned for the vector compare
+    if (posix_memalign(&tags, CODE_ALIGN, (size_t) sets * config->ways * sizeof(uint32_t)) != 0) {
+        free(cache);
+        return NULL;
+    }
+    cache->tags = tags;
+    cache->state = malloc((size_t) sets * (config->policy == CACHE_LRU ? config->ways : 1) * sizeof(uint64_t));
+    if (cache->state == NULL) {
+        SIM_CacheDestroy(cache);
+        return NULL;
+    }
+    SIM_CacheReset(cache);
+    return cache;
+}
+
+void SIM_CacheDestroy(SimCache *cache) {
+    if (cache == NULL) {
+        return;
+    }
+    free(cache->tags);
+    free(cache->state);
+    free(cache);
+}
+
+void SIM_CacheReset(SimCache *cache) {
+    size_t sets = (size_t) cache->set_mask + 1;
+    memset(cache->tags, 0, sets * cache->ways * sizeof(uint32_t));
+    memset(cache->state, 0, sets * (cache->policy == CACHE_LRU ? cache->ways : 1) * sizeof(uint64_t));
+    cache->now = 0;
+}
+
+/* Find the way of a set holding a tag. Returns -1 if none does */
+static int cache_find(const SimCache *cache, const uint32_t *set, uint32_t tag) {
+#ifdef __SSE2__
+    if (cache->ways % 4 == 0) {
+        __m128i key = _mm_set1_epi32((int) tag);
+        for (uint32_t way = 0; way < cache->ways; way += 4) {
+            __m128i equal = _mm_cmpeq_epi32(_mm_load_si128((const __m128i *) (set + way)), key);
+            int mask = _mm_movemask_ps(_mm_castsi128_ps(equal));
+            if (mask != 0) {
+                return way + __builtin_ctz(mask);
+            }
+        }
+        return -1;
+    }
+#endif
+    for (uint32_t way = 0; way < cache->ways; way++) {
+        if (set[way] == tag) {
+            return way;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Tree PLRU: the ways are the leaves of a binary tree, whose ways - 1 nodes
+ * (numbered from 1, node n having children 2n and 2n + 1) each hold a bit,
+ * set if the victim is in the right subtree. Using a way points the nodes on
+ * its path away from it.
+ */
+static void plru_touch(uint64_t *tree, uint32_t ways, uint32_t way) {
+    uint32_t node = way + ways; // the leaf
+    for (; node > 1; node >>= 1) {
+        uint64_t bit = 1ull << (node >> 1);
+        if (node & 1) {
+            *tree &= ~bit;
+        } else {
+            *tree |= bit;
+        }
+    }
+}
+
+static uint32_t plru_victim(uint64_t tree, uint32_t ways) {
+    uint32_t node = 1;
+    while (node < ways) {
+        node = 2 * node + ((tree >> node) & 1);
+    }
+    return node - ways;
+}
+
+static uint32_t cache_victim(const SimCache *cache, const uint32_t *set, const uint64_t *state) {
+    uint32_t victim = 0;
+    for (uint32_t way = 0; way < cache->ways; way++) {
+        if (set[way] == 0) {
+            return way; // an invalid way
+        }
+    }
+    if (cache->policy == CACHE_PLRU) {
+        return plru_victim(*state, cache->ways);
+    }
+    for (uint32_t way = 1; way < cache->ways; way++) {
+        if (state[way] < state[victim]) {
+            victim = way;
+        }
+    }
+    return victim;
+}
+
+bool SIM_CacheAccess(SimCache *cache, uint32_t addr) {
+    uint32_t block = addr >> cache->line_bits;
+    uint32_t index = block & cache->set_mask;
+    uint32_t tag = (block << 1) | 1;
+    uint32_t *set = &cache->tags[(size_t) index * cache->ways];
+    uint64_t *state = cache->policy == CACHE_LRU ? &cache->state[(size_t) index * cache->ways]
+                                                 : &cache->state[index];
+    int way = cache_find(cache, set, tag);
+    bool hit = way >= 0;
+
+    if (!hit) {
+        way = cache_victim(cache, set, state);
+        set[way] = tag;
+    }
+    if (cache->policy == CACHE_LRU) {
+        state[way] = ++cache->now;
+    } else {
+        plru_touch(state, cache->ways, way);
+    }
+    return hit;
+}
+
+void SIM_GetSMT_r(const SimMemory *mem, SimSMTConfig *config) {
+    *config = mem->smt;
+}
+
+int SIM_SetSMT_r(SimMemory *mem, const SimSMTConfig *config) {
+    if (!smt_config_valid(config)) {
+        return -1;
+    }
+    mem->smt = *config;
+    return 0;
+}
+
+void SIM_GetSwitchPolicy_r(const SimMemory *mem, SimSwitchConfig *config) {
+    *config = mem->switching;
+}
+
+int SIM_SetSwitchPolicy_r(SimMemory *mem, const SimSwitchConfig *config) {
+    if (!switch_config_valid(config)) {
+        return -1;
+    }
+    mem->switching = *config;
+    return 0;
+}
+
+int32_t SIM_GetThreadPriority_r(const SimMemory *mem, int tid) {
+    if (mem->thread_priority == NULL || tid < 0 || tid >= mem->inst_threads) {
+        return 0;
+    }
+    return mem->thread_priority[tid];
+}
+
+void SIM_GetMemCtrl_r(const SimMemory *mem, SimMemCtrlConfig *config) {
+    *config = mem->memctrl;
+}
+
+int SIM_SetMemCtrl_r(SimMemory *mem, const SimMemCtrlConfig *config) {
+    if (!memctrl_config_valid(config)) {
+        return -1;
+    }
+    mem->memctrl = *config;
+    return 0;
+}
+
+SimMemCtrl *SIM_MemCtrlCreate(const SimMemCtrlConfig *config) {
+    SimMemCtrl *ctrl;
+
+    if (config->banks == 0 || !memctrl_config_valid(config)) {
+        return NULL;
+    }
+    ctrl = calloc(1, sizeof(SimMemCtrl));
+    if (ctrl == NULL) {
+        return NULL;
+    }
+    ctrl->banks = config->banks;
+    ctrl->mshrs = config->mshrs;
+    ctrl->bank_cycles = config->bank_cycles;
+    ctrl->interleave_bits = __builtin_ctz(config->interleave);
+    ctrl->bank_free = calloc(config->banks, sizeof(uint64_t));
+    ctrl->pending = malloc(config->mshrs * sizeof(uint64_t));
+    if (ctrl->bank_free == NULL || ctrl->pending == NULL) {
+        SIM_MemCtrlDestroy(ctrl);
+        return NULL;
+    }
+    return ctrl;
+}
+
+void SIM_MemCtrlDestroy(SimMemCtrl *ctrl) {
+    if (ctrl == NULL) {
+        return;
+    }
+    free(ctrl->bank_free);
+    free(ctrl->pending);
+    free(ctrl);
+}
+
+void SIM_MemCtrlReset(SimMemCtrl *ctrl) {
+    memset(ctrl->bank_free, 0, ctrl->banks * sizeof(uint64_t));
+    ctrl->pending_count = 0;
+}
+
+/* Remove the earliest completion from the heap of outstanding requests */
+static void pending_pop(SimMemCtrl *ctrl) {
+    uint64_t *heap = ctrl->pending;
+    uint64_t last = heap[--ctrl->pending_count];
+    uint32_t i = 0;
+
+    for (;;) {
+        uint32_t child = 2 * i + 1;
+        if (child >= ctrl->pending_count) {
+            break;
+        }
+        if (child + 1 < ctrl->pending_count && heap[child + 1] < heap[child]) {
+            child++;
+        }
+        if (last <= heap[child]) {
+            break;
+        }
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = last;
+}
+
+static void pending_push(SimMemCtrl *ctrl, uint64_t done) {
+    uint64_t *heap = ctrl->pending;
+    uint32_t i = ctrl->pending_count++;
+
+    for (; i > 0 && heap[(i - 1) / 2] > done; i = (i - 1) / 2) {
+        heap[i] = heap[(i - 1) / 2];
+    }
+    heap[i] = done;
+}
+
+uint64_t SIM_MemCtrlRequest(SimMemCtrl *ctrl, uint32_t addr, uint64_t cycle, uint32_t latency) {
+    uint64_t *bank_free = &ctrl->bank_free[(addr >> ctrl->interleave_bits) % ctrl->banks];
+    uint64_t start = cycle;
+
+    // the requests completed by now leave their MSHRs
+    while (ctrl->pending_count > 0 && ctrl->pending[0] <= cycle) {
+        pending_pop(ctrl);
+    }
+    // wait for an MSHR, then for the bank
+    if (ctrl->pending_count == ctrl->mshrs) {
+        start = ctrl->pending[0];
+        pending_pop(ctrl);
+    }
+    if (start < *bank_free) {
+        start = *bank_free;
+    }
+    *bank_free = start + ctrl->bank_cycles;
+    pending_push(ctrl, start + latency);
+    return start + latency;
+}
+
+SimDataView *SIM_DataViewCreate(const SimMemory *mem) {
+    SimDataView *view = calloc(1, sizeof(SimDataView));
+    if (view == NULL) {
+        return NULL;
+    }
+    view->mem = mem;
+    view->last_page = NO_PAGE;
+    return view;
+}
+
+void SIM_DataViewDestroy(SimDataView *view) {
+    if (view == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < view->owned_count; i++) {
+        free(view->owned[i].words);
+    }
+    free(view->owned);
+    for (uint32_t t = 0; t < (1u << DIR_BITS); t++) {
+        free(view->dirty.tables[t]);
+    }
+    free(view);
+}
+
+void SIM_DataViewReset(SimDataView *view) {
+    // keep the pages for the next run, out of the directory
+    for (size_t i = 0; i < view->dirty_count; i++) {
+        *page_slot(&view->dirty, view->owned[i].page) = NULL;
+    }
+    view->dirty_count = 0;
+    view->last_page = NO_PAGE;
+}
+
+/* Point the lookaside at the given page, as the view currently sees it */
+static void view_lookup(SimDataView *view, uint32_t page) {
+    int32_t *words = page_find(&view->dirty, page);
+    view->last_dirty = words != NULL;
+    if (words == NULL) {
+        words = page_find(view->mem->data, page);
+    }
+    view->last_page = page;
+    view->last_words = words != NULL ? words : (int32_t *)zero_page;
+}
+
+/* Copy a page into the view, for writing, and point the lookaside at it */
+static void view_copy(SimDataView *view, uint32_t page) {
+    int32_t **slot = page_slot(&view->dirty, page);
+    if (slot == NULL) {
+        out_of_memory();
+    }
+    if (view->dirty_count == view->owned_count) {
+        if (view->owned_count == view->owned_capacity) {
+            size_t capacity = view->owned_capacity == 0 ? 16 : 2 * view->owned_capacity;
+            view_page *owned = realloc(view->owned, capacity * sizeof(*owned));
+            if (owned == NULL) {
+                out_of_memory();
+            }
+            view->owned = owned;
+            view->owned_capacity = capacity;
+        }
+        view->owned[view->owned_count].words = malloc(PAGE_WORDS * sizeof(int32_t));
+        if (view->owned[view->owned_count].words == NULL) {
+            out_of_memory();
+        }
+        view->owned_count++;
+    }
+
+    view_page *copy = &view->owned[view->dirty_count++];
+    const int32_t *words = page_find(view->mem->data, page);
+    memcpy(copy->words, words != NULL ? words : zero_page, PAGE_WORDS * sizeof(int32_t));
+    copy->page = page;
+    *slot = copy->words;
+
+    view->last_page = page;
+    view->last_words = copy->words;
+    view->last_dirty = true;
+}
+
+void SIM_DataViewRead(SimDataView *view, uint32_t addr, int32_t *dst) {
+    uint32_t page = addr >> PAGE_BITS;
+    if (page != view->last_page) {
+        view_lookup(view, page);
+    }
+    *dst = view->last_words[(addr >> 2) & (PAGE_WORDS - 1)];
+}
+
+void SIM_DataViewWrite(SimDataView *view, uint32_t addr, int32_t val) {
+    uint32_t page = addr >> PAGE_BITS;
+    if (page != view->last_page) {
+        view_lookup(view, page);
+    }
+    if (!view->last_dirty) {
+        // first write to the page since the reset: copy it from the image
+        view_copy(view, page);
+    }
+    view->last_words[(addr >> 2) & (PAGE_WORDS - 1)] = val;
+}
+
+int SIM_DataViewSave(const SimDataView *view, FILE *file) {
+    uint64_t count = view->dirty_count;
+    if (fwrite(&count, sizeof(count), 1, file) != 1) {
+        return -1;
+    }
+    for (size_t i = 0; i < view->dirty_count; i++) {
+        if (fwrite(&view->owned[i].page, sizeof(uint32_t), 1, file) != 1 ||
+            fwrite(view->owned[i].words, PAGE_BYTES, 1, file) != 1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int SIM_DataViewRestore(SimDataView *view, FILE *file) {
+    uint64_t count;
+
+    SIM_DataViewReset(view);
+    if (fread(&count, sizeof(count), 1, file) != 1) {
+        return -1;
+    }
+    for (uint64_t i = 0; i < count; i++) {
+        uint32_t page;
+        if (fread(&page, sizeof(page), 1, file) != 1 || page >= (1u << (DIR_BITS + TABLE_BITS)) ||
+            page_find(&view->dirty, page) != NULL) {
+            return -1;
+        }
+        view_copy(view, page);
+        if (fread(view->last_words, PAGE_BYTES, 1, file) != 1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Write values of the state of a cache or a memory controller, or check and read them back */
+static bool save_values(FILE *file, const void *values, size_t size) {
+    return size == 0 || fwrite(values, size, 1, file) == 1;
+}
+
+static bool restore_values(FILE *file, void *values, size_t size) {
+    return size == 0 || fread(values, size, 1, file) == 1;
+}
+
+static bool restore_check(FILE *file, uint32_t expected) {
+    uint32_t value;
+    return restore_values(file, &value, sizeof(value)) && value == expected;
+}
+
+int SIM_CacheSave(const SimCache *cache, FILE *file) {
+    size_t sets = (size_t) cache->set_mask + 1;
+    uint32_t geometry[4] = {cache->ways, cache->set_mask, cache->line_bits, (uint32_t) cache->policy};
+
+    return save_values(file, geometry, sizeof(geometry)) &&
+           save_values(file, &cache->now, sizeof(cache->now)) &&
+           save_values(file, cache->tags, sets * cache->ways * sizeof(uint32_t)) &&
+           save_values(file, cache->state,
+                       sets * (cache->policy == CACHE_LRU ? cache->ways : 1) * sizeof(uint64_t)) ? 0 : -1;
+}
+
+int SIM_CacheRestore(SimCache *cache, FILE *file) {
+    size_t sets = (size_t) cache->set_mask + 1;
+
+    return restore_check(file, cache->ways) &&
+           restore_check(file, cache->set_mask) &&
+           restore_check(file, cache->line_bits) &&
+           restore_check(file, (uint32_t) cache->policy) &&
+           restore_values(file, &cache->now, sizeof(cache->now)) &&
+           restore_values(file, cache->tags, sets * cache->ways * sizeof(uint32_t)) &&
+           restore_values(file, cache->state,
+                          sets * (cache->policy == CACHE_LRU ? cache->ways : 1) * sizeof(uint64_t)) ? 0 : -1;
+}
+
+int SIM_MemCtrlSave(const SimMemCtrl *ctrl, FILE *file) {
+    uint32_t geometry[3] = {ctrl->banks, ctrl->mshrs, ctrl->pending_count};
+
+    return save_values(file, geometry, sizeof(geometry)) &&
+           save_values(file, ctrl->bank_free, ctrl->banks * sizeof(uint64_t)) &&
+           save_values(file, ctrl->pending, ctrl->pending_count * sizeof(uint64_t)) ? 0 : -1;
+}
+
+int SIM_MemCtrlRestore(SimMemCtrl *ctrl, FILE *file) {
+    if (!restore_check(file, ctrl->banks) || !restore_check(file, ctrl->mshrs) ||
+        !restore_values(file, &ctrl->pending_count, sizeof(ctrl->pending_count)) ||
+        ctrl->pending_count > ctrl->mshrs) {
+        ctrl->pending_count = 0;
+        return -1;
+    }
+    return restore_values(file, ctrl->bank_free, ctrl->banks * sizeof(uint64_t)) &&
+           restore_values(file, ctrl->pending, ctrl->pending_count * sizeof(uint64_t)) ? 0 : -1;
+}
+
+int SIM_MemSave_r(const SimMemory *mem, const char *fname) {
+    FILE *file;
+    bin_header header;
+    uint32_t *page_numbers;
+    uint64_t pos = 0;
+    bool ok;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BIN_MAGIC, sizeof(header.magic));
+    header.version = BIN_VERSION;
+    header.inst_size = sizeof(Instruction);
+    header.load_latency = mem->load_store_latency[0];
+    header.store_latency = mem->load_store_latency[1];
+    header.switch_cycles = mem->switch_;
+    header.branch_penalty = mem->branch_penalty;
+    header.threads = mem->threadnumber;
+    header.image_threads = mem->inst_threads;
+    header.prog_start = mem->prog_start;
+    header.code_size = mem->code_size;
+    header.cache = mem->cache;
+    header.memctrl = mem->memctrl;
+    header.smt = mem->smt;
+    header.switching = mem->switching;
+
+    for (uint32_t t = 0; mem->data != NULL && t < (1u << DIR_BITS); t++) {
+        for (uint32_t p = 0; mem->data->tables[t] != NULL && p < (1u << TABLE_BITS); p++) {
+            header.page_count += mem->data->tables[t]->pages[p] != NULL;
+        }
+    }
+    page_numbers = malloc(header.page_count * sizeof(uint32_t) + 1);
+    if (page_numbers == NULL) {
+        return -1;
+    }
+    header.page_count = 0;
+    for (uint32_t t = 0; mem->data != NULL && t < (1u << DIR_BITS); t++) {
+        for (uint32_t p = 0; mem->data->tables[t] != NULL && p < (1u << TABLE_BITS); p++) {
+            if (mem->data->tables[t]->pages[p] != NULL) {
+                page_numbers[header.page_count++] = (t << TABLE_BITS) | p;
+            }
+        }
+    }
+
+    header.code_offset = align_up(sizeof(header), CODE_ALIGN);
+    header.threads_offset = align_up(header.code_offset + (uint64_t) header.code_size * sizeof(Instruction),
+                                     CODE_ALIGN);
+    header.pages_offset = align_up(header.threads_offset + 2 * sizeof(uint32_t) * (uint64_t) header.image_threads,
+                                   CODE_ALIGN);
+    if (mem->thread_priority != NULL) {
+        header.priorities_offset = header.pages_offset;
+        header.pages_offset = align_up(header.priorities_offset + sizeof(int32_t) * (uint64_t) header.image_threads,
+                                       CODE_ALIGN);
+    }
+    header.page_data_offset = align_up(header.pages_offset + sizeof(uint32_t) * (uint64_t) header.page_count,
+                                       PAGE_BYTES);
+
+    file = fopen(fname, "wb");
+    if (file == NULL) {
+        free(page_numbers);
+        return -1;
+    }
+    ok = write_at(file, &pos, 0, &header, sizeof(header)) &&
+         write_at(file, &pos, header.code_offset, mem->code, header.code_size * sizeof(Instruction)) &&
+         write_at(file, &pos, header.threads_offset, mem->thread_code, header.image_threads * sizeof(uint32_t)) &&
+         write_at(file, &pos, pos, mem->thread_length, header.image_threads * sizeof(uint32_t)) &&
+         (mem->thread_priority == NULL ||
+          write_at(file, &pos, header.priorities_offset, mem->thread_priority,
+                   header.image_threads * sizeof(int32_t))) &&
+         write_at(file, &pos, header.pages_offset, page_numbers, header.page_count * sizeof(uint32_t));
+    for (uint32_t i = 0; ok && i < header.page_count; i++) {
+        ok = write_at(file, &pos, header.page_data_offset + i * PAGE_BYTES,
+                      page_find(mem->data, page_numbers[i]), PAGE_BYTES);
+    }
+    free(page_numbers);
+    return fclose(file) == 0 && ok ? 0 : -1;
 }
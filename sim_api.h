@@ -28,11 +28,17 @@ void SIM_MemFree();
      Each subsequent line up to the next "@" line is an instruction of format: <command> <dst>,<src1>,<src2>
      Commands is one of: NOP, ADD, SUB, LOAD, STORE
      operands are $<num> for any general purpose register, or just a number for immediate (for src2 only)
+     Branches are "BEQ <a>,<b>,<target>", "BNE <a>,<b>,<target>" and "JMP <target>", where the target
+     (a register or an immediate) is the index of an instruction in the thread's program.
   2. "D@<address>" : The following lines are data values at given memory offset.
      Each subsequent line up the the next "@"is data value of a 32 bit (hex.) data word, e.g., 0x12A556FF
+     An image may have any number of data segments, at any addresses.
   \returns 0 - for success in reseting and loading image file. <0 in case of error.
+  Syntax errors are reported to stderr as "<file>:<line>:<column>: <message>".
 
   * Any memory address that is not defined in the given image file is initialized to zero.
+  * The data memory spans the whole 32 bit address space. It is kept in 4 KiB pages, allocated as
+    they are first written, so its footprint depends on the data used rather than on its addresses.
  */
 int SIM_MemReset(const char * memImgFname);
 
@@ -73,11 +79,349 @@ int SIM_GetStoreLat();
 */
 int SIM_GetSwitchCycles();
 
+/*! SIM_GetBranchPenalty: Get the number of cycles a taken branch makes its thread wait (J{x}, 0 if
+  the image has no J line)
+  \param[out] branch penalty cycles
+*/
+int SIM_GetBranchPenalty();
+
 /*! SIM_GetThreadsNum: Get the number of threads
   \param[out] number of threads
 */
 int SIM_GetThreadsNum();
 
+/* ----- Reentrant memory simulator API ----- */
+
+/*
+ * Each SimMemory holds its own memory image and parameters, so several can be
+ * used at once (e.g. from different threads). Every call above has a `_r`
+ * counterpart taking the memory to operate on; the calls above operate on the
+ * default memory returned by SIM_MemDefault.
+ */
+typedef struct _sim_memory SimMemory;
+
+/*! SIM_MemCreate: Allocate an empty memory simulator
+  \returns The new memory, or NULL if out of memory. Load an image into it with SIM_MemReset_r.
+*/
+SimMemory * SIM_MemCreate();
+
+/*! SIM_MemDestroy: Free a memory simulator allocated by SIM_MemCreate, along with its image
+*/
+void SIM_MemDestroy(SimMemory * mem);
+
+/*! SIM_MemDefault: Get the memory simulator the non-reentrant calls operate on
+*/
+SimMemory * SIM_MemDefault();
+
+/*! SIM_MemClone: Copy a loaded memory simulator, e.g. to simulate it under other parameters
+  The copy shares the image (instructions and data) of the original, which must outlive it, and
+  has its own parameters. Nothing is copied but the parameters.
+  \returns The new memory (free with SIM_MemDestroy), or NULL if out of memory.
+*/
+SimMemory * SIM_MemClone(const SimMemory * mem);
+
+/*! SIM_MemSave_r: Compile a loaded memory image into a binary image file
+  SIM_MemReset loads binary images (told apart from textual ones by their header) by mapping them
+  and using their tables in place, without parsing. A binary image is only valid on hosts with the
+  same byte order and Instruction layout, which the loader checks.
+  \returns 0 for success, <0 in case of error.
+*/
+int SIM_MemSave_r(const SimMemory * mem, const char * fname);
+
+void SIM_MemFree_r(SimMemory * mem);
+
+int SIM_MemReset_r(SimMemory * mem, const char * memImgFname);
+
+void SIM_MemDataRead_r(const SimMemory * mem, uint32_t addr, int32_t * dst);
+
+void SIM_MemDataWrite_r(SimMemory * mem, uint32_t addr, int32_t val);
+
+void SIM_MemInstRead_r(const SimMemory * mem, uint32_t line, Instruction * dst, int tid);
+
+/*! SIM_MemInstCode_r: Get the whole program of a thread
+  Threads whose code is identical share a single copy of it, so the same program is returned for
+  all of them. Lines past the end of a program read as HALT through SIM_MemInstRead.
+  \param[out] length Number of instructions in the program
+  \returns The first instruction of the program, valid until the image is reloaded.
+*/
+const Instruction * SIM_MemInstCode_r(const SimMemory * mem, int tid, uint32_t * length);
+
+/*! SIM_MemHash_r: Hash the contents of the loaded image: the programs and priorities of all its
+  threads, and its data as it currently is. A textual image and its binary compilation hash alike,
+  as do images that only differ in their parameters (latencies, N, cache...) or in zero data words.
+  \param[out] hash The 128 bit hash
+*/
+void SIM_MemHash_r(const SimMemory * mem, uint64_t hash[2]);
+
+int SIM_GetLoadLat_r(const SimMemory * mem);
+
+int SIM_GetStoreLat_r(const SimMemory * mem);
+
+int SIM_GetSwitchCycles_r(const SimMemory * mem);
+
+int SIM_GetBranchPenalty_r(const SimMemory * mem);
+
+int SIM_GetThreadsNum_r(const SimMemory * mem);
+
+/* Override the parameters loaded from the image (e.g. for parameter sweeps).
+   The latency and penalty setters return 0 for success, <0 if `cycles` is negative */
+
+int SIM_SetLoadLat_r(SimMemory * mem, int cycles);
+
+int SIM_SetStoreLat_r(SimMemory * mem, int cycles);
+
+int SIM_SetSwitchCycles_r(SimMemory * mem, int cycles);
+
+/*! SIM_SetBranchPenalty_r: Set the cycles a taken branch makes its thread wait
+  \returns 0 for success, <0 if `cycles` is negative.
+*/
+int SIM_SetBranchPenalty_r(SimMemory * mem, int cycles);
+
+/*! SIM_SetThreadsNum_r: Simulate only the first `threads` threads of the image
+  \returns 0 for success, <0 if the image has fewer threads.
+*/
+int SIM_SetThreadsNum_r(SimMemory * mem, int threads);
+
+/* ----- Data cache model ----- */
+
+/*
+ * A set-associative data cache in front of the data memory, shared by the
+ * threads of a core. It models timing only: LOADs that hit take the hit
+ * latency, and LOADs that miss the miss latency, instead of the fixed LOAD
+ * latency (L). STOREs allocate lines as well (write-allocate) but keep their
+ * fixed latency (S), as if buffered.
+ *
+ * An image configures its cache with a header line
+ * "C<size>,<ways>,<line size>,<hit latency>,<miss latency>[,LRU|PLRU]"
+ * before its N line, e.g. "C32768,8,64,2,100". Sizes are in bytes. The line
+ * size and the number of sets must be powers of 2, as must the ways for PLRU.
+ * Without it, there is no cache.
+ */
+typedef enum
+{
+    CACHE_LRU = 0,  // true LRU
+    CACHE_PLRU,     // tree pseudo-LRU
+} cache_policy;
+
+typedef struct _cache_config
+{
+    uint32_t size;          // total size in bytes, 0 for no cache
+    uint32_t ways;          // associativity, up to 64
+    uint32_t line_size;     // in bytes
+    uint32_t hit_latency;   // cycles
+    uint32_t miss_latency;  // cycles
+    cache_policy policy;
+} SimCacheConfig;
+
+typedef struct _sim_cache SimCache;
+
+void SIM_GetCache_r(const SimMemory * mem, SimCacheConfig * config);
+
+/*! SIM_SetCache_r: Override the data cache the image configures
+  \returns 0 for success, <0 if the configuration is invalid.
+*/
+int SIM_SetCache_r(SimMemory * mem, const SimCacheConfig * config);
+
+/*! SIM_CacheCreate: Create an empty cache
+  \returns The new cache, or NULL if out of memory or if the configuration has no cache.
+*/
+SimCache * SIM_CacheCreate(const SimCacheConfig * config);
+
+void SIM_CacheDestroy(SimCache * cache);
+
+/*! SIM_CacheReset: Invalidate all lines
+*/
+void SIM_CacheReset(SimCache * cache);
+
+/*! SIM_CacheAccess: Access the line of an address, allocating it on a miss
+  \returns true for a hit, false for a miss.
+*/
+bool SIM_CacheAccess(SimCache * cache, uint32_t addr);
+
+/*! SIM_CacheSave: Write the state of a cache (its lines and their ages) to a checkpoint file
+  \returns 0 for success, <0 in case of error.
+*/
+int SIM_CacheSave(const SimCache * cache, FILE * file);
+
+/*! SIM_CacheRestore: Read back the state written by SIM_CacheSave
+  \returns 0 for success, <0 in case of error, or if the cache has another geometry or policy.
+*/
+int SIM_CacheRestore(SimCache * cache, FILE * file);
+
+/* ----- SMT parameters ----- */
+
+/*
+ * The simultaneous multithreading core (CORE_SMT) issues up to `width`
+ * instructions per cycle, each from a different ready thread, picked by its
+ * fetch policy. An image configures them with a header line
+ * "W<width>[,RR|ICOUNT]" before its N line, e.g. "W4,ICOUNT". Without it, the
+ * core issues a single instruction per cycle, in round-robin order.
+ */
+typedef enum
+{
+    FETCH_RR = 0,   // round-robin, from the thread after the last one picked
+    FETCH_ICOUNT,   // the threads that issued the fewest instructions first, then the lower tids
+} fetch_policy;
+
+typedef struct _smt_config
+{
+    uint32_t width;     // issue width, at least 1
+    fetch_policy policy;
+} SimSMTConfig;
+
+void SIM_GetSMT_r(const SimMemory * mem, SimSMTConfig * config);
+
+/*! SIM_SetSMT_r: Override the SMT parameters the image configures
+  \returns 0 for success, <0 if the configuration is invalid.
+*/
+int SIM_SetSMT_r(SimMemory * mem, const SimSMTConfig * config);
+
+/* ----- Blocked MT switch policy ----- */
+
+/*
+ * The blocked MT core (CORE_BlockedMT) keeps running a thread until it stalls
+ * on memory or finishes, and then decides whether and to which thread to
+ * switch, paying the context-switch cycles on each switch, by its switch
+ * policy. An image configures it with a header line
+ * "B<RR|LATENCY|TIMESLICE|PRIORITY|LRU>[,<timeslice>]" before its N line,
+ * e.g. "BTIMESLICE,200", and the priorities of its threads with a line
+ * "P<priority>" after their T line. Without them, the core switches in
+ * round-robin order, and all threads have priority 0.
+ */
+typedef enum
+{
+    SWITCH_RR = 0,      // to the next ready thread in round-robin order
+    SWITCH_LATENCY,     // as RR, but only once the stall has more cycles left than a switch takes
+    SWITCH_TIMESLICE,   // as RR, and also once a thread ran `timeslice` instructions in a row
+    SWITCH_PRIORITY,    // to the ready thread of the highest priority, RR among equals
+    SWITCH_LRU,         // to the ready thread that ran least recently, RR among equals
+    SWITCH_POLICY_COUNT,    // number of policies
+} switch_policy;
+
+typedef struct _switch_config
+{
+    switch_policy policy;
+    uint32_t timeslice;     // for SWITCH_TIMESLICE, at least 1
+} SimSwitchConfig;
+
+void SIM_GetSwitchPolicy_r(const SimMemory * mem, SimSwitchConfig * config);
+
+/*! SIM_SetSwitchPolicy_r: Override the switch policy the image configures
+  \returns 0 for success, <0 if the configuration is invalid.
+*/
+int SIM_SetSwitchPolicy_r(SimMemory * mem, const SimSwitchConfig * config);
+
+/*! SIM_GetThreadPriority_r: Get the priority of a thread, for SWITCH_PRIORITY (the higher, the sooner it runs)
+  \returns The priority, 0 unless the image sets it.
+*/
+int32_t SIM_GetThreadPriority_r(const SimMemory * mem, int tid);
+
+/* ----- Memory controller model ----- */
+
+/*
+ * A model of the contention for the memory behind the data cache, shared by
+ * the threads of a core. Every request that reaches the memory (all LOADs and
+ * STOREs without a cache, misses with one) takes its usual latency, plus the
+ * time it waits for a free miss status holding register (MSHR) and for its
+ * bank. A bank serves a request at a time, and each request keeps an MSHR
+ * until it completes. Addresses are interleaved across the banks.
+ *
+ * An image configures its controller with a header line
+ * "M<banks>,<MSHRs>,<bank busy cycles>[,<interleave bytes>]" before its N
+ * line, e.g. "M8,16,4". The interleave, 64 bytes by default, must be a power
+ * of 2. Without it, requests never wait.
+ */
+typedef struct _memctrl_config
+{
+    uint32_t banks;         // 0 for no contention
+    uint32_t mshrs;         // the requests that may be outstanding at once
+    uint32_t bank_cycles;   // the cycles a bank is busy serving a request
+    uint32_t interleave;    // in bytes
+} SimMemCtrlConfig;
+
+typedef struct _sim_memctrl SimMemCtrl;
+
+void SIM_GetMemCtrl_r(const SimMemory * mem, SimMemCtrlConfig * config);
+
+/*! SIM_SetMemCtrl_r: Override the memory controller the image configures
+  \returns 0 for success, <0 if the configuration is invalid.
+*/
+int SIM_SetMemCtrl_r(SimMemory * mem, const SimMemCtrlConfig * config);
+
+/*! SIM_MemCtrlCreate: Create an idle memory controller
+  \returns The new controller, or NULL if out of memory or if the configuration has no contention.
+*/
+SimMemCtrl * SIM_MemCtrlCreate(const SimMemCtrlConfig * config);
+
+void SIM_MemCtrlDestroy(SimMemCtrl * ctrl);
+
+/*! SIM_MemCtrlReset: Drop all outstanding requests
+*/
+void SIM_MemCtrlReset(SimMemCtrl * ctrl);
+
+/*! SIM_MemCtrlRequest: Issue a memory request
+  The completion is known when the request is issued, so the model needs no polling. Requests
+  must be issued in the order of their cycles.
+  \param[in] cycle The cycle the request is issued in
+  \param[in] latency The cycles the request takes once served
+  \returns The cycle the request completes in.
+*/
+uint64_t SIM_MemCtrlRequest(SimMemCtrl * ctrl, uint32_t addr, uint64_t cycle, uint32_t latency);
+
+/*! SIM_MemCtrlSave: Write the state of a controller (its banks and outstanding requests) to a checkpoint file
+  \returns 0 for success, <0 in case of error.
+*/
+int SIM_MemCtrlSave(const SimMemCtrl * ctrl, FILE * file);
+
+/*! SIM_MemCtrlRestore: Read back the state written by SIM_MemCtrlSave
+  \returns 0 for success, <0 in case of error, or if the controller has other banks or MSHRs.
+*/
+int SIM_MemCtrlRestore(SimMemCtrl * ctrl, FILE * file);
+
+/* ----- Data memory views ----- */
+
+/*
+ * A SimDataView is a private, copy-on-write view of the data of a loaded
+ * image. Reads go to the image until a page is first written; the page is then
+ * copied into the view, and later accesses to it stay in the view. The image
+ * itself is never written through a view, so several views (e.g. one per
+ * simulated core) can be used at once, from different threads, all starting
+ * from the same pristine data.
+ */
+typedef struct _sim_data_view SimDataView;
+
+/*! SIM_DataViewCreate: Create a view over the data of a memory simulator
+  The view follows the image the memory currently holds. Changes to the image (reloading it, or
+  writing it with SIM_MemDataWrite) are seen by the view from its next reset.
+  \returns The new view, or NULL if out of memory.
+*/
+SimDataView * SIM_DataViewCreate(const SimMemory * mem);
+
+void SIM_DataViewDestroy(SimDataView * view);
+
+/*! SIM_DataViewReset: Drop all writes made through the view, going back to the image's data
+*/
+void SIM_DataViewReset(SimDataView * view);
+
+/*! SIM_DataViewRead: Read a data word, as SIM_MemDataRead does, as seen by the view
+*/
+void SIM_DataViewRead(SimDataView * view, uint32_t addr, int32_t * dst);
+
+/*! SIM_DataViewWrite: Write a data word into the view, leaving the image untouched
+*/
+void SIM_DataViewWrite(SimDataView * view, uint32_t addr, int32_t val);
+
+/*! SIM_DataViewSave: Write the pages written through the view to a checkpoint file
+  Only those pages are written: the rest of the data is the image's.
+  \returns 0 for success, <0 in case of error.
+*/
+int SIM_DataViewSave(const SimDataView * view, FILE * file);
+
+/*! SIM_DataViewRestore: Reset the view, then read back the pages written by SIM_DataViewSave
+  \returns 0 for success, <0 in case of error.
+*/
+int SIM_DataViewRestore(SimDataView * view, FILE * file);
+
 
 #ifdef __cplusplus
 }
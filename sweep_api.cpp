@@ -0,0 +1,263 @@
+/* 046267 Computer Architecture - HW #4 */
+/* Parameter sweeps over a loaded memory image        */
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include "sweep_api.h"
+
+/* ----- Classes ----- */
+
+/**
+ * @brief A worker's share of the sweep points: a range of point indices. The
+ * worker takes points from the front, and idle workers steal the back half.
+ */
+class WorkRange
+{
+private:
+    std::mutex m_lock;
+    size_t m_begin;
+    size_t m_end;
+
+public:
+    WorkRange() : m_begin(0), m_end(0) {}
+
+    void assign(size_t begin, size_t end)
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_begin = begin;
+        m_end = end;
+    }
+
+    /**
+     * @brief Take the next point from the front of the range.
+     * @return `true` if a point was taken, `false` if the range is empty.
+     */
+    bool pop(size_t &index)
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        if (m_begin == m_end)
+        {
+            return false;
+        }
+        index = m_begin++;
+        return true;
+    }
+
+    /**
+     * @brief Move the back half of the range (at least one point) to `thief`,
+     * which must be empty.
+     * @return `true` if any points were moved.
+     */
+    bool steal(WorkRange &thief)
+    {
+        size_t begin;
+        size_t end;
+        {
+            std::lock_guard<std::mutex> guard(m_lock);
+            if (m_begin == m_end)
+            {
+                return false;
+            }
+            end = m_end;
+            begin = m_begin + (m_end - m_begin) / 2;
+            m_end = begin;
+        }
+        thief.assign(begin, end);
+        return true;
+    }
+};
+
+/* ----- Helper Functions ----- */
+
+/**
+ * @brief Check that a configuration can be simulated on the given image.
+ */
+bool is_valid(const SimMemory * mem, const sweep_config &config)
+{
+    return config.load_lat >= 0 &&
+           config.store_lat >= 0 &&
+           config.switch_cycles >= 0 &&
+           config.threads >= 1 &&
+           config.threads <= SIM_GetThreadsNum_r(mem) &&
+           config.issue_width >= 1 &&
+           config.timeslice >= 0 &&
+           config.compared_policies < (1u << SWITCH_POLICY_COUNT) &&
+           (config.timeslice > 0 ||
+            !(config.compared_policies & (1u << SWITCH_TIMESLICE)));
+}
+
+/**
+ * @brief Run a mode to the end, unless the result store has its result.
+ * @param cache_dir Directory of the result store, NULL for none.
+ */
+void run_mode(SimInstance * sim, mt_mode mode, const char * cache_dir)
+{
+    if (cache_dir != NULL && CORE_ResultLookup_r(sim, mode, cache_dir) == 1)
+    {
+        return;
+    }
+
+    CORE_Start_r(sim, mode);
+    CORE_RunUntil_r(sim, mode, (size_t)-1);
+    if (cache_dir != NULL && CORE_ResultStore_r(sim, mode, cache_dir) != 0)
+    {
+        fprintf(stderr, "Failed storing a result in %s\n", cache_dir);
+    }
+}
+
+/**
+ * @brief Simulate a single point of the sweep, on a clone of the memory.
+ * @return `true` on success, `false` if out of memory.
+ */
+bool run_point(const SimMemory * mem,
+               const sweep_config &config,
+               sweep_result &result,
+               const char * cache_dir)
+{
+    SimMemory * point_mem = SIM_MemClone(mem);
+    SimInstance * sim;
+    SimSMTConfig smt;
+    SimSwitchConfig switching;
+
+    if (point_mem == NULL)
+    {
+        return false;
+    }
+
+    SIM_SetLoadLat_r(point_mem, config.load_lat);
+    SIM_SetStoreLat_r(point_mem, config.store_lat);
+    SIM_SetSwitchCycles_r(point_mem, config.switch_cycles);
+    SIM_SetThreadsNum_r(point_mem, config.threads);
+    SIM_GetSMT_r(point_mem, &smt);
+    smt.width = config.issue_width;
+    SIM_SetSMT_r(point_mem, &smt);
+    SIM_GetSwitchPolicy_r(point_mem, &switching);
+    if (config.timeslice > 0)
+    {
+        switching.timeslice = config.timeslice;
+        SIM_SetSwitchPolicy_r(point_mem, &switching);
+    }
+
+    sim = CORE_Attach(point_mem);
+    if (sim == NULL)
+    {
+        SIM_MemDestroy(point_mem);
+        return false;
+    }
+
+    result.config = config;
+
+    run_mode(sim, MT_BLOCKED, cache_dir);
+    result.blocked_cycles = CORE_BlockedMT_Cycles_r(sim);
+    result.blocked_instructions = CORE_BlockedMT_Instructions_r(sim);
+    result.blocked_cpi = CORE_BlockedMT_CPI_r(sim);
+
+    for (int policy = 0; policy < SWITCH_POLICY_COUNT; ++policy)
+    {
+        SimSwitchConfig compared = { (switch_policy)policy, switching.timeslice };
+
+        result.blocked_policy_cycles[policy] = 0;
+        result.blocked_policy_cpi[policy] = 0;
+        if (!(config.compared_policies & (1u << policy)))
+        {
+            continue;
+        }
+        SIM_SetSwitchPolicy_r(point_mem, &compared);
+        run_mode(sim, MT_BLOCKED, cache_dir);
+        result.blocked_policy_cycles[policy] = CORE_BlockedMT_Cycles_r(sim);
+        result.blocked_policy_cpi[policy] = CORE_BlockedMT_CPI_r(sim);
+    }
+
+    run_mode(sim, MT_FINEGRAINED, cache_dir);
+    result.finegrained_cycles = CORE_FinegrainedMT_Cycles_r(sim);
+    result.finegrained_instructions = CORE_FinegrainedMT_Instructions_r(sim);
+    result.finegrained_cpi = CORE_FinegrainedMT_CPI_r(sim);
+
+    run_mode(sim, MT_SMT, cache_dir);
+    result.smt_cycles = CORE_SMT_Cycles_r(sim);
+    result.smt_instructions = CORE_SMT_Instructions_r(sim);
+    result.smt_cpi = CORE_SMT_CPI_r(sim);
+
+    CORE_Destroy(sim);
+    return true;
+}
+
+/* ----- External API Functions ----- */
+
+int SWEEP_Run(const SimMemory * mem,
+              const sweep_config configs[],
+              size_t count,
+              sweep_result results[],
+              int workers,
+              const char * cache_dir)
+{
+    std::vector<std::thread> threads;
+    std::atomic<bool> failed(false);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (!is_valid(mem, configs[i]))
+        {
+            return -1;
+        }
+    }
+
+    if (workers <= 0)
+    {
+        workers = (int)std::thread::hardware_concurrency();
+    }
+    if (workers <= 0)
+    {
+        workers = 1;
+    }
+    if ((size_t)workers > count)
+    {
+        workers = count > 0 ? (int)count : 1;
+    }
+
+    // Split the points evenly; workers that run out steal from the others.
+    std::vector<WorkRange> ranges(workers);
+    for (int w = 0; w < workers; ++w)
+    {
+        ranges[w].assign(count * w / workers, count * (w + 1) / workers);
+    }
+
+    auto work = [&](int self)
+    {
+        size_t index;
+        for (;;)
+        {
+            while (ranges[self].pop(index))
+            {
+                if (!run_point(mem, configs[index], results[index], cache_dir))
+                {
+                    failed = true;
+                }
+            }
+
+            bool stolen = false;
+            for (int i = 1; i < workers && !stolen; ++i)
+            {
+                stolen = ranges[(self + i) % workers].steal(ranges[self]);
+            }
+            if (!stolen)
+            {
+                return;
+            }
+        }
+    };
+
+    for (int w = 1; w < workers; ++w)
+    {
+        threads.push_back(std::thread(work, w));
+    }
+    work(0);
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,67 @@
+/* 046267 Computer Architecture - HW #4 */
+/* Parameter sweeps over a loaded memory image        */
+
+#ifndef SWEEP_API_H_
+#define SWEEP_API_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include "core_api.h"
+#include "sim_api.h"
+
+/* A point of the sweep: the simulator parameters of the image (L/S/O/N/W/T) */
+typedef struct _sweep_config
+{
+    int load_lat;       // L
+    int store_lat;      // S
+    int switch_cycles;  // O
+    int threads;        // N, the first N threads of the image are simulated
+    int issue_width;    // W, of the SMT core
+    int timeslice;      // T, of the blocked core's SWITCH_TIMESLICE policy, 0 for the image's
+    unsigned int compared_policies; // switch policies the blocked core also runs under, bit (1 << policy) each
+} sweep_config;
+
+typedef struct _sweep_result
+{
+    sweep_config config;
+    size_t blocked_cycles;
+    size_t blocked_instructions;
+    double blocked_cpi;
+    size_t blocked_policy_cycles[SWITCH_POLICY_COUNT];  // of the compared policies only
+    double blocked_policy_cpi[SWITCH_POLICY_COUNT];
+    size_t finegrained_cycles;
+    size_t finegrained_instructions;
+    double finegrained_cpi;
+    size_t smt_cycles;
+    size_t smt_instructions;
+    double smt_cpi;
+} sweep_result;
+
+/*! SWEEP_Run: Simulate a loaded image in blocked, fine-grained and simultaneous MT under many configurations
+  Each point runs on its own clone of the memory, which shares the loaded image, and all modes
+  start from the image's data. The blocked core runs under the image's switch policy, and then
+  again under each of the compared policies. Points are spread over `workers` host threads, which steal work from each other.
+  \param[in] mem Loaded memory image. Not modified.
+  \param[in] configs Configurations to simulate.
+  \param[in] count Number of configurations.
+  \param[out] results Results, results[i] being the result of configs[i].
+  \param[in] workers Number of host threads, or 0 for one per host core.
+  \param[in] cache_dir Directory of a result store (see CORE_ResultLookup), or NULL for none. Runs
+  whose results it has are not simulated again, and the results of the others are added to it.
+  \returns 0 for success, <0 if a configuration is invalid (nothing is simulated then) or out of memory.
+*/
+int SWEEP_Run(const SimMemory * mem,
+              const sweep_config configs[],
+              size_t count,
+              sweep_result results[],
+              int workers,
+              const char * cache_dir);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SWEEP_API_H_ */
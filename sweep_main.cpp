@@ -0,0 +1,444 @@
+/* 046267 Computer Architecture - HW #4 */
+/* Parameter sweep driver                              */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "sweep_api.h"
+
+#define DEFAULT_TIMESLICE 100
+
+static const char * const policy_names[SWITCH_POLICY_COUNT] = {
+    "RR", "LATENCY", "TIMESLICE", "PRIORITY", "LRU"
+};
+
+static void usage(const char * prog)
+{
+    fprintf(stderr,
+            "Usage: %s <image> [-L list] [-S list] [-O list] [-N list] [-W list]\n"
+            "          [-T list] [-P policies] [-f configs] [-j workers] [-C dir]\n"
+            "          [--json]\n"
+            "  list     Comma separated values or ranges first:last[:step],\n"
+            "           e.g. 10,20,100:400:100. Defaults to the image's value.\n"
+            "           T is the timeslice of the blocked TIMESLICE policy,\n"
+            "           defaulting to %d if the image sets none.\n"
+            "  policies Blocked MT switch policies to compare side by side, e.g.\n"
+            "           RR,LATENCY,TIMESLICE,PRIORITY,LRU, or all.\n"
+            "  configs  File with a configuration per line, e.g. \"L300 S100 O4 N8 W2\".\n"
+            "           Omitted parameters default to the image's values.\n"
+            "           Replaces the grid given by -L/-S/-O/-N/-W/-T.\n"
+            "  workers  Number of host threads, defaults to one per core.\n"
+            "  dir      Result store shared across runs: points already simulated\n"
+            "           are read from it. Defaults to $SIM_RESULT_CACHE, if set.\n",
+            prog, DEFAULT_TIMESLICE);
+}
+
+/**
+ * @brief Parse a list of values and ranges, e.g. "1,2,8:32:8".
+ * @return `false` on a syntax error.
+ */
+static bool parse_list(const char * str, std::vector<int> &values)
+{
+    values.clear();
+    while (*str)
+    {
+        char * end;
+        long first = strtol(str, &end, 0);
+        long last = first;
+        long step = 1;
+
+        if (end == str)
+        {
+            return false;
+        }
+        if (*end == ':')
+        {
+            str = end + 1;
+            last = strtol(str, &end, 0);
+            if (end == str)
+            {
+                return false;
+            }
+            if (*end == ':')
+            {
+                str = end + 1;
+                step = strtol(str, &end, 0);
+                if (end == str || step <= 0)
+                {
+                    return false;
+                }
+            }
+        }
+        for (long value = first; value <= last; value += step)
+        {
+            values.push_back((int)value);
+        }
+
+        if (*end == ',')
+        {
+            ++end;
+        }
+        else if (*end != '\0')
+        {
+            return false;
+        }
+        str = end;
+    }
+    return !values.empty();
+}
+
+/**
+ * @brief Parse a list of switch policy names, e.g. "RR,LRU", or "all".
+ * @param policies OUT A bit (1 << policy) per policy listed.
+ * @return `false` on an unknown name.
+ */
+static bool parse_policies(const char * str, unsigned int &policies)
+{
+    policies = 0;
+    if (strcmp(str, "all") == 0)
+    {
+        policies = (1u << SWITCH_POLICY_COUNT) - 1;
+        return true;
+    }
+    while (*str)
+    {
+        size_t len = strcspn(str, ",");
+        int policy = 0;
+
+        while (policy < SWITCH_POLICY_COUNT &&
+               (strlen(policy_names[policy]) != len ||
+                strncmp(str, policy_names[policy], len) != 0))
+        {
+            ++policy;
+        }
+        if (policy == SWITCH_POLICY_COUNT)
+        {
+            return false;
+        }
+        policies |= 1u << policy;
+
+        str += len;
+        if (*str == ',')
+        {
+            ++str;
+        }
+    }
+    return policies != 0;
+}
+
+/**
+ * @brief Read configurations from a file, a line each. Parameters missing from
+ * a line are taken from `defaults`.
+ * @return `false` if the file cannot be read or has a syntax error.
+ */
+static bool read_configs(const char * fname,
+                         const sweep_config &defaults,
+                         std::vector<sweep_config> &configs)
+{
+    FILE * file = fopen(fname, "r");
+    char line[1024];
+    bool ok = true;
+
+    if (file == NULL)
+    {
+        return false;
+    }
+
+    while (ok && fgets(line, sizeof(line), file) != NULL)
+    {
+        sweep_config config = defaults;
+        bool empty = true;
+
+        for (char * tok = strtok(line, " \t\r\n");
+             tok != NULL;
+             tok = strtok(NULL, " \t\r\n"))
+        {
+            int * field;
+            char * end;
+
+            if (tok[0] == '#')
+            {
+                break;
+            }
+            switch (tok[0])
+            {
+                case 'L': field = &config.load_lat; break;
+                case 'S': field = &config.store_lat; break;
+                case 'O': field = &config.switch_cycles; break;
+                case 'N': field = &config.threads; break;
+                case 'W': field = &config.issue_width; break;
+                case 'T': field = &config.timeslice; break;
+                default: field = NULL; break;
+            }
+            if (field == NULL)
+            {
+                ok = false;
+                break;
+            }
+            *field = (int)strtol(tok + 1, &end, 0);
+            if (end == tok + 1 || *end != '\0')
+            {
+                ok = false;
+                break;
+            }
+            empty = false;
+        }
+
+        if (ok && !empty)
+        {
+            configs.push_back(config);
+        }
+    }
+
+    fclose(file);
+    return ok;
+}
+
+/**
+ * @brief Print the blocked cycles and CPI under each compared policy, as CSV
+ * fields, or as their names for `r` NULL.
+ */
+static void print_policies_csv(const sweep_result * r, unsigned int policies)
+{
+    for (int policy = 0; policy < SWITCH_POLICY_COUNT; ++policy)
+    {
+        if (!(policies & (1u << policy)))
+        {
+            continue;
+        }
+        if (r == NULL)
+        {
+            printf(",blocked_%s_cycles,blocked_%s_cpi", policy_names[policy],
+                   policy_names[policy]);
+        }
+        else
+        {
+            printf(",%zu,%.6f", r->blocked_policy_cycles[policy],
+                   r->blocked_policy_cpi[policy]);
+        }
+    }
+}
+
+static void print_csv(const std::vector<sweep_result> &results,
+                      unsigned int policies)
+{
+    printf("L,S,O,N,W,T,blocked_cycles,blocked_instructions,blocked_cpi");
+    print_policies_csv(NULL, policies);
+    printf(",finegrained_cycles,finegrained_instructions,finegrained_cpi,"
+           "smt_cycles,smt_instructions,smt_cpi\n");
+    for (const sweep_result &r : results)
+    {
+        printf("%d,%d,%d,%d,%d,%d,%zu,%zu,%.6f",
+               r.config.load_lat,
+               r.config.store_lat,
+               r.config.switch_cycles,
+               r.config.threads,
+               r.config.issue_width,
+               r.config.timeslice,
+               r.blocked_cycles,
+               r.blocked_instructions,
+               r.blocked_cpi);
+        print_policies_csv(&r, policies);
+        printf(",%zu,%zu,%.6f,%zu,%zu,%.6f\n",
+               r.finegrained_cycles,
+               r.finegrained_instructions,
+               r.finegrained_cpi,
+               r.smt_cycles,
+               r.smt_instructions,
+               r.smt_cpi);
+    }
+}
+
+static void print_json(const std::vector<sweep_result> &results,
+                       unsigned int policies)
+{
+    printf("[\n");
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const sweep_result &r = results[i];
+        const char * separator = "";
+
+        printf("  {\"L\": %d, \"S\": %d, \"O\": %d, \"N\": %d, \"W\": %d, "
+               "\"T\": %d, "
+               "\"blocked_cycles\": %zu, \"blocked_instructions\": %zu, "
+               "\"blocked_cpi\": %.6f, \"blocked_policies\": {",
+               r.config.load_lat,
+               r.config.store_lat,
+               r.config.switch_cycles,
+               r.config.threads,
+               r.config.issue_width,
+               r.config.timeslice,
+               r.blocked_cycles,
+               r.blocked_instructions,
+               r.blocked_cpi);
+        for (int policy = 0; policy < SWITCH_POLICY_COUNT; ++policy)
+        {
+            if (policies & (1u << policy))
+            {
+                printf("%s\"%s\": {\"cycles\": %zu, \"cpi\": %.6f}",
+                       separator,
+                       policy_names[policy],
+                       r.blocked_policy_cycles[policy],
+                       r.blocked_policy_cpi[policy]);
+                separator = ", ";
+            }
+        }
+        printf("}, "
+               "\"finegrained_cycles\": %zu, \"finegrained_instructions\": %zu, "
+               "\"finegrained_cpi\": %.6f, "
+               "\"smt_cycles\": %zu, \"smt_instructions\": %zu, "
+               "\"smt_cpi\": %.6f}%s\n",
+               r.finegrained_cycles,
+               r.finegrained_instructions,
+               r.finegrained_cpi,
+               r.smt_cycles,
+               r.smt_instructions,
+               r.smt_cpi,
+               i + 1 < results.size() ? "," : "");
+    }
+    printf("]\n");
+}
+
+int main(int argc, char const * argv[])
+{
+    SimMemory * mem;
+    sweep_config defaults;
+    SimSMTConfig smt;
+    SimSwitchConfig switching;
+    std::vector<int> grid[6];
+    const char * grid_args[6] = { NULL, NULL, NULL, NULL, NULL, NULL };
+    const char * configs_fname = NULL;
+    const char * cache_dir = getenv("SIM_RESULT_CACHE");
+    unsigned int policies = 0;
+    int workers = 0;
+    bool json = false;
+
+    if (argc < 2)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    for (int i = 2; i < argc; ++i)
+    {
+        const char * opt = argv[i];
+        if (strcmp(opt, "--json") == 0)
+        {
+            json = true;
+            continue;
+        }
+        if (i + 1 >= argc || strlen(opt) != 2 || opt[0] != '-')
+        {
+            usage(argv[0]);
+            return 2;
+        }
+
+        const char * arg = argv[++i];
+        switch (opt[1])
+        {
+            case 'L': grid_args[0] = arg; break;
+            case 'S': grid_args[1] = arg; break;
+            case 'O': grid_args[2] = arg; break;
+            case 'N': grid_args[3] = arg; break;
+            case 'W': grid_args[4] = arg; break;
+            case 'T': grid_args[5] = arg; break;
+            case 'P':
+                if (!parse_policies(arg, policies))
+                {
+                    fprintf(stderr, "Invalid policies: %s\n", arg);
+                    exit(2);
+                }
+                break;
+            case 'f': configs_fname = arg; break;
+            case 'j': workers = atoi(arg); break;
+            case 'C': cache_dir = arg; break;
+            default:
+                usage(argv[0]);
+                return 2;
+        }
+    }
+
+    mem = SIM_MemCreate();
+    if (mem == NULL || SIM_MemReset_r(mem, argv[1]) != 0)
+    {
+        fprintf(stderr, "Failed initializing memory simulator!\n");
+        exit(2);
+    }
+
+    defaults.load_lat = SIM_GetLoadLat_r(mem);
+    defaults.store_lat = SIM_GetStoreLat_r(mem);
+    defaults.switch_cycles = SIM_GetSwitchCycles_r(mem);
+    defaults.threads = SIM_GetThreadsNum_r(mem);
+    SIM_GetSMT_r(mem, &smt);
+    defaults.issue_width = (int)smt.width;
+    SIM_GetSwitchPolicy_r(mem, &switching);
+    defaults.timeslice = switching.timeslice > 0 ? (int)switching.timeslice :
+                                                   DEFAULT_TIMESLICE;
+    defaults.compared_policies = policies;
+
+    std::vector<sweep_config> configs;
+    if (configs_fname != NULL)
+    {
+        if (!read_configs(configs_fname, defaults, configs))
+        {
+            fprintf(stderr, "Failed reading configurations from %s\n",
+                    configs_fname);
+            exit(2);
+        }
+    }
+    else
+    {
+        int default_values[6] = { defaults.load_lat,
+                                  defaults.store_lat,
+                                  defaults.switch_cycles,
+                                  defaults.threads,
+                                  defaults.issue_width,
+                                  defaults.timeslice };
+        for (int p = 0; p < 6; ++p)
+        {
+            if (grid_args[p] == NULL)
+            {
+                grid[p].assign(1, default_values[p]);
+            }
+            else if (!parse_list(grid_args[p], grid[p]))
+            {
+                fprintf(stderr, "Invalid list: %s\n", grid_args[p]);
+                exit(2);
+            }
+        }
+
+        for (int l : grid[0])
+            for (int s : grid[1])
+                for (int o : grid[2])
+                    for (int n : grid[3])
+                        for (int w : grid[4])
+                            for (int t : grid[5])
+                            {
+                                sweep_config config = { l, s, o, n, w, t,
+                                                        policies };
+                                configs.push_back(config);
+                            }
+    }
+
+    std::vector<sweep_result> results(configs.size());
+    if (SWEEP_Run(mem, configs.data(), configs.size(), results.data(),
+                  workers, cache_dir) != 0)
+    {
+        fprintf(stderr, "Sweep failed: invalid configuration, or out of "
+                "memory (the image has %d threads)\n", defaults.threads);
+        exit(2);
+    }
+
+    if (json)
+    {
+        print_json(results, policies);
+    }
+    else
+    {
+        print_csv(results, policies);
+    }
+
+    SIM_MemDestroy(mem);
+    return 0;
+}
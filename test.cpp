@@ -1,144 +1,1710 @@
 
 #include "test.h"
-#include "core_api.cpp"
-#include "sim_api.c"
+#include "core_api.h"
+#include "sim_api.h"
+#include "sweep_api.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <assert.h>
+#include <stddef.h>
+#include <math.h>
+#include <string>
+#include <vector>
+
+/* ----- Helper Functions ----- */
+
+/**
+ * @brief Create a new, empty temporary file.
+ * @return The name of the file, to unlink once done.
+ */
+std::string temp_file()
+{
+    const char * tmpdir = getenv("TMPDIR");
+    std::string fname = std::string(tmpdir != NULL ? tmpdir : "/tmp") +
+                        "/sim_test_XXXXXX";
+    int fd = mkstemp(&fname[0]);
+
+    assert(fd >= 0);
+    close(fd);
+    return fname;
+}
+
+/**
+ * @brief Write a textual image to a new temporary file.
+ * @return The name of the file, to unlink once done.
+ */
+std::string write_image(const char * text)
+{
+    std::string fname = temp_file();
+    FILE * file = fopen(fname.c_str(), "w");
+    size_t written;
+
+    assert(file != NULL);
+    written = fwrite(text, 1, strlen(text), file);
+    assert(written == strlen(text));
+    fclose(file);
+    return fname;
+}
+
+/**
+ * @brief Load a textual image into a new simulation instance.
+ */
+SimInstance * load_image(const char * text)
+{
+    std::string fname = write_image(text);
+    SimInstance * sim = CORE_Create();
+    int loaded;
+
+    assert(sim != NULL);
+    loaded = CORE_Load(sim, fname.c_str());
+    assert(loaded == 0);
+    unlink(fname.c_str());
+    return sim;
+}
+
+/**
+ * @brief Read a whole file.
+ */
+std::string read_file(const std::string &fname)
+{
+    FILE * file = fopen(fname.c_str(), "rb");
+    std::string contents;
+    char chunk[4096];
+    size_t count;
+
+    assert(file != NULL);
+    while ((count = fread(chunk, 1, sizeof(chunk), file)) > 0)
+    {
+        contents.append(chunk, count);
+    }
+    fclose(file);
+    return contents;
+}
+
+/**
+ * @brief Write a whole file.
+ */
+void write_file(const std::string &fname, const std::string &contents)
+{
+    FILE * file = fopen(fname.c_str(), "wb");
+    size_t written;
+
+    assert(file != NULL);
+    written = fwrite(contents.data(), 1, contents.size(), file);
+    assert(written == contents.size());
+    fclose(file);
+}
+
+/**
+ * @brief Load a textual image that must fail to load.
+ * @return What the loader reported, without the file name, e.g.
+ * ":4:16: unexpected text after the instruction\n".
+ */
+std::string load_error(const char * text)
+{
+    std::string fname = write_image(text);
+    std::string errname = temp_file();
+    SimInstance * sim = CORE_Create();
+    int saved = dup(fileno(stderr));
+    FILE * err = fopen(errname.c_str(), "w");
+    std::string message;
+    int loaded;
+
+    assert(sim != NULL && saved >= 0 && err != NULL);
+    fflush(stderr);
+    dup2(fileno(err), fileno(stderr));
+    loaded = CORE_Load(sim, fname.c_str());
+    fflush(stderr);
+    dup2(saved, fileno(stderr));
+    close(saved);
+    fclose(err);
+    assert(loaded < 0);
+
+    message = read_file(errname);
+    assert(message.compare(0, fname.size(), fname) == 0);
+    message.erase(0, fname.size());
+    unlink(fname.c_str());
+    unlink(errname.c_str());
+    CORE_Destroy(sim);
+    return message;
+}
+
+/**
+ * @brief Get a register of a thread, as the last blocked MT run left it.
+ */
+int blocked_reg(SimInstance * sim, int tid, int reg)
+{
+    tcontext context[16];
+    CORE_BlockedMT_CTX_r(sim, context, tid);
+    return context[tid].reg[reg];
+}
+
+int finegrained_reg(SimInstance * sim, int tid, int reg)
+{
+    tcontext context[16];
+    CORE_FinegrainedMT_CTX_r(sim, context, tid);
+    return context[tid].reg[reg];
+}
+
+/**
+ * @brief Get the registers of a thread, as the last run of a mode left them.
+ */
+tcontext mode_context(SimInstance * sim, mt_mode mode, int tid)
+{
+    tcontext context[16];
+
+    switch (mode)
+    {
+        case MT_BLOCKED:
+            CORE_BlockedMT_CTX_r(sim, context, tid);
+            break;
+        case MT_FINEGRAINED:
+            CORE_FinegrainedMT_CTX_r(sim, context, tid);
+            break;
+        default:
+            CORE_SMT_CTX_r(sim, context, tid);
+            break;
+    }
+    return context[tid];
+}
+
+size_t mode_cycles(SimInstance * sim, mt_mode mode)
+{
+    switch (mode)
+    {
+        case MT_BLOCKED:
+            return CORE_BlockedMT_Cycles_r(sim);
+        case MT_FINEGRAINED:
+            return CORE_FinegrainedMT_Cycles_r(sim);
+        default:
+            return CORE_SMT_Cycles_r(sim);
+    }
+}
+
+size_t mode_instructions(SimInstance * sim, mt_mode mode)
+{
+    switch (mode)
+    {
+        case MT_BLOCKED:
+            return CORE_BlockedMT_Instructions_r(sim);
+        case MT_FINEGRAINED:
+            return CORE_FinegrainedMT_Instructions_r(sim);
+        default:
+            return CORE_SMT_Instructions_r(sim);
+    }
+}
 
 /* ----- Test Functions ----- */
 
 void test_ADD()
 {
-    tcontext context;
-    // Initialize registers
-    context.reg[0] = 5;
-    context.reg[1] = 10;
-    // Execute core_add
-    core_add(&context, 2, 0, 1); // Expected: reg[2] = 15
-    // Check the result
-    assert(context.reg[2] == 15);
-
-    // Additional test case
-    context.reg[0] = 20;
-    context.reg[1] = 30;
-    core_add(&context, 2, 0, 1); // Expected: reg[2] = 50
-    assert(context.reg[2] == 50);
+    SimInstance * sim = load_image("N1\nT0\nI@0x0\n"
+                                   "ADDI $1, $0, 5\n"
+                                   "ADDI $2, $0, 10\n"
+                                   "ADD $3, $1, $2\n"
+                                   "ADD $4, $3, $3\n"
+                                   "HALT\n");
+    CORE_BlockedMT_r(sim);
+    assert(blocked_reg(sim, 0, 3) == 15);
+    assert(blocked_reg(sim, 0, 4) == 30);
+    CORE_Destroy(sim);
 }
 
 void test_ADDI()
 {
-    tcontext context;
-    context.reg[0] = 5;
-    // Execute core_addi
-    core_addi(&context, 1, 0, 3); // Expected: reg[1] = 8
-    assert(context.reg[1] == 8);
-
-    // Additional test case
-    core_addi(&context, 1, 0, -3); // Expected: reg[1] = 2
-    assert(context.reg[1] == 2);
+    SimInstance * sim = load_image("N1\nT0\nI@0x0\n"
+                                   "ADDI $1, $0, 5\n"
+                                   "ADDI $1, $1, 3\n"
+                                   "ADDI $2, $1, -3\n"
+                                   "ADDI $3, $0, 0x10\n"
+                                   "HALT\n");
+    CORE_BlockedMT_r(sim);
+    assert(blocked_reg(sim, 0, 1) == 8);
+    assert(blocked_reg(sim, 0, 2) == 5);
+    assert(blocked_reg(sim, 0, 3) == 16);
+    CORE_Destroy(sim);
 }
 
 void test_SUB()
 {
-    tcontext context;
-    context.reg[0] = 15;
-    context.reg[1] = 5;
-    // Execute core_sub
-    core_sub(&context, 2, 0, 1); // Expected: reg[2] = 10
-    assert(context.reg[2] == 10);
-
-    // Additional test case
-    core_sub(&context, 2, 1, 0); // Expected: reg[2] = -10
-    assert(context.reg[2] == -10);
+    SimInstance * sim = load_image("N1\nT0\nI@0x0\n"
+                                   "ADDI $1, $0, 15\n"
+                                   "ADDI $2, $0, 5\n"
+                                   "SUB $3, $1, $2\n"
+                                   "SUB $4, $2, $1\n"
+                                   "HALT\n");
+    CORE_BlockedMT_r(sim);
+    assert(blocked_reg(sim, 0, 3) == 10);
+    assert(blocked_reg(sim, 0, 4) == -10);
+    CORE_Destroy(sim);
 }
 
 void test_SUBI()
 {
-    tcontext context;
-    context.reg[0] = 10;
-    // Execute core_subi
-    core_subi(&context, 1, 0, 5); // Expected: reg[1] = 5
-    assert(context.reg[1] == 5);
+    SimInstance * sim = load_image("N1\nT0\nI@0x0\n"
+                                   "ADDI $1, $0, 10\n"
+                                   "SUBI $2, $1, 5\n"
+                                   "SUBI $3, $1, -5\n"
+                                   "HALT\n");
+    CORE_BlockedMT_r(sim);
+    assert(blocked_reg(sim, 0, 2) == 5);
+    assert(blocked_reg(sim, 0, 3) == 15);
+    CORE_Destroy(sim);
+}
 
-    // Additional test case
-    core_subi(&context, 1, 0, -5); // Expected: reg[1] = 15
-    assert(context.reg[1] == 15);
+/**
+ * @brief Blocked MT switches threads on a stall, paying the switch penalty,
+ * and switches back once the stalled thread is the only one ready.
+ */
+void test_BlockedSwitch()
+{
+    SimInstance * sim = load_image("L4\nS2\nO2\nN2\n"
+                                   "T0\nI@0x0\nLOAD $1, $0, 0\nHALT\n"
+                                   "T1\nI@0x0\nADDI $1, $0, 1\nHALT\n");
+    CORE_BlockedMT_r(sim);
+    // LOAD at 0, switch at 1-2, ADDI and HALT at 3-4, switch at 5-6, HALT
+    assert(CORE_BlockedMT_Cycles_r(sim) == 8);
+    assert(CORE_BlockedMT_Instructions_r(sim) == 4);
+    assert(CORE_BlockedMT_CPI_r(sim) == 2.0);
+    CORE_Destroy(sim);
 }
 
-void test_FindNextThread()
+/**
+ * @brief Blocked cycles of an image, as loaded.
+ */
+size_t blocked_cycles(const std::string &text)
 {
-    long int remainingExecutionTime[] = { 0, 10, 5, 0 };
-    int totalThreads = sizeof(remainingExecutionTime) / sizeof(long int);
-    // Execute FindNextThread
-    int nextThread = FindNextThread(0, totalThreads, remainingExecutionTime);
-    // Expected: next thread is 1
-    assert(nextThread == 1);
+    SimInstance * sim = load_image(text.c_str());
+    size_t cycles;
 
-    // Additional test case: No active threads
-    remainingExecutionTime[1] = 0;
-    remainingExecutionTime[2] = 0;
-    nextThread = FindNextThread(0, totalThreads, remainingExecutionTime);
-    // Expected: no active thread, return -1
-    assert(nextThread == -1);
+    CORE_BlockedMT_r(sim);
+    cycles = CORE_BlockedMT_Cycles_r(sim);
+    CORE_Destroy(sim);
+    return cycles;
 }
 
-void test_ExecuteInstruction_ADD()
+/**
+ * @brief Blocked MT (LATENCY) waits for a stall shorter than a context
+ * switch, where RR switches away.
+ */
+void test_SwitchLatency()
 {
-    tcontext context;
-    Instruction instruction = { CMD_ADD, 2, 0, 1, false };
-    context.reg[0] = 5;
-    context.reg[1] = 10;
-    execute_instruction(instruction, &context);
-    assert(context.reg[2] == 15);
+    std::string threads = "N2\n"
+                           "T0\nI@0x0\nLOAD $1, $0, 0\nHALT\n"
+                           "T1\nI@0x0\n"
+                           "ADDI $1, $0, 1\n"
+                           "ADDI $1, $1, 1\n"
+                           "ADDI $1, $1, 1\n"
+                           "HALT\n";
+
+    // LOAD at 0, idle at 1-2, HALT at 3, switch at 4-6, T1 at 7-10
+    assert(blocked_cycles("L2\nO3\nBLATENCY\n" + threads) == 11);
+    // LOAD at 0, switch at 1-3, T1 at 4-7, switch at 8-10, HALT at 11
+    assert(blocked_cycles("L2\nO3\n" + threads) == 12);
 }
 
-void test_UpdateThreadExecutionTime()
+/**
+ * @brief Blocked MT (TIMESLICE) switches after a slice of instructions, even
+ * with no stall.
+ */
+void test_SwitchTimeslice()
 {
-    long int remainingExecutionTime[] = { 10, 20, 0, 5 };
-    int totalThreads = sizeof(remainingExecutionTime) / sizeof(long int);
-    UpdateThreadExecutionTime(totalThreads, remainingExecutionTime, 5);
-    assert(remainingExecutionTime[0] == 5);
-    assert(remainingExecutionTime[1] == 15);
-    assert(remainingExecutionTime[2] == 0);
-    assert(remainingExecutionTime[3] == 0);
+    // Two instructions per slice, each slice after a switch but the first
+    assert(blocked_cycles("O1\nBTIMESLICE,2\nN2\n"
+                          "T0\nI@0x0\n"
+                          "ADDI $1, $0, 1\n"
+                          "ADDI $1, $1, 1\n"
+                          "ADDI $1, $1, 1\n"
+                          "HALT\n"
+                          "T1\nI@0x0\n"
+                          "ADDI $1, $0, 1\n"
+                          "ADDI $1, $1, 1\n"
+                          "ADDI $1, $1, 1\n"
+                          "HALT\n") == 11);
 }
 
-void test_PerformLoad()
+/**
+ * @brief Blocked MT (PRIORITY) runs the highest priority thread first, with
+ * no switch before it, as RR does not switch before thread 0.
+ */
+void test_SwitchPriority()
 {
-    // Initialize simulated memory
+    // HALT at 0, switch at 1-5, HALT at 6: as RR
+    assert(blocked_cycles("O5\nBPRIORITY\nN2\n"
+                          "T0\nP1\nI@0x0\nHALT\n"
+                          "T1\nP9\nI@0x0\nHALT\n") == 7);
+    assert(blocked_cycles("O5\nN2\n"
+                          "T0\nI@0x0\nHALT\n"
+                          "T1\nI@0x0\nHALT\n") == 7);
 
-    tcontext context;
-    context.reg[0] = 0;  // Test value for src1
-    context.reg[1] = 10; // Base address for loading
-    context.reg[2] = 0;  // Initial value of the destination register
+    // LOAD of T1 at 0, switch at 1, T0 at 2-3, switch at 4, HALT at 5
+    assert(blocked_cycles("L3\nO1\nBPRIORITY\nN2\n"
+                          "T0\nP1\nI@0x0\nADDI $1, $0, 1\nHALT\n"
+                          "T1\nP9\nI@0x0\nLOAD $1, $0, 0\nHALT\n") == 6);
+}
+
+/**
+ * @brief Blocked MT (LRU) gives the core to the ready thread that ran least
+ * recently, where RR takes the next one in tid order.
+ */
+void test_SwitchLRU()
+{
+    std::string threads = "N3\n"
+                           "T0\nI@0x0\n"
+                           "LOAD $1, $0, 0\n"
+                           "LOAD $1, $0, 0\n"
+                           "HALT\n"
+                           "T1\nI@0x0\n"
+                           "STORE $0, $0, 0\n"
+                           "STORE $0, $0, 0\n"
+                           "HALT\n"
+                           "T2\nI@0x0\n"
+                           "STORE $0, $0, 0\n"
+                           "ADDI $1, $0, 1\n"
+                           "HALT\n";
 
-    Instruction instruction = { CMD_LOAD, 2, 1, 0, false }; // LOAD instruction
+    // At 7 both T0 and T2 are ready: LRU runs T0, whose second LOAD then
+    // overlaps T2 and T1
+    assert(blocked_cycles("L5\nS2\nO1\nBLRU\n" + threads) == 16);
+    assert(blocked_cycles("L5\nS2\nO1\n" + threads) == 19);
+}
 
-    execute_instruction(instruction, &context);
+/**
+ * @brief Fine-grained MT issues from the next ready thread every cycle, and
+ * idles while none is ready.
+ */
+void test_FinegrainedRoundRobin()
+{
+    SimInstance * sim = load_image("L4\nS2\nO2\nN2\n"
+                                   "T0\nI@0x0\nLOAD $1, $0, 0\nHALT\n"
+                                   "T1\nI@0x0\nADDI $1, $0, 1\nHALT\n");
+    CORE_FinegrainedMT_r(sim);
+    // LOAD, ADDI, HALT of T1, 2 idle cycles, HALT of T0 once the LOAD is done
+    assert(CORE_FinegrainedMT_Cycles_r(sim) == 6);
+    assert(CORE_FinegrainedMT_Instructions_r(sim) == 4);
+    CORE_Destroy(sim);
+}
 
-    assert(context.reg[2] == 123); // Check if the loaded value is correct
+void test_PerformLoad()
+{
+    SimInstance * sim = load_image("N1\nT0\nI@0x0\n"
+                                   "ADDI $1, $0, 8\n"
+                                   "LOAD $2, $1, 4\n"
+                                   "LOAD $3, $0, 0x8\n"
+                                   "HALT\n"
+                                   "D@0x8\n0x7B\n");
+    CORE_BlockedMT_r(sim);
+    assert(blocked_reg(sim, 0, 2) == 0);    // 0xC is not initialized
+    assert(blocked_reg(sim, 0, 3) == 123);
+    CORE_Destroy(sim);
 }
 
 void test_PerformStore()
 {
-    // Initialize simulated memory
+    SimInstance * sim = load_image("N1\nT0\nI@0x0\n"
+                                   "ADDI $1, $0, 456\n"
+                                   "ADDI $2, $0, 16\n"
+                                   "STORE $2, $1, 4\n"
+                                   "STORE $0, $1, 0x20\n"
+                                   "LOAD $3, $2, 4\n"
+                                   "HALT\n");
+    int32_t value;
+
+    CORE_BlockedMT_r(sim);
+    assert(blocked_reg(sim, 0, 3) == 456);
+    CORE_DataRead_r(sim, MT_BLOCKED, 20, &value);
+    assert(value == 456);
+    CORE_DataRead_r(sim, MT_BLOCKED, 32, &value);
+    assert(value == 456);
+
+    // The run's STOREs are its own: the image is not written
+    SIM_MemDataRead_r(CORE_Memory(sim), 20, &value);
+    assert(value == 0);
+    CORE_Destroy(sim);
+}
+
+/**
+ * @brief A run checkpointed halfway and restored into a new instance ends
+ * exactly as the same run does uninterrupted, in every mode.
+ */
+void test_CheckpointRestore()
+{
+    // Threads loop over their own words, through a cache and a controller
+    const char * text = "L4\nS2\nO1\nJ1\nC256,2,16,1,6\nM2,2,3\nW2\nN3\n"
+                        "T0\nI@0x0\n"
+                        "ADDI $1, $0, 20\n"
+                        "LOAD $2, $3, 0x100\n"
+                        "ADD $2, $2, $1\n"
+                        "STORE $3, $2, 0x100\n"
+                        "ADDI $3, $3, 4\n"
+                        "SUBI $1, $1, 1\n"
+                        "BNE $1, $0, 1\n"
+                        "HALT\n"
+                        "T1\nI@0x0\n"
+                        "ADDI $1, $0, 15\n"
+                        "LOAD $2, $0, 0x200\n"
+                        "ADDI $2, $2, 3\n"
+                        "STORE $0, $2, 0x200\n"
+                        "SUBI $1, $1, 1\n"
+                        "BNE $1, $0, 1\n"
+                        "HALT\n"
+                        "T2\nI@0x0\n"
+                        "ADDI $1, $0, 30\n"
+                        "SUBI $1, $1, 1\n"
+                        "ADD $4, $4, $1\n"
+                        "BNE $1, $0, 1\n"
+                        "STORE $0, $4, 0x300\n"
+                        "HALT\n"
+                        "D@0x100\n0x5\n0x6\n0x7\n";
+    mt_mode modes[3] = { MT_BLOCKED, MT_FINEGRAINED, MT_SMT };
+
+    for (mt_mode mode : modes)
+    {
+        SimInstance * whole = load_image(text);
+        SimInstance * first = load_image(text);
+        SimInstance * second = load_image(text);
+        std::string fname = temp_file();
+        size_t half;
+        int result;
+
+        CORE_Start_r(whole, mode);
+        assert(CORE_RunUntil_r(whole, mode, (size_t)-1));
+        half = mode_cycles(whole, mode) / 2;
+
+        CORE_Start_r(first, mode);
+        assert(!CORE_RunUntil_r(first, mode, half));
+        result = CORE_Checkpoint_r(first, mode, fname.c_str());
+        assert(result == 0);
+        result = CORE_Restore_r(second, mode, fname.c_str());
+        assert(result == 0);
+        unlink(fname.c_str());
+        assert(CORE_RunUntil_r(second, mode, (size_t)-1));
+
+        assert(mode_cycles(second, mode) == mode_cycles(whole, mode));
+        assert(mode_instructions(second, mode) ==
+               mode_instructions(whole, mode));
+        for (int tid = 0; tid < 3; tid++)
+        {
+            tcontext expected = mode_context(whole, mode, tid);
+            tcontext restored = mode_context(second, mode, tid);
+            assert(memcmp(&expected, &restored, sizeof(expected)) == 0);
+        }
+        for (uint32_t addr = 0x100; addr < 0x310; addr += 4)
+        {
+            int32_t expected, restored;
+            CORE_DataRead_r(whole, mode, addr, &expected);
+            CORE_DataRead_r(second, mode, addr, &restored);
+            assert(expected == restored);
+        }
+
+        CORE_Destroy(whole);
+        CORE_Destroy(first);
+        CORE_Destroy(second);
+    }
+}
+
+// A textual image with every kind of instruction, data and parameters
+static const char * binary_text =
+    "L3\nS2\nO2\nJ1\nC256,2,16,1,6\nW2\nBLATENCY\nN2\n"
+    "T0\nP1\nI@0x0\n"
+    "ADDI $1, $0, 0x5A5A5A5A\n"
+    "ADDI $2, $0, 4\n"
+    "LOAD $3, $0, 0x40\n"
+    "ADD $4, $3, $1\n"
+    "STORE $0, $4, 0x44\n"
+    "SUBI $2, $2, 1\n"
+    "BNE $2, $0, 2\n"
+    "NOP\n"
+    "HALT\n"
+    "T1\nI@0x0\n"
+    "LOAD $1, $0, 0x44\n"
+    "SUB $2, $0, $1\n"
+    "BEQ $0, $0, 4\n"
+    "ADDI $3, $0, 1\n"
+    "ADDI $5, $0, 100\n"
+    "JMP $5\n"
+    "D@0x40\n0x12345678\n";
+
+/**
+ * @brief A binary image loads as the textual image it was compiled from, and
+ * simulates alike.
+ */
+void test_BinaryRoundTrip()
+{
+    SimInstance * text = load_image(binary_text);
+    SimInstance * binary = CORE_Create();
+    std::string fname = temp_file();
+    uint64_t text_hash[2], binary_hash[2];
+    mt_mode modes[3] = { MT_BLOCKED, MT_FINEGRAINED, MT_SMT };
+    int result;
+
+    result = SIM_MemSave_r(CORE_Memory(text), fname.c_str());
+    assert(result == 0);
+    result = CORE_Load(binary, fname.c_str());
+    assert(result == 0);
+    unlink(fname.c_str());
+
+    SIM_MemHash_r(CORE_Memory(text), text_hash);
+    SIM_MemHash_r(CORE_Memory(binary), binary_hash);
+    assert(memcmp(text_hash, binary_hash, sizeof(text_hash)) == 0);
+
+    CORE_BlockedMT_r(text);
+    CORE_BlockedMT_r(binary);
+    assert(CORE_BlockedMT_CPI_r(text) == CORE_BlockedMT_CPI_r(binary));
+    CORE_FinegrainedMT_r(text);
+    CORE_FinegrainedMT_r(binary);
+    assert(CORE_FinegrainedMT_CPI_r(text) == CORE_FinegrainedMT_CPI_r(binary));
+    CORE_SMT_r(text);
+    CORE_SMT_r(binary);
+    assert(CORE_SMT_CPI_r(text) == CORE_SMT_CPI_r(binary));
+    for (mt_mode mode : modes)
+    {
+        assert(mode_cycles(text, mode) == mode_cycles(binary, mode));
+        for (int tid = 0; tid < 2; tid++)
+        {
+            tcontext expected = mode_context(text, mode, tid);
+            tcontext loaded = mode_context(binary, mode, tid);
+            assert(memcmp(&expected, &loaded, sizeof(expected)) == 0);
+        }
+    }
+
+    CORE_Destroy(text);
+    CORE_Destroy(binary);
+}
+
+/**
+ * @brief Check that a binary image fails to load.
+ */
+void assert_binary_rejected(const std::string &fname, const std::string &image)
+{
+    SimInstance * sim = CORE_Create();
+    int result;
+
+    write_file(fname, image);
+    result = CORE_Load(sim, fname.c_str());
+    assert(result < 0);
+    CORE_Destroy(sim);
+}
+
+/**
+ * @brief A binary image with an instruction out of the register file, or a
+ * header whose sections do not fit the file (even once their offset and size
+ * wrap around), is rejected rather than mapped.
+ */
+void test_BinaryCorrupt()
+{
+    SimInstance * sim = load_image(binary_text);
+    std::string fname = temp_file();
+    std::string image, corrupt;
+    int32_t marker = 0x5A5A5A5A;
+    int32_t dst = 100000;
+    uint32_t cache[] = { 256, 2, 16, 1, 6 };
+    uint32_t code_size;
+    uint64_t code_offset, wrapped;
+    size_t at, offsets, sizes;
+    int result;
 
-    tcontext context;
-    context.reg[0] = 0;  // Test value for src1
-    context.reg[1] = 456; // Value to store
-    context.reg[2] = 10;  // Base address for storage
+    result = SIM_MemSave_r(CORE_Memory(sim), fname.c_str());
+    assert(result == 0);
+    CORE_Destroy(sim);
 
-    Instruction instruction = { CMD_STORE, 1, 2, 0, false }; // STORE instruction
+    image = read_file(fname);
 
-    execute_instruction(instruction, &context);
+    // The ADDI that loads the marker is the only instruction holding it, and
+    // the first of the code
+    at = image.find(std::string((const char *)&marker, sizeof(marker)));
+    assert(at != std::string::npos);
+    at -= offsetof(Instruction, src2_index_imm);
+    corrupt = image;
+    memcpy(&corrupt[at + offsetof(Instruction, dst_index)], &dst, sizeof(dst));
+    assert_binary_rejected(fname, corrupt);
 
-    // Check if the value is correctly stored
-    //assert(simulatedMemory[10] == 456); // This assumes simulatedMemory is accessible here
+    // The header holds the code size and page count right before the cache
+    // configuration, and the offsets of the code, thread tables, priorities,
+    // pages and page data in a row
+    code_offset = at;
+    sizes = image.find(std::string((const char *)cache, sizeof(cache)));
+    offsets = image.find(std::string((const char *)&code_offset,
+                                     sizeof(code_offset)));
+    assert(sizes != std::string::npos && sizes < at);
+    assert(offsets != std::string::npos && offsets < at);
+    sizes -= 2 * sizeof(uint32_t);
 
-    // Additional test case: storing at a different address
-    context.reg[2] = 20; // New base address for storage
-    execute_instruction(instruction, &context);
-    //assert(simulatedMemory[20] == 456); // Check the new storage location
+    // Code 16 MiB before the file, whose end wraps around into it
+    corrupt = image;
+    wrapped = 0 - ((uint64_t)1 << 24);
+    code_size = (1 << 24) / sizeof(Instruction) + 2;
+    memcpy(&corrupt[offsets], &wrapped, sizeof(wrapped));
+    memcpy(&corrupt[sizes], &code_size, sizeof(code_size));
+    assert_binary_rejected(fname, corrupt);
+
+    // Thread tables and pages that wrap around, or are not aligned
+    for (int section = 1; section <= 3; section += 2)
+    {
+        uint64_t offset;
+
+        corrupt = image;
+        wrapped = 0 - (uint64_t)sizeof(uint32_t);
+        memcpy(&corrupt[offsets + section * sizeof(uint64_t)], &wrapped,
+               sizeof(wrapped));
+        assert_binary_rejected(fname, corrupt);
+
+        corrupt = image;
+        memcpy(&offset, &image[offsets + section * sizeof(uint64_t)],
+               sizeof(offset));
+        offset += 2;
+        memcpy(&corrupt[offsets + section * sizeof(uint64_t)], &offset,
+               sizeof(offset));
+        assert_binary_rejected(fname, corrupt);
+    }
+
+    // The untouched image still loads
+    sim = CORE_Create();
+    write_file(fname, image);
+    result = CORE_Load(sim, fname.c_str());
+    assert(result == 0);
+    unlink(fname.c_str());
+    CORE_Destroy(sim);
+}
+
+/**
+ * @brief Branches go to an immediate or a register target, in every mode.
+ */
+void test_BranchTargets()
+{
+    SimInstance * sim = load_image("N1\nT0\nI@0x0\n"
+                                   "ADDI $1, $0, 1\n"
+                                   "BNE $1, $0, 3\n"     // taken
+                                   "ADDI $2, $0, 99\n"
+                                   "ADDI $3, $0, 6\n"
+                                   "JMP $3\n"
+                                   "ADDI $2, $0, 98\n"
+                                   "BEQ $1, $0, 0\n"     // not taken
+                                   "ADDI $4, $0, 7\n"
+                                   "HALT\n");
+    mt_mode modes[3] = { MT_BLOCKED, MT_FINEGRAINED, MT_SMT };
+
+    CORE_BlockedMT_r(sim);
+    CORE_FinegrainedMT_r(sim);
+    CORE_SMT_r(sim);
+    for (mt_mode mode : modes)
+    {
+        assert(mode_context(sim, mode, 0).reg[2] == 0);
+        assert(mode_context(sim, mode, 0).reg[4] == 7);
+        assert(mode_instructions(sim, mode) == 7);
+    }
+    CORE_Destroy(sim);
+}
+
+/**
+ * @brief Targets past the end of the program, and negative ones, go to the
+ * HALT appended to it.
+ */
+void test_BranchOutOfRange()
+{
+    SimInstance * sim = load_image("N3\n"
+                                   "T0\nI@0x0\n"
+                                   "ADDI $1, $0, 1\n"
+                                   "JMP 1000\n"
+                                   "ADDI $1, $0, 2\n"
+                                   "HALT\n"
+                                   "T1\nI@0x0\n"
+                                   "ADDI $2, $0, -5\n"
+                                   "JMP $2\n"
+                                   "ADDI $1, $0, 2\n"
+                                   "HALT\n"
+                                   "T2\nI@0x0\n"
+                                   "BEQ $0, $0, -1\n"
+                                   "ADDI $1, $0, 2\n"
+                                   "HALT\n");
+
+    CORE_BlockedMT_r(sim);
+    assert(blocked_reg(sim, 0, 1) == 1);
+    assert(blocked_reg(sim, 1, 1) == 0);
+    assert(blocked_reg(sim, 2, 1) == 0);
+    // ADDI, JMP and HALT; ADDI, JMP and HALT; BEQ and HALT
+    assert(CORE_BlockedMT_Instructions_r(sim) == 8);
+    CORE_Destroy(sim);
+}
+
+/**
+ * @brief A taken branch stalls its thread for the branch penalty: blocked MT
+ * waits for it without switching, while fine-grained MT issues the other
+ * threads meanwhile.
+ */
+void test_BranchPenalty()
+{
+    SimInstance * sim = load_image("J3\nO2\nN2\n"
+                                   "T0\nI@0x0\nJMP 1\nHALT\n"
+                                   "T1\nI@0x0\n"
+                                   "ADDI $1, $0, 1\n"
+                                   "ADDI $1, $1, 1\n"
+                                   "ADDI $1, $1, 1\n"
+                                   "HALT\n");
+
+    CORE_BlockedMT_r(sim);
+    // JMP at 0, idle at 1-3, HALT at 4, switch at 5-6, T1 at 7-10
+    assert(CORE_BlockedMT_Cycles_r(sim) == 11);
+    assert(CORE_BlockedMT_Instructions_r(sim) == 6);
+
+    CORE_FinegrainedMT_r(sim);
+    // T1 issues in the cycles T0 waits: no idle cycle
+    assert(CORE_FinegrainedMT_Cycles_r(sim) == 6);
+    assert(CORE_FinegrainedMT_Instructions_r(sim) == 6);
+    assert(finegrained_reg(sim, 1, 1) == 3);
+    CORE_Destroy(sim);
+}
+
+/**
+ * @brief Malformed images are rejected, with the file, line and column of the
+ * error.
+ */
+void test_ParseErrors()
+{
+    SimInstance * sim;
+
+    assert(load_error("N1\nT0\nI@0x0\nADD $1, $2, $3 $4\nHALT\n") ==
+           ":4:16: unexpected text after the instruction\n");
+    assert(load_error("N1\nT0\nI@0x0\nJMP 3 4\n") ==
+           ":4:7: unexpected text after the instruction\n");
+    assert(load_error("N1\nT0\nI@0x0\nNOP $1 x\n") ==
+           ":4:8: unexpected text after the instruction\n");
+    assert(load_error("N1\nT0\nI@0x0\nADD $1, $2, $99\n") ==
+           ":4:13: invalid register\n");
+    assert(load_error("N1\nT0\nI@0x0\nSUB $1, 2, $3\n") ==
+           ":4:9: expected a register\n");
+    assert(load_error("L-5\nN1\nT0\nI@0x0\nLOAD $1, $0, 0\n") ==
+           ":1:2: expected a non-negative load latency\n");
+    assert(load_error("S-3\nN1\nT0\nI@0x0\nSTORE $0, $1, 0\n") ==
+           ":1:2: expected a non-negative store latency\n");
+    assert(load_error("O-3\nN1\nT0\nI@0x0\nHALT\n") ==
+           ":1:2: expected a non-negative switch penalty\n");
+    assert(load_error("J-1\nN1\nT0\nI@0x0\nHALT\n") ==
+           ":1:2: expected a non-negative branch penalty\n");
+
+    // The setters refuse them as well
+    sim = load_image("N1\nT0\nI@0x0\nHALT\n");
+    assert(SIM_SetLoadLat_r(CORE_Memory(sim), -5) < 0);
+    assert(SIM_SetStoreLat_r(CORE_Memory(sim), -3) < 0);
+    assert(SIM_SetSwitchCycles_r(CORE_Memory(sim), -3) < 0);
+    assert(SIM_SetLoadLat_r(CORE_Memory(sim), 7) == 0);
+    assert(SIM_GetLoadLat_r(CORE_Memory(sim)) == 7);
+    CORE_Destroy(sim);
+}
+
+/**
+ * @brief Wake-ups further ahead than the wheel has slots go to its heap, in
+ * order with the ones on the wheel.
+ */
+void test_LongLatency()
+{
+    SimInstance * sim = load_image("L10000\nS3\nO2\nN2\n"
+                                   "T0\nI@0x0\nLOAD $1, $0, 0\nHALT\n"
+                                   "T1\nI@0x0\n"
+                                   "STORE $0, $0, 0\n"
+                                   "LOAD $1, $0, 0\n"
+                                   "HALT\n");
+
+    CORE_BlockedMT_r(sim);
+    // LOAD at 0, switch at 1-2, STORE at 3, LOAD at 7, switch at
+    // 10001-10002, HALT at 10003, switch at 10008-10009, HALT at 10010
+    assert(CORE_BlockedMT_Cycles_r(sim) == 10011);
+
+    CORE_FinegrainedMT_r(sim);
+    // LOAD at 0, STORE at 1, LOAD at 5, HALT of T0 at 10001, of T1 at 10006
+    assert(CORE_FinegrainedMT_Cycles_r(sim) == 10007);
+    CORE_Destroy(sim);
+}
+
+/**
+ * @brief Check that a functional run of an image ends in the architectural
+ * state of its blocked and fine-grained runs: the registers of every thread,
+ * and the words at `addrs`.
+ * @return What CORE_Functional_r returned.
+ */
+int functional_matches(const char * text,
+                       const std::vector<uint32_t> &addrs)
+{
+    SimInstance * sim = load_image(text);
+    int threads = SIM_GetThreadsNum_r(CORE_Memory(sim));
+    tcontext functional[16], blocked[16], finegrained[16];
+    int32_t value, expected;
+    int shared;
+
+    shared = CORE_Functional_r(sim);
+    assert(shared >= 0);
+    CORE_BlockedMT_r(sim);
+    CORE_FinegrainedMT_r(sim);
+    for (int tid = 0; tid < threads; tid++)
+    {
+        CORE_Functional_CTX_r(sim, functional, tid);
+        CORE_BlockedMT_CTX_r(sim, blocked, tid);
+        CORE_FinegrainedMT_CTX_r(sim, finegrained, tid);
+        for (int reg = 0; reg < REGS_COUNT; reg++)
+        {
+            assert(functional[tid].reg[reg] == blocked[tid].reg[reg]);
+            assert(functional[tid].reg[reg] == finegrained[tid].reg[reg]);
+        }
+    }
+    for (uint32_t addr : addrs)
+    {
+        CORE_Functional_DataRead_r(sim, addr, &value);
+        CORE_DataRead_r(sim, MT_BLOCKED, addr, &expected);
+        assert(value == expected);
+        CORE_DataRead_r(sim, MT_FINEGRAINED, addr, &expected);
+        assert(value == expected);
+    }
+    assert(CORE_Functional_Instructions_r(sim) ==
+           CORE_BlockedMT_Instructions_r(sim));
+    CORE_Destroy(sim);
+    return shared;
+}
+
+/**
+ * @brief The functional mode ends in the architectural state of the timed
+ * modes, whether its threads run in parallel or, sharing data, in tid order.
+ */
+void test_FunctionalMatches()
+{
+    // Each thread STOREs its own words: the threads run in parallel
+    assert(functional_matches("L3\nS2\nO1\nN3\n"
+                              "T0\nI@0x0\n"
+                              "ADDI $1, $0, 5\n"
+                              "ADDI $2, $0, 0\n"
+                              "ADD $2, $2, $1\n"
+                              "SUBI $1, $1, 1\n"
+                              "BNE $1, $0, 2\n"
+                              "STORE $0, $2, 0x10\n"
+                              "HALT\n"
+                              "T1\nI@0x0\n"
+                              "LOAD $1, $0, 0x20\n"
+                              "ADD $2, $1, $1\n"
+                              "STORE $0, $2, 0x24\n"
+                              "HALT\n"
+                              "T2\nI@0x0\n"
+                              "ADDI $1, $0, 3\n"
+                              "SUB $2, $0, $1\n"
+                              "STORE $0, $2, 0x30\n"
+                              "HALT\n"
+                              "D@0x20\n0x7B\n",
+                              {0x10, 0x20, 0x24, 0x30}) == 0);
+
+    // T1 LOADs what T0 STOREs, late enough in every mode: the threads run
+    // in tid order
+    assert(functional_matches("L1\nS1\nO1\nN2\n"
+                              "T0\nI@0x0\n"
+                              "ADDI $1, $0, 7\n"
+                              "STORE $0, $1, 0x40\n"
+                              "HALT\n"
+                              "T1\nI@0x0\n"
+                              "ADDI $4, $0, 1\n"
+                              "ADDI $4, $4, 1\n"
+                              "ADDI $4, $4, 1\n"
+                              "LOAD $2, $0, 0x40\n"
+                              "ADDI $3, $2, 1\n"
+                              "STORE $0, $3, 0x44\n"
+                              "HALT\n",
+                              {0x40, 0x44}) == 1);
+}
+
+/**
+ * @brief A multi-core run on one core is a run of its mode, whatever the
+ * quantum.
+ */
+void test_MultiCoreOneCore()
+{
+    SimInstance * sim = load_image("L4\nS2\nO2\nN3\n"
+                                   "T0\nI@0x0\n"
+                                   "LOAD $1, $0, 0x10\n"
+                                   "ADDI $2, $1, 1\n"
+                                   "STORE $0, $2, 0x14\n"
+                                   "HALT\n"
+                                   "T1\nI@0x0\n"
+                                   "ADDI $1, $0, 1\n"
+                                   "LOAD $2, $0, 0x14\n"
+                                   "ADD $3, $2, $1\n"
+                                   "HALT\n"
+                                   "T2\nI@0x0\n"
+                                   "STORE $0, $0, 0x10\n"
+                                   "LOAD $4, $0, 0x14\n"
+                                   "HALT\n"
+                                   "D@0x10\n0x7B\n");
+    tcontext single[16], multi[16];
+    mt_mode modes[] = { MT_BLOCKED, MT_FINEGRAINED };
+    size_t quanta[] = { 1, 3, 1000 };
+
+    CORE_BlockedMT_r(sim);
+    CORE_FinegrainedMT_r(sim);
+    for (mt_mode mode : modes)
+    {
+        for (size_t quantum : quanta)
+        {
+            assert(CORE_MultiCore_r(sim, 1, mode, quantum) == 0);
+            for (int tid = 0; tid < 3; tid++)
+            {
+                if (mode == MT_BLOCKED)
+                {
+                    CORE_BlockedMT_CTX_r(sim, single, tid);
+                }
+                else
+                {
+                    CORE_FinegrainedMT_CTX_r(sim, single, tid);
+                }
+                CORE_MultiCore_CTX_r(sim, multi, tid);
+                for (int reg = 0; reg < REGS_COUNT; reg++)
+                {
+                    assert(multi[tid].reg[reg] == single[tid].reg[reg]);
+                }
+            }
+            assert(CORE_MultiCore_Cycles_r(sim) ==
+                   (mode == MT_BLOCKED ? CORE_BlockedMT_Cycles_r(sim) :
+                                         CORE_FinegrainedMT_Cycles_r(sim)));
+        }
+    }
+    CORE_Destroy(sim);
+}
+
+/**
+ * @brief A STORE of one core is seen by the others from the end of its
+ * quantum on, not before.
+ */
+void test_MultiCoreQuantum()
+{
+    SimInstance * sim = load_image("L6\nS1\nO1\nN2\n"
+                                   "T0\nI@0x0\n"
+                                   "ADDI $1, $0, 9\n"
+                                   "STORE $0, $1, 0x40\n"
+                                   "HALT\n"
+                                   "T1\nI@0x0\n"
+                                   "ADDI $3, $0, 1\n"
+                                   "ADDI $3, $3, 1\n"
+                                   "ADDI $3, $3, 1\n"
+                                   "LOAD $1, $0, 0x40\n"
+                                   "LOAD $2, $0, 0x40\n"
+                                   "HALT\n");
+    tcontext context[16];
+    int32_t value;
+
+    // T0 STOREs at 1; T1 LOADs at 3, in the same quantum, and at 10, in the
+    // next one
+    assert(CORE_MultiCore_r(sim, 2, MT_BLOCKED, 10) == 0);
+    CORE_MultiCore_CTX_r(sim, context, 1);
+    assert(context[1].reg[1] == 0);
+    assert(context[1].reg[2] == 9);
+
+    // With a quantum of 20, both LOADs are in the quantum of the STORE
+    assert(CORE_MultiCore_r(sim, 2, MT_BLOCKED, 20) == 0);
+    CORE_MultiCore_CTX_r(sim, context, 1);
+    assert(context[1].reg[1] == 0);
+    assert(context[1].reg[2] == 0);
+
+    // The image is not written
+    SIM_MemDataRead_r(CORE_Memory(sim), 0x40, &value);
+    assert(value == 0);
+    CORE_Destroy(sim);
+}
+
+/**
+ * @brief Get the paths of the files in a directory.
+ */
+std::vector<std::string> dir_files(const std::string &dir)
+{
+    std::vector<std::string> files;
+    DIR * handle = opendir(dir.c_str());
+    struct dirent * entry;
+
+    assert(handle != NULL);
+    while ((entry = readdir(handle)) != NULL)
+    {
+        if (entry->d_name[0] != '.')
+        {
+            files.push_back(dir + "/" + entry->d_name);
+        }
+    }
+    closedir(handle);
+    return files;
+}
+
+/**
+ * @brief A stored result is found again with the same image and parameters,
+ * as if the run had run, and is a miss once a parameter of its key changes or
+ * its file is of another version or truncated.
+ */
+void test_ResultStore()
+{
+    const char * image = "L4\nS2\nO2\nN2\n"
+                         "T0\nI@0x0\nLOAD $1, $0, 0x10\nADDI $2, $1, 1\nHALT\n"
+                         "T1\nI@0x0\nADDI $1, $0, 1\nSTORE $0, $1, 0x14\nHALT\n"
+                         "D@0x10\n0x7B\n";
+    const char * tmpdir = getenv("TMPDIR");
+    std::string dir = std::string(tmpdir != NULL ? tmpdir : "/tmp") +
+                      "/sim_test_XXXXXX";
+    SimInstance * sim = load_image(image);
+    SimMemory * mem;
+    SimSwitchConfig switching = { SWITCH_LRU, 0 };
+    SimSMTConfig smt;
+    tcontext ran[16], found[16];
+    std::vector<std::string> files;
+    std::vector<std::string> contents;
+    size_t cycles, instructions;
+    char * made = mkdtemp(&dir[0]);
+
+    assert(made != NULL);
+    assert(CORE_ResultLookup_r(sim, MT_BLOCKED, dir.c_str()) == 0);
+    CORE_BlockedMT_r(sim);
+    cycles = CORE_BlockedMT_Cycles_r(sim);
+    instructions = CORE_BlockedMT_Instructions_r(sim);
+    CORE_BlockedMT_CTX_r(sim, ran, 0);
+    CORE_BlockedMT_CTX_r(sim, ran, 1);
+    assert(CORE_ResultStore_r(sim, MT_BLOCKED, dir.c_str()) == 0);
+    CORE_SMT_r(sim);
+    assert(CORE_ResultStore_r(sim, MT_SMT, dir.c_str()) == 0);
+    CORE_Destroy(sim);
+
+    // Another instance finds the run's result
+    sim = load_image(image);
+    mem = CORE_Memory(sim);
+    assert(CORE_ResultLookup_r(sim, MT_BLOCKED, dir.c_str()) == 1);
+    assert(CORE_BlockedMT_Cycles_r(sim) == cycles);
+    assert(CORE_BlockedMT_Instructions_r(sim) == instructions);
+    CORE_BlockedMT_CTX_r(sim, found, 0);
+    CORE_BlockedMT_CTX_r(sim, found, 1);
+    assert(memcmp(found, ran, 2 * sizeof(tcontext)) == 0);
+    assert(CORE_ResultLookup_r(sim, MT_FINEGRAINED, dir.c_str()) == 0);
+
+    // The load latency is in every key
+    assert(SIM_SetLoadLat_r(mem, 5) == 0);
+    assert(CORE_ResultLookup_r(sim, MT_BLOCKED, dir.c_str()) == 0);
+    assert(CORE_ResultLookup_r(sim, MT_SMT, dir.c_str()) == 0);
+    assert(SIM_SetLoadLat_r(mem, 4) == 0);
+
+    // The switch policy only in that of blocked MT
+    assert(SIM_SetSwitchPolicy_r(mem, &switching) == 0);
+    assert(CORE_ResultLookup_r(sim, MT_BLOCKED, dir.c_str()) == 0);
+    assert(CORE_ResultLookup_r(sim, MT_SMT, dir.c_str()) == 1);
+    switching.policy = SWITCH_RR;
+    assert(SIM_SetSwitchPolicy_r(mem, &switching) == 0);
+
+    // The SMT width only in that of SMT
+    SIM_GetSMT_r(mem, &smt);
+    smt.width++;
+    assert(SIM_SetSMT_r(mem, &smt) == 0);
+    assert(CORE_ResultLookup_r(sim, MT_SMT, dir.c_str()) == 0);
+    assert(CORE_ResultLookup_r(sim, MT_BLOCKED, dir.c_str()) == 1);
+    smt.width--;
+    assert(SIM_SetSMT_r(mem, &smt) == 0);
+    assert(CORE_ResultLookup_r(sim, MT_SMT, dir.c_str()) == 1);
+
+    // Files of another version, or truncated, are misses
+    files = dir_files(dir);
+    assert(files.size() == 2);
+    for (const std::string &fname : files)
+    {
+        contents.push_back(read_file(fname));
+        std::string other = contents.back();
+        other[8]++;     // the version, after the magic
+        write_file(fname, other);
+    }
+    assert(CORE_ResultLookup_r(sim, MT_BLOCKED, dir.c_str()) == 0);
+    assert(CORE_ResultLookup_r(sim, MT_SMT, dir.c_str()) == 0);
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        write_file(files[i], contents[i].substr(0, contents[i].size() - 1));
+    }
+    assert(CORE_ResultLookup_r(sim, MT_BLOCKED, dir.c_str()) == 0);
+    assert(CORE_ResultLookup_r(sim, MT_SMT, dir.c_str()) == 0);
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        write_file(files[i], contents[i]);
+    }
+    assert(CORE_ResultLookup_r(sim, MT_BLOCKED, dir.c_str()) == 1);
+
+    for (const std::string &fname : files)
+    {
+        unlink(fname.c_str());
+    }
+    rmdir(dir.c_str());
+    CORE_Destroy(sim);
+}
+
+/**
+ * @brief Access a sequence of lines of a cache.
+ * @return The hits ('h') and misses ('m') of the accesses, in order.
+ */
+std::string cache_accesses(SimCache * cache, const char * lines)
+{
+    std::string result;
+
+    for (const char * line = lines; *line != '\0'; line++)
+    {
+        // One line per letter, all in set 0 of a cache of one set
+        result += SIM_CacheAccess(cache, (uint32_t)(*line - 'A') * 16) ?
+                  'h' : 'm';
+    }
+    return result;
+}
+
+/**
+ * @brief A set evicts its least recently used line under LRU, and the line
+ * its tree points away from under PLRU.
+ */
+void test_CacheReplacement()
+{
+    SimCacheConfig config = { 64, 4, 16, 2, 10, CACHE_LRU };
+    SimCache * cache = SIM_CacheCreate(&config);
+
+    // E evicts B, the least recently used
+    assert(cache != NULL);
+    assert(cache_accesses(cache, "ABCDAE") == "mmmmhm");
+    assert(cache_accesses(cache, "C") == "h");
+    assert(cache_accesses(cache, "B") == "m");
+    SIM_CacheDestroy(cache);
+
+    // After A, the tree points to the half of C and D, then to C: E evicts C
+    config.policy = CACHE_PLRU;
+    cache = SIM_CacheCreate(&config);
+    assert(cache != NULL);
+    assert(cache_accesses(cache, "ABCDAE") == "mmmmhm");
+    assert(cache_accesses(cache, "B") == "h");
+    assert(cache_accesses(cache, "C") == "m");
+
+    // Reset invalidates all lines
+    SIM_CacheReset(cache);
+    assert(cache_accesses(cache, "AA") == "mh");
+    SIM_CacheDestroy(cache);
+}
+
+/**
+ * @brief With a data cache, a LOAD takes the hit or the miss latency instead
+ * of L, and counts as a hit or a miss of its thread. The threads of a core
+ * share the cache.
+ */
+void test_CacheLatency()
+{
+    SimInstance * sim = load_image("C256,4,16,2,10\nL4\nS1\nO1\nN2\n"
+                                   "T0\nI@0x0\nLOAD $1, $0, 0x0\nHALT\n"
+                                   "T1\nI@0x0\n"
+                                   "LOAD $1, $0, 0x4\n"
+                                   "LOAD $2, $0, 0x40\n"
+                                   "HALT\n");
+
+    CORE_FinegrainedMT_r(sim);
+    // LOAD of T0 at 0 misses, LOAD of T1 at 1 hits its line, LOAD of T1 at 4
+    // misses, HALT of T0 at 11, of T1 at 15
+    assert(CORE_FinegrainedMT_Cycles_r(sim) == 16);
+    assert(CORE_FinegrainedMT_CacheHits_r(sim, 0) == 0);
+    assert(CORE_FinegrainedMT_CacheMisses_r(sim, 0) == 1);
+    assert(CORE_FinegrainedMT_CacheHits_r(sim, 1) == 1);
+    assert(CORE_FinegrainedMT_CacheMisses_r(sim, 1) == 1);
+    CORE_Destroy(sim);
+}
+
+/**
+ * @brief A memory request waits for a free MSHR, then for its bank, before
+ * taking its latency.
+ */
+void test_MemCtrlRequests()
+{
+    SimMemCtrlConfig config = { 2, 2, 4, 64 };
+    SimMemCtrl * ctrl = SIM_MemCtrlCreate(&config);
+
+    assert(ctrl != NULL);
+    assert(SIM_MemCtrlRequest(ctrl, 0x0, 0, 10) == 10);
+    // Bank 0 is busy until 4
+    assert(SIM_MemCtrlRequest(ctrl, 0x4, 0, 10) == 14);
+    // Bank 1 is free, but both MSHRs are held until 10
+    assert(SIM_MemCtrlRequest(ctrl, 0x40, 1, 10) == 20);
+    // Then until 14, when bank 0 is free again
+    assert(SIM_MemCtrlRequest(ctrl, 0x80, 2, 3) == 17);
+
+    SIM_MemCtrlReset(ctrl);
+    assert(SIM_MemCtrlRequest(ctrl, 0x0, 30, 10) == 40);
+    SIM_MemCtrlDestroy(ctrl);
+}
+
+/**
+ * @brief The LOADs of a core wait for each other in its memory controller:
+ * for a bank on a bank conflict, and for an MSHR when all are held.
+ */
+void test_MemCtrlContention()
+{
+    const char * threads = "L3\nS1\nO1\nN2\n"
+                           "T0\nI@0x0\nLOAD $1, $0, 0x0\nHALT\n"
+                           "T1\nI@0x0\nLOAD $1, $0, 0x40\nHALT\n";
+    SimInstance * sim = load_image(threads);
+
+    // LOADs at 0 and 1, HALTs at 4 and 5
+    CORE_FinegrainedMT_r(sim);
+    assert(CORE_FinegrainedMT_Cycles_r(sim) == 6);
+    CORE_Destroy(sim);
+
+    // One bank, busy for 5 cycles: the LOAD of T1 starts at 5, HALT at 9
+    sim = load_image((std::string("M1,4,5\n") + threads).c_str());
+    CORE_FinegrainedMT_r(sim);
+    assert(CORE_FinegrainedMT_Cycles_r(sim) == 10);
+    CORE_Destroy(sim);
+
+    // Two banks, but one MSHR: the LOAD of T1 starts at 3, HALT at 7
+    sim = load_image((std::string("M2,1,1\n") + threads).c_str());
+    CORE_FinegrainedMT_r(sim);
+    assert(CORE_FinegrainedMT_Cycles_r(sim) == 8);
+    CORE_Destroy(sim);
+
+    // Two banks and two MSHRs: no wait
+    sim = load_image((std::string("M2,2,1\n") + threads).c_str());
+    CORE_FinegrainedMT_r(sim);
+    assert(CORE_FinegrainedMT_Cycles_r(sim) == 6);
+    CORE_Destroy(sim);
+}
+
+/**
+ * @brief SMT issues up to its width of instructions per cycle, each from
+ * another ready thread.
+ */
+void test_SMTWidth()
+{
+    const char * threads = "N2\n"
+                           "T0\nI@0x0\n"
+                           "ADDI $1, $0, 1\n"
+                           "ADDI $1, $1, 1\n"
+                           "ADDI $1, $1, 1\n"
+                           "HALT\n"
+                           "T1\nI@0x0\n"
+                           "ADDI $1, $0, 1\n"
+                           "ADDI $1, $1, 1\n"
+                           "ADDI $1, $1, 1\n"
+                           "HALT\n";
+    SimInstance * sim = load_image(threads);
+
+    CORE_SMT_r(sim);
+    assert(CORE_SMT_Cycles_r(sim) == 8);
+    assert(CORE_SMT_Instructions_r(sim) == 8);
+    CORE_Destroy(sim);
+
+    sim = load_image((std::string("W2\n") + threads).c_str());
+    CORE_SMT_r(sim);
+    assert(CORE_SMT_Cycles_r(sim) == 4);
+    assert(CORE_SMT_CPI_r(sim) == 0.5);
+    CORE_Destroy(sim);
+
+    // No more than one instruction of a thread per cycle
+    sim = load_image((std::string("W4\n") + threads).c_str());
+    CORE_SMT_r(sim);
+    assert(CORE_SMT_Cycles_r(sim) == 4);
+    CORE_Destroy(sim);
+}
+
+/**
+ * @brief SMT (ICOUNT) issues from the ready thread that issued the fewest
+ * instructions, where RR takes the next one after the last it picked.
+ */
+void test_SMTFetchPolicy()
+{
+    std::string threads = "L3\nN3\n"
+                          "T0\nI@0x0\n"
+                          "LOAD $1, $0, 0\n"
+                          "LOAD $2, $0, 0\n"
+                          "HALT\n"
+                          "T1\nI@0x0\n"
+                          "ADDI $1, $0, 1\n"
+                          "ADDI $1, $1, 1\n"
+                          "HALT\n"
+                          "T2\nI@0x0\n"
+                          "ADDI $1, $0, 1\n"
+                          "ADDI $1, $1, 1\n"
+                          "HALT\n";
+    SimInstance * sim;
+
+    // T0 is ready again at 4: RR issues T2 first, and T0 at 5, whose second
+    // LOAD then holds the HALT of T0 until 9
+    sim = load_image(("W1,RR\n" + threads).c_str());
+    CORE_SMT_r(sim);
+    assert(CORE_SMT_Cycles_r(sim) == 10);
+    CORE_Destroy(sim);
+
+    // ICOUNT issues T0 at 4, having issued as few as T2
+    sim = load_image(("W1,ICOUNT\n" + threads).c_str());
+    CORE_SMT_r(sim);
+    assert(CORE_SMT_Cycles_r(sim) == 9);
+    CORE_Destroy(sim);
+}
+
+/**
+ * @brief Sampling a long run estimates its CPI within the confidence interval
+ * it reports, simulating only a small part of it in detail.
+ */
+void test_SampleAccuracy()
+{
+    std::string text = "C1024,2,16,1,20\nL4\nS2\nO2\nN4\n";
+    sample_config config = { 10000, 300, 500, 0 };
+    sample_result result;
+    mt_mode modes[] = { MT_BLOCKED, MT_FINEGRAINED };
+    double cpi;
+    size_t instructions;
+
+    // Each thread walks the data with its own stride, through a cache it
+    // shares with the others, so they finish one after the other
+    for (int tid = 0; tid < 4; tid++)
+    {
+        std::string stride = std::to_string(4 + 8 * tid);
+        text += "T" + std::to_string(tid) + "\nI@0x0\n"
+                "ADDI $1, $0, 20000\n"
+                "ADDI $3, $0, " + stride + "\n"
+                "LOAD $2, $3, 0\n"
+                "ADD $4, $4, $2\n"
+                "ADDI $3, $3, " + stride + "\n"
+                "SUBI $1, $1, 1\n"
+                "BNE $1, $0, 2\n"
+                "HALT\n";
+    }
+    SimInstance * sim = load_image(text.c_str());
+
+    for (mt_mode mode : modes)
+    {
+        if (mode == MT_BLOCKED)
+        {
+            CORE_BlockedMT_r(sim);
+            cpi = CORE_BlockedMT_CPI_r(sim);
+            instructions = CORE_BlockedMT_Instructions_r(sim);
+        }
+        else
+        {
+            CORE_FinegrainedMT_r(sim);
+            cpi = CORE_FinegrainedMT_CPI_r(sim);
+            instructions = CORE_FinegrainedMT_Instructions_r(sim);
+        }
+
+        assert(CORE_Sample_r(sim, mode, &config, &result) == 0);
+        assert(result.instructions == instructions);
+        assert(result.windows >= 40);
+        assert(fabs(result.cpi - cpi) <= result.error * result.cpi);
+
+        // No more than a tenth of the run is simulated in detail
+        assert(10 * (mode == MT_BLOCKED ?
+                     CORE_BlockedMT_Instructions_r(sim) :
+                     CORE_FinegrainedMT_Instructions_r(sim)) <= instructions);
+    }
+    CORE_Destroy(sim);
+}
+
+/**
+ * @brief The performance counters account for every cycle of a run: it
+ * retires an instruction, switches threads or idles.
+ */
+void test_Stats()
+{
+    const char * looped = "L4\nS2\nO2\nN2\n"
+                          "T0\nI@0x0\n"
+                          "ADDI $1, $0, 5\n"
+                          "LOAD $2, $0, 4\n"
+                          "STORE $2, $0, 8\n"
+                          "SUBI $1, $1, 1\n"
+                          "BNE $1, $0, 1\n"
+                          "HALT\n"
+                          "T1\nI@0x0\n"
+                          "ADDI $1, $0, 3\n"
+                          "LOAD $2, $0, 12\n"
+                          "SUBI $1, $1, 1\n"
+                          "BNE $1, $0, 1\n"
+                          "HALT\n"
+                          "D@0x4\n7\n";
+    const char * small = "L4\nS2\nN1\n"
+                         "T0\nI@0x0\n"
+                         "ADDI $1, $0, 1\n"
+                         "LOAD $2, $0, 4\n"
+                         "STORE $1, $0, 8\n"
+                         "HALT\n";
+    mt_mode modes[] = { MT_BLOCKED, MT_FINEGRAINED, MT_SMT };
+    SimInstance * sim = load_image(looped);
+    core_stats stats;
+    thread_stats thread;
+    size_t retired;
+
+#if SIM_STATS
+    CORE_SimulateMT_r(sim);
+    CORE_SMT_r(sim);
+    for (mt_mode mode : modes)
+    {
+        assert(CORE_GetStats_r(sim, mode, &stats) == 0);
+        retired = 0;
+        for (int op = 0; op < CMD_COUNT; op++)
+        {
+            retired += stats.retired[op];
+        }
+        assert(retired == mode_instructions(sim, mode));
+        assert(stats.cycles == mode_cycles(sim, mode) && stats.cycles > 0);
+        assert(stats.cycles == retired + stats.switch_cycles + stats.idle_cycles);
+        assert(stats.switch_cycles > 0 || mode != MT_BLOCKED);
+    }
+    CORE_Destroy(sim);
+
+    // ADDI at 0, LOAD at 1 ready at 6, STORE at 6 ready at 9, HALT at 9
+    sim = load_image(small);
+    CORE_BlockedMT_r(sim);
+    assert(CORE_GetThreadStats_r(sim, MT_BLOCKED, 0, &thread) == 0);
+    for (int op = 0; op < CMD_COUNT; op++)
+    {
+        bool once = op == CMD_ADDI || op == CMD_LOAD || op == CMD_STORE ||
+                    op == CMD_HALT;
+        assert(thread.retired[op] == (once ? 1u : 0u));
+    }
+    assert(thread.load_stall_cycles == 4);
+    assert(thread.store_stall_cycles == 2);
+    assert(thread.branch_stall_cycles == 0);
+    assert(CORE_GetStats_r(sim, MT_BLOCKED, &stats) == 0);
+    assert(stats.cycles == 10 && stats.idle_cycles == 6);
+#else
+    // Compiled out: make check-stats
+    (void)modes;
+    (void)small;
+    (void)retired;
+    CORE_BlockedMT_r(sim);
+    assert(CORE_GetStats_r(sim, MT_BLOCKED, &stats) < 0);
+    assert(CORE_GetThreadStats_r(sim, MT_BLOCKED, 0, &thread) < 0);
+#endif
+    CORE_Destroy(sim);
+}
+
+/**
+ * @brief Simulate a point of a sweep on its own, from an image that sets
+ * its parameters in the header.
+ * @param policy Switch policy of the blocked core, e.g. "TIMESLICE".
+ */
+SimInstance * sweep_point(const std::vector<std::string> &threads,
+                          const sweep_config &config,
+                          const char * policy)
+{
+    int timeslice = config.timeslice > 0 ? config.timeslice : 3;
+    std::string text = "L" + std::to_string(config.load_lat) +
+                       "\nS" + std::to_string(config.store_lat) +
+                       "\nO" + std::to_string(config.switch_cycles) +
+                       "\nW" + std::to_string(config.issue_width) +
+                       "\nB" + policy + "," + std::to_string(timeslice) +
+                       "\nN" + std::to_string(config.threads) + "\n";
+
+    for (int tid = 0; tid < config.threads; tid++)
+    {
+        text += threads[tid];
+    }
+    SimInstance * sim = load_image(text.c_str());
+    CORE_SimulateMT_r(sim);
+    CORE_SMT_r(sim);
+    return sim;
+}
+
+/**
+ * @brief Every point of a sweep gets the result of running its configuration
+ * on its own, however many workers share the points, and a sweep with an
+ * invalid point simulates none.
+ */
+void test_Sweep()
+{
+    std::vector<std::string> threads = {
+        "T0\nI@0x0\nADDI $1, $0, 4\nLOAD $2, $1, 0\nSTORE $2, $1, 4\n"
+        "SUBI $1, $1, 1\nBNE $1, $0, 1\nHALT\n",
+        "T1\nI@0x0\nLOAD $1, $0, 8\nADDI $2, $1, 1\nADDI $3, $2, 1\nHALT\n",
+        "T2\nI@0x0\nADDI $1, $0, 3\nSTORE $1, $0, 12\nSUBI $1, $1, 1\n"
+        "BNE $1, $0, 1\nHALT\n",
+    };
+    std::string text = "L1\nS1\nO0\nBTIMESLICE,3\nN3\n" +
+                       threads[0] + threads[1] + threads[2];
+    unsigned int compared = (1u << SWITCH_RR) | (1u << SWITCH_LRU);
+    std::vector<sweep_config> configs = {
+        { 4, 2, 2, 3, 1, 0, 0 },
+        { 4, 2, 2, 3, 2, 2, compared },
+        { 8, 1, 1, 2, 1, 2, 1u << SWITCH_TIMESLICE },
+        { 0, 0, 0, 1, 1, 1, 0 },
+        { 3, 5, 4, 3, 4, 0, compared },
+    };
+    const char * policies[SWITCH_POLICY_COUNT] = {
+        "RR", "LATENCY", "TIMESLICE", "PRIORITY", "LRU"
+    };
+    int workers[] = { 1, 16, 0 };
+    SimInstance * image = load_image(text.c_str());
+    const SimMemory * mem = CORE_Memory(image);
+    std::vector<sweep_result> results(configs.size());
+    const char * tmpdir = getenv("TMPDIR");
+    std::string dir = std::string(tmpdir != NULL ? tmpdir : "/tmp") +
+                      "/sim_test_XXXXXX";
+    char * made = mkdtemp(&dir[0]);
+
+    assert(made != NULL);
+    for (int count : workers)
+    {
+        memset(&results[0], 0, results.size() * sizeof(sweep_result));
+        assert(SWEEP_Run(mem, &configs[0], configs.size(), &results[0],
+                         count, NULL) == 0);
+
+        for (size_t i = 0; i < configs.size(); i++)
+        {
+            const sweep_result &result = results[i];
+            SimInstance * sim = sweep_point(threads, configs[i], "TIMESLICE");
+
+            assert(result.config.load_lat == configs[i].load_lat);
+            assert(result.blocked_cycles == CORE_BlockedMT_Cycles_r(sim));
+            assert(result.blocked_instructions ==
+                   CORE_BlockedMT_Instructions_r(sim));
+            assert(result.blocked_cpi == CORE_BlockedMT_CPI_r(sim));
+            assert(result.finegrained_cycles ==
+                   CORE_FinegrainedMT_Cycles_r(sim));
+            assert(result.finegrained_instructions ==
+                   CORE_FinegrainedMT_Instructions_r(sim));
+            assert(result.finegrained_cpi == CORE_FinegrainedMT_CPI_r(sim));
+            assert(result.smt_cycles == CORE_SMT_Cycles_r(sim));
+            assert(result.smt_instructions == CORE_SMT_Instructions_r(sim));
+            assert(result.smt_cpi == CORE_SMT_CPI_r(sim));
+            CORE_Destroy(sim);
+
+            for (int policy = 0; policy < SWITCH_POLICY_COUNT; policy++)
+            {
+                if (!(configs[i].compared_policies & (1u << policy)))
+                {
+                    assert(result.blocked_policy_cycles[policy] == 0);
+                    continue;
+                }
+                sim = sweep_point(threads, configs[i], policies[policy]);
+                assert(result.blocked_policy_cycles[policy] ==
+                       CORE_BlockedMT_Cycles_r(sim));
+                assert(result.blocked_policy_cpi[policy] ==
+                       CORE_BlockedMT_CPI_r(sim));
+                CORE_Destroy(sim);
+            }
+        }
+    }
+
+    // More threads than the image has, a negative latency, and TIMESLICE
+    // compared without a timeslice: nothing is simulated, even the valid
+    // points, so the result store stays empty
+    sweep_config invalid[] = {
+        { 4, 2, 2, 4, 1, 0, 0 },
+        { -1, 2, 2, 3, 1, 0, 0 },
+        { 4, 2, 2, 3, 1, 0, 1u << SWITCH_TIMESLICE },
+    };
+    for (const sweep_config &config : invalid)
+    {
+        sweep_config points[] = { configs[0], config };
+        sweep_result sentinel[2];
+
+        memset(sentinel, 0xA5, sizeof(sentinel));
+        memcpy(&results[0], sentinel, sizeof(sentinel));
+        assert(SWEEP_Run(mem, points, 2, &results[0], 2, dir.c_str()) == -1);
+        assert(memcmp(&results[0], sentinel, sizeof(sentinel)) == 0);
+        assert(dir_files(dir).empty());
+    }
+    rmdir(dir.c_str());
+    CORE_Destroy(image);
+}
+
+/**
+ * @brief A blocked run's trace has a record per issue, with the stall that
+ * follows and the switch that precedes it, and sim_trace turns it into a
+ * timeline.
+ */
+void test_Trace()
+{
+    SimInstance * sim = load_image("L4\nO2\nN2\n"
+                                   "T0\nI@0x0\n"
+                                   "LOAD $1, $0, 0\n"
+                                   "ADDI $2, $1, 1\n"
+                                   "HALT\n"
+                                   "T1\nI@0x0\n"
+                                   "ADDI $1, $0, 1\n"
+                                   "ADDI $1, $1, 1\n"
+                                   "HALT\n");
+    std::string fname = temp_file();
+
+#if SIM_TRACE
+    // cycle, event, switched, opcode, stall, tid, pc
+    const unsigned expected[][7] = {
+        { 0, TRACE_RUN, 0, MT_BLOCKED, 0, 0, 2 },
+        { 0, TRACE_ISSUE, 0, CMD_LOAD, 4, 0, 0 },
+        { 3, TRACE_ISSUE, 1, CMD_ADDI, 0, 1, 0 },
+        { 4, TRACE_ISSUE, 0, CMD_ADDI, 0, 1, 1 },
+        { 5, TRACE_ISSUE, 0, CMD_HALT, 0, 1, 2 },
+        { 5, TRACE_HALT, 0, 0, 0, 1, 2 },
+        { 8, TRACE_ISSUE, 1, CMD_ADDI, 0, 0, 1 },
+        { 9, TRACE_ISSUE, 0, CMD_HALT, 0, 0, 2 },
+        { 9, TRACE_HALT, 0, 0, 0, 0, 2 },
+    };
+    const size_t count = sizeof(expected) / sizeof(expected[0]);
+    const char * timeline =
+        "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n"
+        "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 0, \"args\": "
+        "{\"name\": \"run 0 core 0: blocked MT\"}},\n"
+        "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": 0, "
+        "\"args\": {\"name\": \"thread 0\"}},\n"
+        "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": 1, "
+        "\"args\": {\"name\": \"thread 1\"}},\n"
+        "{\"name\": \"LOAD\", \"ph\": \"X\", \"ts\": 0, \"dur\": 1, "
+        "\"pid\": 0, \"tid\": 0, \"args\": {\"pc\": 0}},\n"
+        "{\"name\": \"stall\", \"ph\": \"X\", \"ts\": 1, \"dur\": 4, "
+        "\"pid\": 0, \"tid\": 0, \"args\": {\"pc\": 0}},\n"
+        "{\"name\": \"switch\", \"ph\": \"X\", \"ts\": 1, \"dur\": 2, "
+        "\"pid\": 0, \"tid\": 1},\n"
+        "{\"name\": \"ADDI\", \"ph\": \"X\", \"ts\": 3, \"dur\": 1, "
+        "\"pid\": 0, \"tid\": 1, \"args\": {\"pc\": 0}},\n"
+        "{\"name\": \"ADDI\", \"ph\": \"X\", \"ts\": 4, \"dur\": 1, "
+        "\"pid\": 0, \"tid\": 1, \"args\": {\"pc\": 1}},\n"
+        "{\"name\": \"HALT\", \"ph\": \"X\", \"ts\": 5, \"dur\": 1, "
+        "\"pid\": 0, \"tid\": 1, \"args\": {\"pc\": 2}},\n"
+        "{\"name\": \"finished\", \"ph\": \"i\", \"s\": \"t\", \"ts\": 5, "
+        "\"pid\": 0, \"tid\": 1},\n"
+        "{\"name\": \"switch\", \"ph\": \"X\", \"ts\": 6, \"dur\": 2, "
+        "\"pid\": 0, \"tid\": 0},\n"
+        "{\"name\": \"ADDI\", \"ph\": \"X\", \"ts\": 8, \"dur\": 1, "
+        "\"pid\": 0, \"tid\": 0, \"args\": {\"pc\": 1}},\n"
+        "{\"name\": \"HALT\", \"ph\": \"X\", \"ts\": 9, \"dur\": 1, "
+        "\"pid\": 0, \"tid\": 0, \"args\": {\"pc\": 2}},\n"
+        "{\"name\": \"finished\", \"ph\": \"i\", \"s\": \"t\", \"ts\": 9, "
+        "\"pid\": 0, \"tid\": 0}\n"
+        "]}\n";
+    std::string json = temp_file();
+    std::string trace;
+    uint32_t header[2];
+    trace_batch batch;
+    const trace_record * records;
+
+    assert(CORE_TraceOpen_r(sim, fname.c_str()) == 0);
+    CORE_BlockedMT_r(sim);
+    assert(CORE_TraceClose_r(sim) == 0);
+    assert(CORE_BlockedMT_Cycles_r(sim) == 10);
+
+    // A single batch, the run's records in issue order
+    trace = read_file(fname);
+    assert(trace.size() == 8 + sizeof(header) + sizeof(batch) +
+                           count * sizeof(trace_record));
+    assert(trace.compare(0, 8, TRACE_MAGIC) == 0);
+    memcpy(header, &trace[8], sizeof(header));
+    assert(header[0] == TRACE_VERSION && header[1] == sizeof(trace_record));
+    memcpy(&batch, &trace[8 + sizeof(header)], sizeof(batch));
+    assert(batch.run == 0 && batch.core == 0 && batch.count == count);
+    assert(batch.switch_cycles == 2);
+    records = (const trace_record *)&trace[8 + sizeof(header) + sizeof(batch)];
+    for (size_t i = 0; i < count; i++)
+    {
+        assert(records[i].cycle == expected[i][0]);
+        assert(records[i].event == expected[i][1]);
+        assert(records[i].switched == expected[i][2]);
+        assert(records[i].opcode == expected[i][3]);
+        assert(records[i].stall == expected[i][4]);
+        assert(records[i].tid == expected[i][5]);
+        assert(records[i].pc == expected[i][6]);
+    }
+
+    assert(system(("./sim_trace " + fname + " " + json).c_str()) == 0);
+    assert(read_file(json) == timeline);
+    unlink(json.c_str());
+#else
+    // Compiled out: make check-trace
+    assert(CORE_TraceOpen_r(sim, fname.c_str()) < 0);
+    assert(CORE_TraceClose_r(sim) < 0);
+#endif
+    unlink(fname.c_str());
+    CORE_Destroy(sim);
 }
 
 /* ----- Main Entry Point ----- */
@@ -159,21 +1725,95 @@ int main(int argc, char const * argv[])
     test_SUBI();
     printf("Subi test passed\n");
 
-    test_FindNextThread();
-    printf("FindNextThread test passed\n");
+    test_BlockedSwitch();
+    printf("BlockedSwitch test passed\n");
 
-    test_ExecuteInstruction_ADD();
-    printf("ExecuteInstruction_ADD test passed\n");
+    test_FinegrainedRoundRobin();
+    printf("FinegrainedRoundRobin test passed\n");
 
-    test_UpdateThreadExecutionTime();
-    printf("UpdateThreadExecutionTime test passed\n");
+    test_SwitchLatency();
+    printf("SwitchLatency test passed\n");
+
+    test_SwitchTimeslice();
+    printf("SwitchTimeslice test passed\n");
+
+    test_SwitchPriority();
+    printf("SwitchPriority test passed\n");
+
+    test_SwitchLRU();
+    printf("SwitchLRU test passed\n");
 
-    SIM_MemDataWrite(10, 123);
     test_PerformLoad();
     printf("PerformLoad test passed\n");
 
     test_PerformStore();
     printf("PerformStore test passed\n");
 
+    test_CheckpointRestore();
+    printf("CheckpointRestore test passed\n");
+
+    test_BinaryRoundTrip();
+    printf("BinaryRoundTrip test passed\n");
+
+    test_BinaryCorrupt();
+    printf("BinaryCorrupt test passed\n");
+
+    test_BranchTargets();
+    printf("BranchTargets test passed\n");
+
+    test_BranchOutOfRange();
+    printf("BranchOutOfRange test passed\n");
+
+    test_BranchPenalty();
+    printf("BranchPenalty test passed\n");
+
+    test_ParseErrors();
+    printf("ParseErrors test passed\n");
+
+    test_LongLatency();
+    printf("LongLatency test passed\n");
+
+    test_FunctionalMatches();
+    printf("FunctionalMatches test passed\n");
+
+    test_MultiCoreOneCore();
+    printf("MultiCoreOneCore test passed\n");
+
+    test_MultiCoreQuantum();
+    printf("MultiCoreQuantum test passed\n");
+
+    test_ResultStore();
+    printf("ResultStore test passed\n");
+
+    test_CacheReplacement();
+    printf("CacheReplacement test passed\n");
+
+    test_CacheLatency();
+    printf("CacheLatency test passed\n");
+
+    test_MemCtrlRequests();
+    printf("MemCtrlRequests test passed\n");
+
+    test_MemCtrlContention();
+    printf("MemCtrlContention test passed\n");
+
+    test_SMTWidth();
+    printf("SMTWidth test passed\n");
+
+    test_SMTFetchPolicy();
+    printf("SMTFetchPolicy test passed\n");
+
+    test_SampleAccuracy();
+    printf("SampleAccuracy test passed\n");
+
+    test_Stats();
+    printf("Stats test passed\n");
+
+    test_Sweep();
+    printf("Sweep test passed\n");
+
+    test_Trace();
+    printf("Trace test passed\n");
+
     return 0;
 }
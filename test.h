@@ -9,14 +9,64 @@ void test_SUB();
 
 void test_SUBI();
 
-void test_FindNextThread();
+void test_BlockedSwitch();
 
-void test_ExecuteInstruction_ADD();
+void test_FinegrainedRoundRobin();
 
-void test_UpdateThreadExecutionTime();
+void test_SwitchLatency();
+
+void test_SwitchTimeslice();
+
+void test_SwitchPriority();
+
+void test_SwitchLRU();
 
 void test_PerformLoad();
 
 void test_PerformStore();
 
+void test_CheckpointRestore();
+
+void test_BinaryRoundTrip();
+
+void test_BinaryCorrupt();
+
+void test_BranchTargets();
+
+void test_BranchOutOfRange();
+
+void test_BranchPenalty();
+
+void test_ParseErrors();
+
+void test_LongLatency();
+
+void test_FunctionalMatches();
+
+void test_MultiCoreOneCore();
+
+void test_MultiCoreQuantum();
+
+void test_ResultStore();
+
+void test_CacheReplacement();
+
+void test_CacheLatency();
+
+void test_MemCtrlRequests();
+
+void test_MemCtrlContention();
+
+void test_SMTWidth();
+
+void test_SMTFetchPolicy();
+
+void test_SampleAccuracy();
+
+void test_Stats();
+
+void test_Sweep();
+
+void test_Trace();
+
 #endif //_TEST_H
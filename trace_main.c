@@ -0,0 +1,198 @@
+/* 046267 Computer Architecture - HW #4 */
+/* Trace converter: converts a cycle trace (see CORE_TraceOpen) to the Chrome
+ * trace event format, for chrome://tracing or Perfetto. A cycle shows as a
+ * microsecond; each core of each run is a process, with a row per thread. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "core_api.h"
+
+#define READ_BATCH 4096
+
+static const char * const opcode_names[CMD_COUNT] = {
+    "NOP", "ADD", "SUB", "ADDI", "SUBI", "LOAD", "STORE", "HALT", "BEQ", "BNE",
+    "JMP"
+};
+
+static const char * const mode_names[] = {
+    "blocked MT", "fine-grained MT", "SMT"
+};
+
+/**
+ * @brief Print an event, preceded by a separator unless it is the first.
+ */
+static void print_event(FILE * out, int * first, const char * event)
+{
+    fprintf(out, "%s\n%s", *first ? "" : ",", event);
+    *first = 0;
+}
+
+/**
+ * @brief Print the stall of `tid` at `pc`, from `begin` to `end`.
+ */
+static void print_stall(FILE * out, int * first, unsigned long long pid,
+                        uint32_t tid, uint32_t pc,
+                        unsigned long long begin, unsigned long long end)
+{
+    char event[256];
+
+    snprintf(event, sizeof(event),
+             "{\"name\": \"stall\", \"ph\": \"X\", "
+             "\"ts\": %llu, \"dur\": %llu, \"pid\": %llu, "
+             "\"tid\": %u, \"args\": {\"pc\": %u}}",
+             begin, end - begin, pid, tid, pc);
+    print_event(out, first, event);
+}
+
+int main(int argc, char const * argv[])
+{
+    FILE * in;
+    FILE * out = stdout;
+    char magic[8];
+    uint32_t header[2];
+    trace_batch batch;
+    trace_record * records;
+    unsigned long long begin = 0;   /* of the stall ended next */
+    char event[256];
+    size_t count;
+    int first = 1;
+
+    if (argc != 2 && argc != 3)
+    {
+        fprintf(stderr, "Usage: %s <trace> [json]\n", argv[0]);
+        return 2;
+    }
+
+    in = fopen(argv[1], "rb");
+    if (in == NULL ||
+        fread(magic, sizeof(magic), 1, in) != 1 ||
+        fread(header, sizeof(header), 1, in) != 1 ||
+        memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0 ||
+        header[0] != TRACE_VERSION ||
+        header[1] != sizeof(trace_record))
+    {
+        fprintf(stderr, "Failed reading %s: not a trace of this version\n",
+                argv[1]);
+        exit(2);
+    }
+
+    if (argc == 3)
+    {
+        out = fopen(argv[2], "w");
+        if (out == NULL)
+        {
+            fprintf(stderr, "Failed writing %s\n", argv[2]);
+            exit(2);
+        }
+    }
+
+    records = malloc(READ_BATCH * sizeof(trace_record));
+    if (records == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(2);
+    }
+
+    fprintf(out, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+    while (fread(&batch, sizeof(batch), 1, in) == 1)
+    {
+        /* Each core of each run is a process */
+        unsigned long long pid = ((unsigned long long)batch.run << 16) |
+                                 batch.core;
+
+        for (size_t i = 0; i < batch.count; ++i)
+        {
+            const trace_record * r = &records[i % READ_BATCH];
+
+            if (i % READ_BATCH == 0)
+            {
+                count = batch.count - i < READ_BATCH ? batch.count - i :
+                                                       READ_BATCH;
+                if (fread(records, sizeof(trace_record), count, in) != count)
+                {
+                    fprintf(stderr, "Failed reading %s: truncated\n",
+                            argv[1]);
+                    exit(2);
+                }
+            }
+
+            switch (r->event)
+            {
+                case TRACE_RUN:
+                    snprintf(event, sizeof(event),
+                             "{\"name\": \"process_name\", \"ph\": \"M\", "
+                             "\"pid\": %llu, \"args\": {\"name\": "
+                             "\"run %u core %u: %s\"}}",
+                             pid, batch.run, batch.core,
+                             r->opcode < 3 ? mode_names[r->opcode] : "?");
+                    print_event(out, &first, event);
+                    for (uint32_t tid = r->tid; tid < r->tid + r->pc; ++tid)
+                    {
+                        snprintf(event, sizeof(event),
+                                 "{\"name\": \"thread_name\", \"ph\": \"M\", "
+                                 "\"pid\": %llu, \"tid\": %u, \"args\": "
+                                 "{\"name\": \"thread %u\"}}",
+                                 pid, tid, tid);
+                        print_event(out, &first, event);
+                    }
+                    break;
+                case TRACE_ISSUE:
+                    /* The switch to tid, if any, ends right before */
+                    if (r->switched)
+                    {
+                        snprintf(event, sizeof(event),
+                                 "{\"name\": \"switch\", \"ph\": \"X\", "
+                                 "\"ts\": %llu, \"dur\": %u, "
+                                 "\"pid\": %llu, \"tid\": %u}",
+                                 (unsigned long long)r->cycle -
+                                     batch.switch_cycles,
+                                 batch.switch_cycles, pid, r->tid);
+                        print_event(out, &first, event);
+                    }
+                    snprintf(event, sizeof(event),
+                             "{\"name\": \"%s\", \"ph\": \"X\", \"ts\": %llu, "
+                             "\"dur\": 1, \"pid\": %llu, \"tid\": %u, "
+                             "\"args\": {\"pc\": %u}}",
+                             r->opcode < CMD_COUNT ?
+                                 opcode_names[r->opcode] : "?",
+                             (unsigned long long)r->cycle, pid, r->tid, r->pc);
+                    print_event(out, &first, event);
+                    /* A long stall follows as a STALL_BEGIN/END pair */
+                    if (r->stall > 0 && r->stall < TRACE_LONG_STALL)
+                    {
+                        print_stall(out, &first, pid, r->tid, r->pc,
+                                    r->cycle + 1, r->cycle + 1 + r->stall);
+                    }
+                    break;
+                case TRACE_STALL_BEGIN:
+                    begin = r->cycle;
+                    break;
+                case TRACE_STALL_END:
+                    print_stall(out, &first, pid, r->tid, r->pc, begin,
+                                r->cycle);
+                    break;
+                case TRACE_HALT:
+                    snprintf(event, sizeof(event),
+                             "{\"name\": \"finished\", \"ph\": \"i\", "
+                             "\"s\": \"t\", \"ts\": %llu, \"pid\": %llu, "
+                             "\"tid\": %u}",
+                             (unsigned long long)r->cycle, pid, r->tid);
+                    print_event(out, &first, event);
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+    fprintf(out, "\n]}\n");
+
+    free(records);
+    fclose(in);
+    if (out != stdout && fclose(out) != 0)
+    {
+        fprintf(stderr, "Failed writing %s\n", argv[2]);
+        exit(2);
+    }
+    return 0;
+}